@@ -0,0 +1,145 @@
+#include "Budget.h"
+
+#include <atomic>
+#include <cstring>
+
+#include "Stats.h"
+
+using namespace std;
+using namespace opentelemetry;
+
+namespace detail {
+
+// caps of Budget, 0 for none until Budget::Setup()
+size_t g_budgetMaxBytes = 0;
+size_t g_budgetMaxAttributes = 0;
+size_t g_budgetMaxValueLen = 0;
+
+atomic<size_t> g_budgetUsed(0);
+
+// ClipWriter: the string of an attribute value cut to max-value-len
+struct ClipWriter {
+    common::AttributeValue &_value;
+
+    void operator()(const char *v) {
+        auto text = nostd::string_view(v, strlen(v));
+        auto clipped = tracing::Budget::Clip(text);
+        if (clipped.size() != text.size()) {
+            _value = clipped;
+        }
+    }
+    void operator()(nostd::string_view v) {
+        auto clipped = tracing::Budget::Clip(v);
+        if (clipped.size() != v.size()) {
+            _value = clipped;
+        }
+    }
+    template <typename T>
+    void operator()(const T &) {}
+};
+
+} // namespace detail
+
+namespace tracing {
+
+void Budget::Setup(const BudgetOptions &options) noexcept {
+    detail::g_budgetMaxBytes = options._maxBytes;
+    detail::g_budgetMaxAttributes = options._maxAttributes;
+    detail::g_budgetMaxValueLen = options._maxValueLen;
+}
+
+bool Budget::Charge(size_t n) noexcept {
+    auto used = detail::g_budgetUsed.fetch_add(n, memory_order_relaxed) + n;
+    if (detail::g_budgetMaxBytes != 0 && used > detail::g_budgetMaxBytes) {
+        detail::g_budgetUsed.fetch_sub(n, memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void Budget::Force(size_t n) noexcept {
+    detail::g_budgetUsed.fetch_add(n, memory_order_relaxed);
+}
+
+void Budget::Release(size_t n) noexcept {
+    detail::g_budgetUsed.fetch_sub(n, memory_order_relaxed);
+}
+
+bool Budget::Exhausted() noexcept {
+    return detail::g_budgetMaxBytes != 0 && Used() >= detail::g_budgetMaxBytes;
+}
+
+size_t Budget::Used() noexcept {
+    return detail::g_budgetUsed.load(memory_order_relaxed);
+}
+
+size_t Budget::MaxAttributes() noexcept {
+    return detail::g_budgetMaxAttributes;
+}
+
+nostd::string_view Budget::Clip(nostd::string_view text) noexcept {
+    auto max = detail::g_budgetMaxValueLen;
+    if (max == 0 || text.size() <= max) {
+        return text;
+    }
+    // back off continuation bytes, a code point is never split
+    auto n = max;
+    while (n > 0 && ((uint8_t)text[n] & 0xc0u) == 0x80u) {
+        n--;
+    }
+    Stats::Add(kStatsAttrsTruncated);
+    return text.substr(0, n);
+}
+
+common::AttributeValue Budget::Clip(const common::AttributeValue &value) noexcept {
+    auto clipped = value;
+    nostd::visit(detail::ClipWriter{clipped}, value);
+    return clipped;
+}
+
+BudgetHold::BudgetHold(size_t base) noexcept
+    : _held(chunks(base))
+    , _used(base)
+    , _attributes(0) {
+    Budget::Force(_held);
+}
+
+BudgetHold::~BudgetHold() {
+    Budget::Release(_held);
+}
+
+bool BudgetHold::Grow(size_t n) noexcept {
+    if (_used + n > _held) {
+        auto more = chunks(_used + n) - _held;
+        if (!Budget::Charge(more)) {
+            return false;
+        }
+        _held += more;
+    }
+    _used += n;
+    return true;
+}
+
+void BudgetHold::Force(size_t n) noexcept {
+    if (_used + n > _held) {
+        auto more = chunks(_used + n) - _held;
+        Budget::Force(more);
+        _held += more;
+    }
+    _used += n;
+}
+
+bool BudgetHold::AddAttribute(size_t n) noexcept {
+    auto max = Budget::MaxAttributes();
+    if ((max != 0 && _attributes >= max) || !Grow(n)) {
+        return false;
+    }
+    _attributes++;
+    return true;
+}
+
+size_t BudgetHold::chunks(size_t n) noexcept {
+    return (n + kBudgetChunk - 1) / kBudgetChunk * kBudgetChunk;
+}
+
+} // namespace tracing
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <opentelemetry/common/attribute_value.h>
+
+#include <cstddef>
+
+namespace tracing {
+
+constexpr size_t kBudgetChunk = 512; // bytes a BudgetHold charges to the budget at a time
+
+// BudgetOptions: see budget in tracing.yml, 0 for no cap
+struct BudgetOptions {
+    BudgetOptions()
+        : _maxBytes(64u << 20)
+        , _maxAttributes(64)
+        , _maxValueLen(1024) {}
+
+    size_t _maxBytes;      // of all the spans buffered, recording or queued or being exported
+    size_t _maxAttributes; // per span
+    size_t _maxValueLen;   // bytes of each string attribute value and status message
+};
+
+// Budget: process-wide memory budget of the spans buffered between start and export. Recordables charge what they
+// hold through a BudgetHold, and release it once exported or dropped. While it is exhausted, new spans are dropped by
+// BudgetSampler, attributes which do not fit are dropped, and queued spans of lower lanes are released by
+// PriorityProcessor first. Nothing is capped until Setup().
+class Budget final {
+public:
+    // Setup: before the first span
+    static void Setup(const BudgetOptions &options) noexcept;
+    // Charge: n more bytes, false and nothing charged if they are over the budget
+    static bool Charge(size_t n) noexcept;
+    // Force: n more bytes, over the budget or not
+    static void Force(size_t n) noexcept;
+    // Release: n bytes charged before
+    static void Release(size_t n) noexcept;
+    // Exhausted: whether the budget is used up
+    static bool Exhausted() noexcept;
+    // Used: bytes charged now
+    static size_t Used() noexcept;
+    // MaxAttributes: per span, 0 for no cap
+    static size_t MaxAttributes() noexcept;
+    // Clip: text cut to max-value-len at a UTF-8 boundary, counted if it is cut
+    static opentelemetry::nostd::string_view Clip(opentelemetry::nostd::string_view text) noexcept;
+    // Clip: value with its string cut as above, other types as is
+    static opentelemetry::common::AttributeValue Clip(const opentelemetry::common::AttributeValue &value) noexcept;
+};
+
+// BudgetHold: what one recordable holds of the budget, charged by the chunk so most spans touch the budget only
+// when created and released
+class BudgetHold final {
+public:
+    // BudgetHold: base bytes are charged over the budget or not, the sampler keeps new spans out once it is exhausted
+    explicit BudgetHold(size_t base) noexcept;
+    ~BudgetHold();
+
+    BudgetHold(const BudgetHold &) = delete;
+    BudgetHold &operator=(const BudgetHold &) = delete;
+
+public:
+    // Grow: n more bytes, false if they are over the budget
+    bool Grow(size_t n) noexcept;
+    // Force: n more bytes, over the budget or not
+    void Force(size_t n) noexcept;
+    // AddAttribute: one more attribute of n bytes, false if it is over max-attributes or the budget
+    bool AddAttribute(size_t n) noexcept;
+
+private:
+    // chunks: bytes of the whole chunks covering n
+    static size_t chunks(size_t n) noexcept;
+
+private:
+    size_t _held;       // bytes charged to the budget
+    size_t _used;       // bytes in use, no more than _held
+    size_t _attributes; // attributes added
+};
+
+} // namespace tracing
@@ -0,0 +1,268 @@
+#include "Clock.h"
+
+#include <algorithm>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+namespace detail {
+
+constexpr int64_t kNanosPerSecond = 1000000000;
+constexpr int64_t kTscPeriod = kNanosPerSecond; // ns, kTsc is re-anchored once a period
+
+int64_t ReadClock(clockid_t id) {
+    struct timespec ts {};
+    clock_gettime(id, &ts);
+    return (int64_t)ts.tv_sec * kNanosPerSecond + ts.tv_nsec;
+}
+
+// all readers touch this line only, the writer is the clock thread (or Setup())
+struct alignas(64) ClockState {
+    atomic<unsigned> _mode{(unsigned)tracing::ClockMode::kPrecise};
+    // kCached: latest timestamps
+    atomic<int64_t> _wall{0};
+    atomic<int64_t> _steady{0};
+    // kTsc: base point and ns-per-tick as 32.32 fixed point, published together under _seq (odd while written)
+    atomic<unsigned> _seq{0};
+    atomic<uint64_t> _tscBase{0};
+    atomic<int64_t> _wallBase{0};
+    atomic<int64_t> _steadyBase{0};
+    atomic<uint64_t> _tscMult{0};
+};
+
+ClockState g_clock;
+
+// TscAnchor: one base point of kTsc as published in ClockState
+struct TscAnchor {
+    uint64_t _tsc;
+    uint64_t _mult;
+    int64_t _steady;
+    int64_t _wall;
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+bool InvariantTsc() {
+    unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0) {
+        return false;
+    }
+    return (edx & (1u << 8)) != 0;
+}
+
+uint64_t ReadTsc() {
+    return __rdtsc();
+}
+#else
+bool InvariantTsc() {
+    return false;
+}
+
+uint64_t ReadTsc() {
+    return 0;
+}
+#endif
+
+// TscScale: nanoseconds of delta ticks
+int64_t TscScale(uint64_t delta, uint64_t mult) {
+    return (int64_t)(((unsigned __int128)delta * mult) >> 32u);
+}
+
+// TscRead: wall or steady nanoseconds from one consistent base point, the tsc is read under the same sequence so it
+// is never before a base point published meanwhile
+int64_t TscRead(bool wall) {
+    unsigned seq;
+    uint64_t base, mult, tsc;
+    int64_t ns;
+    do {
+        seq = g_clock._seq.load(memory_order_acquire);
+        base = g_clock._tscBase.load(memory_order_relaxed);
+        mult = g_clock._tscMult.load(memory_order_relaxed);
+        ns = wall ? g_clock._wallBase.load(memory_order_relaxed) : g_clock._steadyBase.load(memory_order_relaxed);
+        tsc = ReadTsc();
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1u) != 0 || seq != g_clock._seq.load(memory_order_relaxed));
+    return ns + TscScale(tsc - base, mult);
+}
+
+} // namespace detail
+
+namespace tracing {
+
+Clock *Clock::Instance() {
+    static Clock instance;
+    return &instance;
+}
+
+Clock::Clock()
+    : _stop(true)
+    , _tick(1000)
+    , _thread()
+    , _tscLast(0)
+    , _steadyLast(0) {}
+
+Clock::~Clock() {
+    stop();
+}
+
+void Clock::Setup(ClockMode mode, chrono::microseconds tick) {
+    stop();
+    _tick = tick.count() > 0 ? tick : chrono::microseconds(1000);
+
+    if (mode == ClockMode::kTsc && !calibrate()) {
+        mode = ClockMode::kCoarse;
+    }
+    if (mode == ClockMode::kCached) {
+        detail::g_clock._wall.store(detail::ReadClock(CLOCK_REALTIME), memory_order_relaxed);
+        detail::g_clock._steady.store(detail::ReadClock(CLOCK_MONOTONIC), memory_order_relaxed);
+    }
+    detail::g_clock._mode.store((unsigned)mode, memory_order_release);
+
+    if (mode == ClockMode::kCached || mode == ClockMode::kTsc) {
+        _stop.store(false, memory_order_relaxed);
+        _thread = thread(&Clock::run, this);
+    }
+}
+
+ClockMode Clock::Mode() noexcept {
+    return (ClockMode)detail::g_clock._mode.load(memory_order_relaxed);
+}
+
+void Clock::Suspend() noexcept {
+    stop();
+}
+
+void Clock::Resume() {
+    auto mode = Mode();
+    if ((mode != ClockMode::kCached && mode != ClockMode::kTsc) || _thread.joinable()) {
+        return;
+    }
+    _stop.store(false, memory_order_relaxed);
+    _thread = thread(&Clock::run, this);
+}
+
+bool Clock::ParseMode(const string &name, ClockMode &mode) noexcept {
+    if (name == "precise") {
+        mode = ClockMode::kPrecise;
+    } else if (name == "coarse") {
+        mode = ClockMode::kCoarse;
+    } else if (name == "cached") {
+        mode = ClockMode::kCached;
+    } else if (name == "tsc") {
+        mode = ClockMode::kTsc;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int64_t Clock::WallNs() noexcept {
+    switch (Mode()) {
+    case ClockMode::kCoarse:
+        return detail::ReadClock(CLOCK_REALTIME_COARSE);
+    case ClockMode::kCached:
+        return detail::g_clock._wall.load(memory_order_relaxed);
+    case ClockMode::kTsc:
+        return detail::TscRead(true);
+    default:
+        return detail::ReadClock(CLOCK_REALTIME);
+    }
+}
+
+int64_t Clock::SteadyNs() noexcept {
+    switch (Mode()) {
+    case ClockMode::kCoarse:
+        return detail::ReadClock(CLOCK_MONOTONIC_COARSE);
+    case ClockMode::kCached:
+        return detail::g_clock._steady.load(memory_order_relaxed);
+    case ClockMode::kTsc:
+        return detail::TscRead(false);
+    default:
+        return detail::ReadClock(CLOCK_MONOTONIC);
+    }
+}
+
+int64_t Clock::Seconds() noexcept {
+    switch (Mode()) {
+    case ClockMode::kPrecise:
+    case ClockMode::kCoarse:
+        return (int64_t)time(nullptr); // vDSO, reads the coarse clock already
+    default:
+        return WallNs() / detail::kNanosPerSecond;
+    }
+}
+
+void Clock::run() {
+    while (!_stop.load(memory_order_relaxed)) {
+        if (Mode() == ClockMode::kCached) {
+            detail::g_clock._wall.store(detail::ReadClock(CLOCK_REALTIME), memory_order_relaxed);
+            detail::g_clock._steady.store(detail::ReadClock(CLOCK_MONOTONIC), memory_order_relaxed);
+            this_thread::sleep_for(_tick);
+        } else {
+            // kTsc: the rate is measured over the whole period, so that ntp adjustments are followed
+            this_thread::sleep_for(chrono::nanoseconds(detail::kTscPeriod));
+            recalibrate();
+        }
+    }
+}
+
+void Clock::stop() noexcept {
+    _stop.store(true, memory_order_relaxed);
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+bool Clock::calibrate() noexcept {
+    if (!detail::InvariantTsc()) {
+        return false;
+    }
+    // the first rate is measured over 10ms, which blocks the caller of Setup() but not the refresh thread
+    _tscLast = detail::ReadTsc();
+    _steadyLast = detail::ReadClock(CLOCK_MONOTONIC);
+    this_thread::sleep_for(chrono::milliseconds(10));
+    return recalibrate();
+}
+
+bool Clock::recalibrate() noexcept {
+    auto &clock = detail::g_clock;
+    auto seq = clock._seq.load(memory_order_relaxed);
+    detail::TscAnchor prev{clock._tscBase.load(memory_order_relaxed), clock._tscMult.load(memory_order_relaxed),
+                           clock._steadyBase.load(memory_order_relaxed), clock._wallBase.load(memory_order_relaxed)};
+    clock._seq.store(seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    // the new base point is read inside the sequence, readers which see the old one read their tsc before it
+    auto tsc = detail::ReadTsc();
+    auto steady = detail::ReadClock(CLOCK_MONOTONIC);
+    auto wall = detail::ReadClock(CLOCK_REALTIME);
+    auto ok = tsc > _tscLast && steady > _steadyLast;
+    auto next = prev;
+    if (ok) {
+        auto mult = (uint64_t)(((unsigned __int128)(steady - _steadyLast) << 32u) / (tsc - _tscLast));
+        next = detail::TscAnchor{tsc, mult, steady, wall};
+        if (prev._mult != 0) {
+            // never step back, stay on the line published before and slew into CLOCK_MONOTONIC within a period
+            auto predicted = prev._steady + detail::TscScale(tsc - prev._tsc, prev._mult);
+            if (predicted > steady) {
+                auto gap = min(predicted - steady, detail::kTscPeriod / 2);
+                next._mult -= (uint64_t)((unsigned __int128)mult * (uint64_t)gap / detail::kTscPeriod);
+                next._steady = predicted;
+            }
+        }
+        _tscLast = tsc;
+        _steadyLast = steady;
+    }
+
+    clock._tscBase.store(next._tsc, memory_order_relaxed);
+    clock._tscMult.store(next._mult, memory_order_relaxed);
+    clock._steadyBase.store(next._steady, memory_order_relaxed);
+    clock._wallBase.store(next._wall, memory_order_relaxed);
+    clock._seq.store(seq + 2, memory_order_release);
+    return ok;
+}
+
+} // namespace tracing
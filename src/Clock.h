@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+namespace tracing {
+
+// ClockMode: precision/cost trade-off of the Hornet clock source
+enum class ClockMode : unsigned {
+    kPrecise = 0, // CLOCK_REALTIME/CLOCK_MONOTONIC, and span timestamps are left to the SDK
+    kCoarse,      // CLOCK_*_COARSE, jiffy resolution (1~4ms) but vDSO-cheap on any clocksource
+    kCached,      // timestamp refreshed by a background thread every tick, one atomic load per read
+    kTsc,         // rdtsc calibrated against CLOCK_MONOTONIC, falls back to kCoarse without invariant tsc
+};
+
+// Clock: clock source shared by the sampler and span timing
+class Clock final {
+public:
+    static Clock *Instance();
+
+    ~Clock();
+
+    Clock(const Clock &) = delete;
+    Clock &operator=(const Clock &) = delete;
+
+public:
+    // Setup: switch clock mode, tick is the refresh period of kCached, kTsc is re-calibrated once a second
+    void Setup(ClockMode mode, std::chrono::microseconds tick);
+    // Mode: current clock mode
+    static ClockMode Mode() noexcept;
+    // ParseMode: "precise" | "coarse" | "cached" | "tsc"
+    static bool ParseMode(const std::string &name, ClockMode &mode) noexcept;
+    // Suspend: join the refresh thread, the last timestamps are kept (around fork())
+    void Suspend() noexcept;
+    // Resume: restart the refresh thread of kCached/kTsc after Suspend()
+    void Resume();
+
+public:
+    // WallNs: nanoseconds since epoch
+    static int64_t WallNs() noexcept;
+    // SteadyNs: nanoseconds of a monotonic clock
+    static int64_t SteadyNs() noexcept;
+    // Seconds: seconds since epoch
+    static int64_t Seconds() noexcept;
+
+private:
+    Clock();
+
+    void run();
+    void stop() noexcept;
+    // calibrate: measure the first tsc rate of kTsc, 10ms on the caller
+    bool calibrate() noexcept;
+    // recalibrate: publish a new base point with the rate measured since the last one, SteadyNs() never goes back
+    bool recalibrate() noexcept;
+
+private:
+    std::atomic<bool> _stop;
+    std::chrono::microseconds _tick;
+    std::thread _thread;
+    uint64_t _tscLast;   // tsc of the last calibration
+    int64_t _steadyLast; // CLOCK_MONOTONIC of the last calibration
+};
+
+} // namespace tracing
@@ -14,13 +14,48 @@ namespace jaeger {
 // See more in jaeger-client-cpp
 constexpr const char *kBinaryFormat = "trace-ctx";
 
+// flag bits besides sampled, the caller forces the trace to be kept
+constexpr uint8_t kDebugFlag = 0x02;
+
+// trace-id span-id parent-span-id flag baggage-number, followed by baggage if any
+constexpr size_t kBinaryHeaderSize = opentelemetry::trace::TraceId::kSize + opentelemetry::trace::SpanId::kSize * 2u +
+                                     sizeof(char) + sizeof(uint32_t); // 37
+
 } // namespace jaeger
 
+namespace w3c {
+
+// See more in https://www.w3.org/TR/trace-context
+constexpr const char *kTraceParent = "traceparent";
+constexpr const char *kTraceState = "tracestate";
+
+// version-trace-id-span-id-flags, 00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01
+constexpr size_t kTraceParentSize = 2u + 1u + opentelemetry::trace::TraceId::kSize * 2u + 1u +
+                                    opentelemetry::trace::SpanId::kSize * 2u + 1u + 2u; // 55
+
+} // namespace w3c
+
+namespace b3 {
+
+// See more in https://github.com/openzipkin/b3-propagation, keys in lower case as gRPC metadata requires
+constexpr const char *kSingle = "b3"; // trace-id-span-id[-sampled[-parent-span-id]]
+constexpr const char *kTraceId = "x-b3-traceid";
+constexpr const char *kSpanId = "x-b3-spanid";
+constexpr const char *kSampled = "x-b3-sampled";
+constexpr const char *kFlags = "x-b3-flags"; // "1" means debug, which implies sampled
+
+// flag bit of a remote context without a sampling state, which leaves the decision to this service. Never injected,
+// the spans started under it carry the decision instead.
+constexpr uint8_t kDeferFlag = 0x80;
+
+} // namespace b3
+
 // for built-in usage
 constexpr const char *kTraceTagCmd = "cmd"; // attribute 中的保留字段
 constexpr const char *kTraceTagUid = "uid"; // attribute 中的保留字段
 constexpr const char *kTraceTagRot = "rot"; // attribute 中的保留字段
 constexpr const char *kTraceTagErr = "err"; // attribute 中的保留字段
+constexpr const char *kTraceTagFlt = "flt"; // attribute 中的保留字段, spans exported by the flight recorder
 
 // ration [0, 10000]
 constexpr unsigned kMaxRatioValue = 10000; // 采样率精确度 万分之一
@@ -0,0 +1,94 @@
+#include "ContextStorage.h"
+
+#include <vector>
+
+using namespace std;
+using namespace opentelemetry;
+
+namespace detail {
+
+constexpr size_t kInitialDepth = 16; // enough for most call chains, grows on demand
+
+struct Frame {
+    explicit Frame(const context::Context &ctx)
+        : _ctx(ctx)
+        , _memo() {}
+
+    context::Context _ctx;
+    string _memo; // encoded _ctx, see CustomContextStorage::Memo()
+};
+
+// bumped on every change of the stack of this thread, see CustomContextStorage::Generation()
+thread_local uint64_t t_generation = 0;
+
+vector<Frame> &GetStack() {
+    static thread_local vector<Frame> stack;
+    if (stack.capacity() == 0) {
+        stack.reserve(kInitialDepth);
+    }
+    return stack;
+}
+
+} // namespace detail
+
+namespace tracing {
+
+context::Context CustomContextStorage::GetCurrent() noexcept {
+    return Current();
+}
+
+nostd::unique_ptr<context::Token> CustomContextStorage::Attach(const context::Context &context) noexcept {
+    Push(context);
+    return CreateToken(context);
+}
+
+bool CustomContextStorage::Detach(context::Token &token) noexcept {
+    auto &stack = detail::GetStack();
+    // in most cases, the context to be detached is on the top of the stack
+    for (auto i = stack.size(); i > 0; i--) {
+        if (token == stack[i - 1]._ctx) {
+            stack.erase(stack.begin() + (ptrdiff_t)(i - 1), stack.end());
+            detail::t_generation++;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t CustomContextStorage::Push(const context::Context &context) noexcept {
+    auto &stack = detail::GetStack();
+    auto depth = stack.size();
+    stack.emplace_back(context);
+    detail::t_generation++;
+    return depth;
+}
+
+void CustomContextStorage::Pop(size_t depth) noexcept {
+    auto &stack = detail::GetStack();
+    if (depth < stack.size()) {
+        stack.erase(stack.begin() + (ptrdiff_t)depth, stack.end());
+        detail::t_generation++;
+    }
+}
+
+context::Context CustomContextStorage::Current() noexcept {
+    auto &stack = detail::GetStack();
+    if (stack.empty()) {
+        return context::Context();
+    }
+    return stack.back()._ctx;
+}
+
+string *CustomContextStorage::Memo() noexcept {
+    auto &stack = detail::GetStack();
+    if (stack.empty()) {
+        return nullptr;
+    }
+    return &stack.back()._memo;
+}
+
+uint64_t CustomContextStorage::Generation() noexcept {
+    return detail::t_generation;
+}
+
+} // namespace tracing
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <opentelemetry/context/runtime_context.h>
+
+namespace tracing {
+
+// CustomContextStorage: thread-local context stack which can also be driven without Token
+class CustomContextStorage final : public opentelemetry::context::RuntimeContextStorage {
+public:
+    // GetCurrent: Return the current context.
+    opentelemetry::context::Context GetCurrent() noexcept override;
+    // Attach: Set the current context, the returned token restores the previous one.
+    opentelemetry::nostd::unique_ptr<opentelemetry::context::Token> Attach(
+        const opentelemetry::context::Context &context) noexcept override;
+    // Detach: Restore the context which was current before the token was attached.
+    bool Detach(opentelemetry::context::Token &token) noexcept override;
+
+public:
+    // Push: attach context without a token, returns the depth to Pop() back to
+    static size_t Push(const opentelemetry::context::Context &context) noexcept;
+    // Pop: detach everything attached since Push() returned depth
+    static void Pop(size_t depth) noexcept;
+    // Current: the current context of this thread, without a virtual call
+    static opentelemetry::context::Context Current() noexcept;
+    // Memo: per-context slot memoizing the encoded current context, nullptr if nothing is attached.
+    // A context never changes once attached (new baggage or trace state means a new context is attached), so the
+    // slot is dropped exactly when the current context changes.
+    static std::string *Memo() noexcept;
+    // Generation: bumped each time the current context of this thread may have changed
+    static uint64_t Generation() noexcept;
+};
+
+} // namespace tracing
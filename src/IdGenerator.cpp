@@ -0,0 +1,114 @@
+#include "IdGenerator.h"
+
+#include <endian.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <random>
+#include <thread>
+
+#include "Clock.h"
+
+using namespace std;
+using namespace opentelemetry;
+
+namespace detail {
+
+uint64_t SplitMix64(uint64_t &x) {
+    auto z = (x += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30u)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27u)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31u);
+}
+
+uint64_t Rotl(uint64_t x, unsigned k) {
+    return (x << k) | (x >> (64u - k));
+}
+
+// bumped after fork(), the child must not replay the parent's sequences
+atomic<unsigned> g_seedGeneration(0);
+
+// xoshiro256++, one instance per thread, see https://prng.di.unimi.it
+class Xoshiro final {
+public:
+    Xoshiro() noexcept
+        : _generation(0)
+        , _s() {
+        Seed(g_seedGeneration.load(memory_order_relaxed));
+    }
+
+    void Seed(unsigned generation) noexcept {
+        random_device rd;
+        auto seed = ((uint64_t)rd() << 32u) ^ rd() ^ (uint64_t)hash<thread::id>()(this_thread::get_id());
+        seed ^= (uint64_t)getpid() << 32u;
+        for (auto &s : _s) {
+            s = SplitMix64(seed);
+        }
+        _generation = generation;
+    }
+
+    unsigned Generation() const noexcept {
+        return _generation;
+    }
+
+    uint64_t Next() noexcept {
+        const auto result = Rotl(_s[0] + _s[3], 23) + _s[0];
+        const auto t = _s[1] << 17u;
+        _s[2] ^= _s[0];
+        _s[3] ^= _s[1];
+        _s[1] ^= _s[2];
+        _s[0] ^= _s[3];
+        _s[2] ^= t;
+        _s[3] = Rotl(_s[3], 45);
+        return result;
+    }
+
+private:
+    unsigned _generation; // g_seedGeneration when seeded
+    uint64_t _s[4];
+};
+
+Xoshiro &LocalRandom() {
+    static thread_local Xoshiro rng;
+    auto generation = g_seedGeneration.load(memory_order_relaxed);
+    if (rng.Generation() != generation) {
+        rng.Seed(generation);
+    }
+    return rng;
+}
+
+} // namespace detail
+
+namespace tracing {
+
+CustomIdGenerator::CustomIdGenerator(bool timeOrdered) noexcept
+    : _timeOrdered(timeOrdered) {}
+
+trace::SpanId CustomIdGenerator::GenerateSpanId() noexcept {
+    uint64_t id;
+    do {
+        id = detail::LocalRandom().Next();
+    } while (id == 0); // all-zero id is invalid
+    return trace::SpanId({(const uint8_t *)&id, trace::SpanId::kSize});
+}
+
+trace::TraceId CustomIdGenerator::GenerateTraceId() noexcept {
+    auto &rng = detail::LocalRandom();
+    uint64_t id[2] = {rng.Next(), rng.Next()};
+    if (_timeOrdered) {
+        // big-endian seconds in the leading bytes, so ids sort by creation time
+        auto ts = (uint64_t)(uint32_t)Clock::Seconds();
+        id[0] = htobe64((ts << 32u) | (id[0] & 0xffffffffull));
+    }
+    return trace::TraceId({(const uint8_t *)id, trace::TraceId::kSize});
+}
+
+uint64_t CustomIdGenerator::Random() noexcept {
+    return detail::LocalRandom().Next();
+}
+
+void CustomIdGenerator::Reseed() noexcept {
+    detail::g_seedGeneration.fetch_add(1, memory_order_relaxed);
+}
+
+} // namespace tracing
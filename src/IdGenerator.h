@@ -0,0 +1,28 @@
+#pragma once
+
+#include <opentelemetry/sdk/trace/id_generator.h>
+
+namespace tracing {
+
+class CustomIdGenerator final : public opentelemetry::sdk::trace::IdGenerator {
+public:
+    // timeOrdered: put the coarse timestamp (seconds) into the high 32 bits of trace ids
+    explicit CustomIdGenerator(bool timeOrdered = false) noexcept;
+
+public:
+    // GenerateSpanId: 64 random bits from the per-thread xoshiro256++ state
+    opentelemetry::trace::SpanId GenerateSpanId() noexcept override;
+    // GenerateTraceId: 128 random bits, or 32 bits of seconds followed by 96 random bits
+    opentelemetry::trace::TraceId GenerateTraceId() noexcept override;
+
+public:
+    // Random: 64 random bits from the same per-thread state
+    static uint64_t Random() noexcept;
+    // Reseed: every thread draws a fresh seed before its next id, called in the child after fork()
+    static void Reseed() noexcept;
+
+private:
+    const bool _timeOrdered;
+};
+
+} // namespace tracing
@@ -0,0 +1,530 @@
+#include "Jaeger.h"
+
+#include <netdb.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "Stats.h"
+
+using namespace std;
+using namespace opentelemetry;
+
+namespace detail {
+
+// ThriftType: type ids of the compact protocol
+enum ThriftType : uint8_t {
+    kThriftTrue = 1,
+    kThriftFalse = 2,
+    kThriftI32 = 5,
+    kThriftI64 = 6,
+    kThriftDouble = 7,
+    kThriftBinary = 8,
+    kThriftList = 9,
+    kThriftStruct = 12,
+};
+
+// JaegerTagType: jaeger.thrift TagType
+enum JaegerTagType : int32_t {
+    kJaegerString = 0,
+    kJaegerDouble = 1,
+    kJaegerBool = 2,
+    kJaegerLong = 3,
+    kJaegerBinary = 4,
+};
+
+constexpr size_t kMaxListHeader = 6;       // type byte and a varint size
+constexpr const char kBatchSuffix[2] = {}; // stops of Batch and of the emitBatch args
+constexpr unsigned kMaxBurst = 1024;       // datagrams per sendmmsg()
+
+void ThriftVarint(string &out, uint64_t v) {
+    while (v >= 0x80u) {
+        out.push_back((char)(v | 0x80u));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+void ThriftI32(string &out, int32_t v) {
+    ThriftVarint(out, (uint32_t)(((uint32_t)v << 1) ^ (uint32_t)(v >> 31)));
+}
+
+void ThriftI64(string &out, int64_t v) {
+    ThriftVarint(out, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+void ThriftDouble(string &out, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    for (auto i = 0; i < 8; i++) {
+        out.push_back((char)(bits >> (8 * i))); // little endian
+    }
+}
+
+void ThriftBinary(string &out, nostd::string_view v) {
+    ThriftVarint(out, v.size());
+    out.append(v.data(), v.size());
+}
+
+// ThriftField: header of field id, last is the previous field id in the same struct
+void ThriftField(string &out, int16_t &last, int16_t id, uint8_t type) {
+    if (id > last && id - last <= 15) {
+        out.push_back((char)(((id - last) << 4) | type));
+    } else {
+        out.push_back((char)type);
+        ThriftI32(out, id);
+    }
+    last = id;
+}
+
+void ThriftList(string &out, size_t size, uint8_t type) {
+    if (size < 15) {
+        out.push_back((char)((size << 4) | type));
+        return;
+    }
+    out.push_back((char)(0xf0u | type));
+    ThriftVarint(out, size);
+}
+
+int64_t BigEndian64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (auto i = 0; i < 8; i++) {
+        v = (v << 8) | p[i];
+    }
+    return (int64_t)v;
+}
+
+// TagHeader: Tag.key and Tag.vType, the value field and the stop follow
+void TagHeader(string &out, int16_t &last, nostd::string_view key, JaegerTagType type) {
+    ThriftField(out, last, 1, kThriftBinary);
+    ThriftBinary(out, key);
+    ThriftField(out, last, 2, kThriftI32);
+    ThriftI32(out, type);
+}
+
+void TagString(string &out, nostd::string_view key, nostd::string_view value) {
+    int16_t last = 0;
+    TagHeader(out, last, key, kJaegerString);
+    ThriftField(out, last, 3, kThriftBinary);
+    ThriftBinary(out, value);
+    out.push_back('\0');
+}
+
+void TagDouble(string &out, nostd::string_view key, double value) {
+    int16_t last = 0;
+    TagHeader(out, last, key, kJaegerDouble);
+    ThriftField(out, last, 4, kThriftDouble);
+    ThriftDouble(out, value);
+    out.push_back('\0');
+}
+
+void TagBool(string &out, nostd::string_view key, bool value) {
+    int16_t last = 0;
+    TagHeader(out, last, key, kJaegerBool);
+    ThriftField(out, last, 5, value ? kThriftTrue : kThriftFalse);
+    out.push_back('\0');
+}
+
+void TagLong(string &out, nostd::string_view key, int64_t value) {
+    int16_t last = 0;
+    TagHeader(out, last, key, kJaegerLong);
+    ThriftField(out, last, 6, kThriftI64);
+    ThriftI64(out, value);
+    out.push_back('\0');
+}
+
+void TagBinary(string &out, nostd::string_view key, nostd::span<const uint8_t> value) {
+    int16_t last = 0;
+    TagHeader(out, last, key, kJaegerBinary);
+    ThriftField(out, last, 7, kThriftBinary);
+    ThriftBinary(out, nostd::string_view((const char *)value.data(), value.size()));
+    out.push_back('\0');
+}
+
+// ArrayText: array attributes are sent as string tags, [a,b]
+struct ArrayText {
+    string &_out;
+
+    void operator()(bool v) {
+        _out.append(v ? "true" : "false");
+    }
+    void operator()(int32_t v) {
+        _out.append(to_string(v));
+    }
+    void operator()(int64_t v) {
+        _out.append(to_string(v));
+    }
+    void operator()(uint32_t v) {
+        _out.append(to_string(v));
+    }
+    void operator()(uint64_t v) {
+        _out.append(to_string(v));
+    }
+    void operator()(double v) {
+        char buffer[32];
+        auto n = snprintf(buffer, sizeof(buffer), "%.15g", v);
+        _out.append(buffer, (size_t)max(n, 0));
+    }
+    void operator()(nostd::string_view v) {
+        _out.append(v.data(), v.size());
+    }
+};
+
+// TagWriter: an attribute as a Tag
+struct TagWriter {
+    string &_out;
+    nostd::string_view _key;
+
+    void operator()(bool v) {
+        TagBool(_out, _key, v);
+    }
+    void operator()(int32_t v) {
+        TagLong(_out, _key, v);
+    }
+    void operator()(int64_t v) {
+        TagLong(_out, _key, v);
+    }
+    void operator()(uint32_t v) {
+        TagLong(_out, _key, v);
+    }
+    void operator()(uint64_t v) {
+        TagLong(_out, _key, (int64_t)v);
+    }
+    void operator()(double v) {
+        TagDouble(_out, _key, v);
+    }
+    void operator()(const char *v) {
+        TagString(_out, _key, v);
+    }
+    void operator()(nostd::string_view v) {
+        TagString(_out, _key, v);
+    }
+    void operator()(nostd::span<const uint8_t> v) {
+        TagBinary(_out, _key, v);
+    }
+    template <typename T>
+    void operator()(nostd::span<const T> v) {
+        string text("[");
+        for (size_t i = 0; i < v.size(); i++) {
+            if (i > 0) {
+                text.push_back(',');
+            }
+            ArrayText{text}(v[i]);
+        }
+        text.push_back(']');
+        TagString(_out, _key, text);
+    }
+};
+
+const char *JaegerKindName(trace::SpanKind kind) {
+    switch (kind) {
+    case trace::SpanKind::kServer:
+        return "server";
+    case trace::SpanKind::kClient:
+        return "client";
+    case trace::SpanKind::kProducer:
+        return "producer";
+    case trace::SpanKind::kConsumer:
+        return "consumer";
+    default:
+        return nullptr;
+    }
+}
+
+// ConnectUdp: a UDP socket connected to host:port, -1 on error
+int ConnectUdp(const string &endpoint) {
+    auto pos = endpoint.rfind(':');
+    if (pos == string::npos) {
+        return -1;
+    }
+    auto host = endpoint.substr(0, pos);
+    auto port = endpoint.substr(pos + 1);
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo *res = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+        return -1;
+    }
+    auto fd = -1;
+    for (auto ai = res; ai != nullptr; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+} // namespace detail
+
+namespace tracing {
+
+JaegerRecordable::JaegerRecordable() noexcept
+    : _trace()
+    , _span()
+    , _parent()
+    , _flags(0)
+    , _name()
+    , _start(0)
+    , _duration(0)
+    , _kind(trace::SpanKind::kInternal)
+    , _status(trace::StatusCode::kUnset)
+    , _message()
+    , _tags()
+    , _tagCount(0)
+    , _logs()
+    , _logCount(0)
+    , _hold(sizeof(JaegerRecordable)) {}
+
+void JaegerRecordable::SetIdentity(const trace::SpanContext &span_context, trace::SpanId parent_span_id) noexcept {
+    span_context.trace_id().CopyBytesTo(_trace);
+    span_context.span_id().CopyBytesTo(_span);
+    parent_span_id.CopyBytesTo(_parent);
+    _flags = span_context.trace_flags().flags();
+}
+
+void JaegerRecordable::SetAttribute(nostd::string_view key, const common::AttributeValue &value) noexcept {
+    auto pos = _tags.size();
+    nostd::visit(detail::TagWriter{_tags, key}, Budget::Clip(value));
+    if (!_hold.AddAttribute(_tags.size() - pos)) {
+        _tags.resize(pos);
+        Stats::Add(kStatsAttrsDropped);
+        return;
+    }
+    _tagCount++;
+}
+
+void JaegerRecordable::AddEvent(nostd::string_view name, common::SystemTimestamp timestamp,
+                                const common::KeyValueIterable &attributes) noexcept {
+    auto pos = _logs.size();
+    int16_t last = 0;
+    detail::ThriftField(_logs, last, 1, detail::kThriftI64);
+    detail::ThriftI64(_logs, chrono::duration_cast<chrono::microseconds>(timestamp.time_since_epoch()).count());
+    detail::ThriftField(_logs, last, 2, detail::kThriftList);
+    detail::ThriftList(_logs, attributes.size() + 1, detail::kThriftStruct);
+    detail::TagString(_logs, "event", name);
+    attributes.ForEachKeyValue([this](nostd::string_view key, common::AttributeValue value) noexcept -> bool {
+        nostd::visit(detail::TagWriter{_logs, key}, value);
+        return true;
+    });
+    _logs.push_back('\0');
+    if (!_hold.Grow(_logs.size() - pos)) {
+        _logs.resize(pos);
+        Stats::Add(kStatsEventsDropped);
+        return;
+    }
+    _logCount++;
+}
+
+void JaegerRecordable::AddLink(const trace::SpanContext &, const common::KeyValueIterable &) noexcept {
+    // links are not reported
+}
+
+void JaegerRecordable::SetStatus(trace::StatusCode code, nostd::string_view description) noexcept {
+    auto text = Budget::Clip(description);
+    _hold.Force(text.size() > _message.size() ? text.size() - _message.size() : 0);
+    _status = code;
+    _message.assign(text.data(), text.size());
+}
+
+void JaegerRecordable::SetName(nostd::string_view name) noexcept {
+    _hold.Force(name.size() > _name.size() ? name.size() - _name.size() : 0);
+    _name.assign(name.data(), name.size());
+}
+
+void JaegerRecordable::SetSpanKind(trace::SpanKind span_kind) noexcept {
+    _kind = span_kind;
+}
+
+void JaegerRecordable::SetResource(const sdk::resource::Resource &) noexcept {
+    // the service name comes from JaegerExporterOptions
+}
+
+void JaegerRecordable::SetStartTime(common::SystemTimestamp start_time) noexcept {
+    _start = chrono::duration_cast<chrono::microseconds>(start_time.time_since_epoch()).count();
+}
+
+void JaegerRecordable::SetDuration(chrono::nanoseconds duration) noexcept {
+    _duration = chrono::duration_cast<chrono::microseconds>(duration).count();
+}
+
+void JaegerRecordable::SetInstrumentationLibrary(const sdk::trace::InstrumentationLibrary &) noexcept {}
+
+CustomJaegerExporter::CustomJaegerExporter(JaegerExporterOptions options)
+    : _options(move(options))
+    , _fd(detail::ConnectUdp(_options._endpoint))
+    , _prefix()
+    , _room(0)
+    , _spans()
+    , _ends()
+    , _lists()
+    , _iovs()
+    , _msgs()
+    , _shutdown(false) {
+    char hostname[256] = {};
+    gethostname(hostname, sizeof(hostname) - 1);
+
+    // message header of a oneway call, compact protocol version 1, seqid 0
+    _prefix.push_back((char)0x82);
+    _prefix.push_back((char)0x81);
+    detail::ThriftVarint(_prefix, 0);
+    detail::ThriftBinary(_prefix, "emitBatch");
+    int16_t args = 0;
+    detail::ThriftField(_prefix, args, 1, detail::kThriftStruct);
+    int16_t batch = 0;
+    detail::ThriftField(_prefix, batch, 1, detail::kThriftStruct);
+    int16_t process = 0;
+    detail::ThriftField(_prefix, process, 1, detail::kThriftBinary);
+    detail::ThriftBinary(_prefix, _options._serviceName);
+    detail::ThriftField(_prefix, process, 2, detail::kThriftList);
+    detail::ThriftList(_prefix, 1, detail::kThriftStruct);
+    detail::TagString(_prefix, "hostname", hostname);
+    _prefix.push_back('\0');
+    detail::ThriftField(_prefix, batch, 2, detail::kThriftList);
+
+    auto overhead = _prefix.size() + detail::kMaxListHeader + sizeof(detail::kBatchSuffix);
+    _room = _options._maxPacketSize > overhead ? _options._maxPacketSize - overhead : 0;
+}
+
+CustomJaegerExporter::~CustomJaegerExporter() {
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+unique_ptr<sdk::trace::Recordable> CustomJaegerExporter::MakeRecordable() noexcept {
+    return unique_ptr<sdk::trace::Recordable>(new JaegerRecordable);
+}
+
+sdk::common::ExportResult
+CustomJaegerExporter::Export(const nostd::span<unique_ptr<sdk::trace::Recordable>> &spans) noexcept {
+    if (_shutdown.load(memory_order_relaxed) || _fd < 0) {
+        return sdk::common::ExportResult::kFailure;
+    }
+    _spans.clear(); // capacity is kept
+    _ends.clear();
+    for (const auto &recordable : spans) {
+        if (recordable == nullptr) {
+            continue;
+        }
+        auto begin = _spans.size();
+        SerializeSpan(*recordable, _spans);
+        if (_spans.size() - begin > _room) {
+            _spans.resize(begin);
+            Stats::Add(kStatsDropOversize);
+            continue;
+        }
+        _ends.push_back(_spans.size());
+    }
+    if (_ends.empty()) {
+        return sdk::common::ExportResult::kSuccess;
+    }
+    return send(pack()) ? sdk::common::ExportResult::kSuccess : sdk::common::ExportResult::kFailure;
+}
+
+bool CustomJaegerExporter::Shutdown(chrono::microseconds) noexcept {
+    _shutdown.store(true, memory_order_relaxed);
+    return true;
+}
+
+void CustomJaegerExporter::SerializeSpan(const sdk::trace::Recordable &recordable, string &out) noexcept {
+    auto &span = static_cast<const JaegerRecordable &>(recordable);
+    int16_t last = 0;
+    detail::ThriftField(out, last, 1, detail::kThriftI64);
+    detail::ThriftI64(out, detail::BigEndian64(span._trace + 8));
+    detail::ThriftField(out, last, 2, detail::kThriftI64);
+    detail::ThriftI64(out, detail::BigEndian64(span._trace));
+    detail::ThriftField(out, last, 3, detail::kThriftI64);
+    detail::ThriftI64(out, detail::BigEndian64(span._span));
+    detail::ThriftField(out, last, 4, detail::kThriftI64);
+    detail::ThriftI64(out, detail::BigEndian64(span._parent));
+    detail::ThriftField(out, last, 5, detail::kThriftBinary);
+    detail::ThriftBinary(out, span._name);
+    detail::ThriftField(out, last, 7, detail::kThriftI32);
+    detail::ThriftI32(out, span._flags);
+    detail::ThriftField(out, last, 8, detail::kThriftI64);
+    detail::ThriftI64(out, span._start);
+    detail::ThriftField(out, last, 9, detail::kThriftI64);
+    detail::ThriftI64(out, span._duration);
+
+    auto kind = detail::JaegerKindName(span._kind);
+    auto error = span._status == trace::StatusCode::kError;
+    auto tags = span._tagCount + (kind != nullptr ? 1u : 0u) + (error ? 2u : 0u);
+    if (tags > 0) {
+        detail::ThriftField(out, last, 10, detail::kThriftList);
+        detail::ThriftList(out, tags, detail::kThriftStruct);
+        out.append(span._tags);
+        if (kind != nullptr) {
+            detail::TagString(out, "span.kind", kind);
+        }
+        if (error) {
+            detail::TagBool(out, "error", true);
+            detail::TagString(out, "otel.status_description", span._message);
+        }
+    }
+    if (span._logCount > 0) {
+        detail::ThriftField(out, last, 11, detail::kThriftList);
+        detail::ThriftList(out, span._logCount, detail::kThriftStruct);
+        out.append(span._logs);
+    }
+    out.push_back('\0');
+}
+
+size_t CustomJaegerExporter::pack() noexcept {
+    _lists.clear();
+    _iovs.clear();
+    size_t begin = 0; // offset of the first span of the datagram
+    size_t first = 0; // index of it
+    for (size_t i = 0; i < _ends.size(); i++) {
+        if (i + 1 < _ends.size() && _ends[i + 1] - begin <= _room) {
+            continue; // the next one fits as well
+        }
+        auto header = _lists.size();
+        detail::ThriftList(_lists, i + 1 - first, detail::kThriftStruct);
+        _iovs.push_back({const_cast<char *>(_prefix.data()), _prefix.size()});
+        _iovs.push_back({nullptr, _lists.size() - header});
+        _iovs.push_back({&_spans[begin], _ends[i] - begin});
+        _iovs.push_back({const_cast<char *>(detail::kBatchSuffix), sizeof(detail::kBatchSuffix)});
+        begin = _ends[i];
+        first = i + 1;
+    }
+
+    // _lists no longer moves
+    auto datagrams = _iovs.size() / 4;
+    _msgs.assign(datagrams, mmsghdr{});
+    size_t offset = 0;
+    for (size_t d = 0; d < datagrams; d++) {
+        _iovs[4 * d + 1].iov_base = &_lists[offset];
+        offset += _iovs[4 * d + 1].iov_len;
+        _msgs[d].msg_hdr.msg_iov = &_iovs[4 * d];
+        _msgs[d].msg_hdr.msg_iovlen = 4;
+    }
+    return datagrams;
+}
+
+bool CustomJaegerExporter::send(size_t datagrams) noexcept {
+    size_t sent = 0;
+    while (sent < datagrams) {
+        auto n = sendmmsg(_fd, &_msgs[sent], (unsigned)min(datagrams - sent, (size_t)detail::kMaxBurst), 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+} // namespace tracing
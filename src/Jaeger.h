@@ -0,0 +1,112 @@
+#pragma once
+
+#include <opentelemetry/sdk/trace/exporter.h>
+#include <opentelemetry/sdk/trace/recordable.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "Budget.h"
+
+namespace tracing {
+
+// JaegerRecordable: span data kept as the jaeger.thrift Span needs it, tags and logs are encoded on arrival
+class JaegerRecordable final : public opentelemetry::sdk::trace::Recordable {
+public:
+    JaegerRecordable() noexcept;
+
+public:
+    void SetIdentity(const opentelemetry::trace::SpanContext &span_context,
+                     opentelemetry::trace::SpanId parent_span_id) noexcept override;
+    void SetAttribute(opentelemetry::nostd::string_view key,
+                      const opentelemetry::common::AttributeValue &value) noexcept override;
+    void AddEvent(opentelemetry::nostd::string_view name, opentelemetry::common::SystemTimestamp timestamp,
+                  const opentelemetry::common::KeyValueIterable &attributes) noexcept override;
+    void AddLink(const opentelemetry::trace::SpanContext &span_context,
+                 const opentelemetry::common::KeyValueIterable &attributes) noexcept override;
+    void SetStatus(opentelemetry::trace::StatusCode code, opentelemetry::nostd::string_view description) noexcept
+        override;
+    void SetName(opentelemetry::nostd::string_view name) noexcept override;
+    void SetSpanKind(opentelemetry::trace::SpanKind span_kind) noexcept override;
+    void SetResource(const opentelemetry::sdk::resource::Resource &resource) noexcept override;
+    void SetStartTime(opentelemetry::common::SystemTimestamp start_time) noexcept override;
+    void SetDuration(std::chrono::nanoseconds duration) noexcept override;
+    void SetInstrumentationLibrary(const opentelemetry::sdk::trace::InstrumentationLibrary &library) noexcept
+        override;
+
+private:
+    friend class CustomJaegerExporter;
+    uint8_t _trace[16];
+    uint8_t _span[8];
+    uint8_t _parent[8];
+    uint8_t _flags;
+    std::string _name;
+    int64_t _start;    // us since epoch
+    int64_t _duration; // us
+    opentelemetry::trace::SpanKind _kind;
+    opentelemetry::trace::StatusCode _status;
+    std::string _message; // status description
+    std::string _tags;    // Tag structs, thrift compact
+    unsigned _tagCount;   // in _tags
+    std::string _logs;    // Log structs, thrift compact
+    unsigned _logCount;   // in _logs
+    BudgetHold _hold;     // of the memory budget
+};
+
+// JaegerExporterOptions: see reporter in tracing.yml
+struct JaegerExporterOptions {
+    JaegerExporterOptions()
+        : _endpoint("localhost:6831")
+        , _serviceName()
+        , _maxPacketSize(65000) {}
+
+    std::string _endpoint;    // host:port of the agent
+    std::string _serviceName; // Process.serviceName of every batch
+    size_t _maxPacketSize;    // of each datagram, spans which cannot fit alone are dropped
+};
+
+// CustomJaegerExporter: Agent.emitBatch over UDP in thrift compact, spans are packed into as few datagrams under
+// the max packet size as they fit, which are sent with one sendmmsg() per batch
+class CustomJaegerExporter final : public opentelemetry::sdk::trace::SpanExporter {
+public:
+    explicit CustomJaegerExporter(JaegerExporterOptions options);
+    ~CustomJaegerExporter() override;
+
+    CustomJaegerExporter(const CustomJaegerExporter &) = delete;
+    CustomJaegerExporter &operator=(const CustomJaegerExporter &) = delete;
+
+public:
+    std::unique_ptr<opentelemetry::sdk::trace::Recordable> MakeRecordable() noexcept override;
+    opentelemetry::sdk::common::ExportResult
+    Export(const opentelemetry::nostd::span<std::unique_ptr<opentelemetry::sdk::trace::Recordable>> &spans) noexcept
+        override;
+    bool Shutdown(std::chrono::microseconds timeout) noexcept override;
+
+public:
+    // SerializeSpan: append span (JaegerRecordable) to out as a jaeger.thrift Span
+    static void SerializeSpan(const opentelemetry::sdk::trace::Recordable &span, std::string &out) noexcept;
+
+private:
+    // pack: group the serialized spans into datagrams, returns the number of datagrams
+    size_t pack() noexcept;
+    // send: send the packed datagrams
+    bool send(size_t datagrams) noexcept;
+
+private:
+    const JaegerExporterOptions _options;
+    int _fd;             // connected UDP socket
+    std::string _prefix; // emitBatch message up to the span list, the same for every datagram
+    size_t _room;        // span bytes which fit in one datagram
+    // reused across batches, only touched by the export thread
+    std::string _spans;        // serialized spans of a batch
+    std::vector<size_t> _ends; // end offset of each span in _spans
+    std::string _lists;        // span list header of each datagram
+    std::vector<struct iovec> _iovs;
+    std::vector<struct mmsghdr> _msgs;
+    std::atomic<bool> _shutdown;
+};
+
+} // namespace tracing
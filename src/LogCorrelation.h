@@ -0,0 +1,83 @@
+#pragma once
+
+#include <ostream>
+
+#include "Tracing.h"
+
+// Adapters stamping the ids of the active span on log lines, see Tracing::GetLogIds(). Nothing is copied or
+// allocated per line. The fmt and spdlog ones are only defined if their headers are found.
+
+namespace tracing {
+
+// operator<<: "trace_id=<32 hex> span_id=<16 hex>", nothing without an active span
+inline std::ostream &operator<<(std::ostream &os, const LogIds &ids) {
+    if (ids._traceId.empty()) {
+        return os;
+    }
+    os.write("trace_id=", 9).write(ids._traceId.data(), (std::streamsize)ids._traceId.size());
+    os.write(" span_id=", 9).write(ids._spanId.data(), (std::streamsize)ids._spanId.size());
+    return os;
+}
+
+} // namespace tracing
+
+#if defined(__has_include)
+#if __has_include(<fmt/format.h>)
+#include <fmt/format.h>
+
+namespace fmt {
+
+// formatter: fmt::format("{}", tracing::Tracing::GetLogIds()), same text as operator<<
+template <>
+struct formatter<tracing::LogIds> {
+    constexpr format_parse_context::iterator parse(format_parse_context &ctx) {
+        return ctx.begin();
+    }
+
+    template <typename FormatContext>
+    auto format(const tracing::LogIds &ids, FormatContext &ctx) const -> decltype(ctx.out()) {
+        if (ids._traceId.empty()) {
+            return ctx.out();
+        }
+        return format_to(ctx.out(), "trace_id={} span_id={}", string_view(ids._traceId.data(), ids._traceId.size()),
+                         string_view(ids._spanId.data(), ids._spanId.size()));
+    }
+};
+
+} // namespace fmt
+#endif
+
+#if __has_include(<spdlog/pattern_formatter.h>)
+#include <spdlog/pattern_formatter.h>
+
+namespace tracing {
+
+// TraceIdFlag: spdlog pattern flag, e.g. formatter->add_flag<tracing::TraceIdFlag>('*').set_pattern("[%*] %v")
+class TraceIdFlag final : public spdlog::custom_flag_formatter {
+public:
+    void format(const spdlog::details::log_msg &, const std::tm &, spdlog::memory_buf_t &dest) override {
+        auto id = Tracing::GetLogIds()._traceId;
+        dest.append(id.data(), id.data() + id.size());
+    }
+
+    std::unique_ptr<spdlog::custom_flag_formatter> clone() const override {
+        return std::unique_ptr<spdlog::custom_flag_formatter>(new TraceIdFlag);
+    }
+};
+
+// SpanIdFlag: same as TraceIdFlag for the span id
+class SpanIdFlag final : public spdlog::custom_flag_formatter {
+public:
+    void format(const spdlog::details::log_msg &, const std::tm &, spdlog::memory_buf_t &dest) override {
+        auto id = Tracing::GetLogIds()._spanId;
+        dest.append(id.data(), id.data() + id.size());
+    }
+
+    std::unique_ptr<spdlog::custom_flag_formatter> clone() const override {
+        return std::unique_ptr<spdlog::custom_flag_formatter>(new SpanIdFlag);
+    }
+};
+
+} // namespace tracing
+#endif
+#endif
@@ -0,0 +1,300 @@
+#include "Metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Clock.h"
+#include "Names.h"
+
+using namespace std;
+
+namespace detail {
+
+constexpr size_t kMaxIndex = 4096; // keys cached per thread, unseen keys go to the overflow series beyond
+
+struct SeriesKey {
+    uint32_t _name;
+    uint32_t _cmd;
+    int32_t _err;
+
+    bool operator==(const SeriesKey &other) const noexcept {
+        return _name == other._name && _cmd == other._cmd && _err == other._err;
+    }
+    bool operator<(const SeriesKey &other) const noexcept {
+        return tie(_name, _cmd, _err) < tie(other._name, other._cmd, other._err);
+    }
+};
+
+struct SeriesKeyHash {
+    size_t operator()(const SeriesKey &key) const noexcept {
+        auto h = ((uint64_t)key._name << 32u) | key._cmd;
+        h ^= (uint64_t)(uint32_t)key._err * 0x9e3779b97f4a7c15ull;
+        return (size_t)((h ^ (h >> 29u)) * 0xbf58476d1ce4e5b9ull);
+    }
+};
+
+const SeriesKey kOverflowKey{0, 0, 0};
+
+using SeriesTable = unordered_map<SeriesKey, unique_ptr<tracing::Histogram>, SeriesKeyHash>;
+
+// SeriesShard: series of one thread. _series is read by the ticker thread under _mtx and only the owner inserts (under
+// _mtx too), so the owner looks up without lock. _index maps every key seen to its series, owner only.
+struct SeriesShard {
+    mutex _mtx;
+    SeriesTable _series;
+    unordered_map<SeriesKey, tracing::Histogram *, SeriesKeyHash> _index;
+};
+
+void MergeInto(const SeriesTable &from, SeriesTable &to) {
+    for (const auto &item : from) {
+        auto &h = to[item.first];
+        if (h == nullptr) {
+            h.reset(new tracing::Histogram);
+        }
+        h->Merge(*item.second);
+    }
+}
+
+class SeriesRegistry final {
+public:
+    SeriesRegistry()
+        : _enable(true)
+        , _maxSeries(256)
+        , _mtx()
+        , _shards()
+        , _retired()
+        , _admitted()
+        , _snapMtx()
+        , _snapshot()
+        , _last()
+        , _lastTime(tracing::Clock::WallNs()) {
+        _snapshot._time = _lastTime;
+    }
+
+public:
+    atomic<bool> _enable;
+    atomic<size_t> _maxSeries;
+
+    // Admit: key itself while the series are within the bound, otherwise the overflow key
+    SeriesKey Admit(const SeriesKey &key) {
+        if (key == kOverflowKey) {
+            return key;
+        }
+        lock_guard<mutex> lock(_mtx);
+        if (_admitted.count(key) != 0) {
+            return key;
+        }
+        if (_admitted.size() >= _maxSeries.load(memory_order_relaxed)) {
+            return kOverflowKey;
+        }
+        _admitted.insert(key);
+        return key;
+    }
+
+    void Register(SeriesShard *shard) {
+        lock_guard<mutex> lock(_mtx);
+        _shards.insert(shard);
+    }
+
+    void Retire(SeriesShard *shard) {
+        lock_guard<mutex> lock(_mtx);
+        {
+            lock_guard<mutex> shardLock(shard->_mtx);
+            MergeInto(shard->_series, _retired);
+        }
+        _shards.erase(shard);
+    }
+
+    void Merge() {
+        SeriesTable merged;
+        {
+            lock_guard<mutex> lock(_mtx);
+            MergeInto(_retired, merged);
+            for (auto shard : _shards) {
+                lock_guard<mutex> shardLock(shard->_mtx);
+                MergeInto(shard->_series, merged);
+            }
+        }
+
+        tracing::MetricsSnapshot snapshot{};
+        snapshot._time = tracing::Clock::WallNs();
+        snapshot._series.reserve(merged.size());
+
+        lock_guard<mutex> lock(_snapMtx);
+        auto elapsed = (double)(snapshot._time - _lastTime) / 1e9;
+        for (const auto &item : merged) {
+            const auto &h = *item.second;
+            auto &last = _last[item.first];
+            tracing::SeriesSummary series{};
+            series._name = tracing::Names::Get(item.first._name);
+            series._cmd = item.first._cmd;
+            series._err = item.first._err;
+            series._count = h.Count();
+            series._rate = elapsed > 0 ? (double)(series._count - last) / elapsed : 0;
+            series._latency._count = series._count;
+            series._latency._sum = h.Sum();
+            series._latency._max = h.Max();
+            series._latency._p50 = h.Percentile(50);
+            series._latency._p90 = h.Percentile(90);
+            series._latency._p99 = h.Percentile(99);
+            last = series._count;
+            snapshot._series.push_back(move(series));
+        }
+        sort(snapshot._series.begin(), snapshot._series.end(),
+             [](const tracing::SeriesSummary &a, const tracing::SeriesSummary &b) {
+                 return tie(a._name, a._cmd, a._err) < tie(b._name, b._cmd, b._err);
+             });
+        _snapshot = move(snapshot);
+        _lastTime = _snapshot._time;
+    }
+
+    tracing::MetricsSnapshot Snapshot() {
+        lock_guard<mutex> lock(_snapMtx);
+        return _snapshot;
+    }
+
+    // Lock: every lock in the order Merge() takes them, shards of threads gone in the child are merged later on
+    void Lock() {
+        _mtx.lock();
+        for (auto shard : _shards) {
+            shard->_mtx.lock();
+        }
+        _snapMtx.lock();
+    }
+
+    void Unlock() {
+        _snapMtx.unlock();
+        for (auto shard : _shards) {
+            shard->_mtx.unlock();
+        }
+        _mtx.unlock();
+    }
+
+private:
+    mutex _mtx; // guards _shards, _retired and _admitted
+    set<SeriesShard *> _shards;
+    SeriesTable _retired;
+    unordered_set<SeriesKey, SeriesKeyHash> _admitted;
+
+    mutex _snapMtx; // guards the fields below
+    tracing::MetricsSnapshot _snapshot;
+    unordered_map<SeriesKey, uint64_t, SeriesKeyHash> _last; // count of each series at the last merge
+    int64_t _lastTime;
+};
+
+SeriesRegistry &GetSeriesRegistry() {
+    static auto registry = new SeriesRegistry; // never destroyed, threads may exit after static destruction
+    return *registry;
+}
+
+struct LocalSeriesShard {
+    LocalSeriesShard() {
+        GetSeriesRegistry().Register(&_shard);
+    }
+    ~LocalSeriesShard() {
+        GetSeriesRegistry().Retire(&_shard);
+    }
+    SeriesShard _shard;
+};
+
+SeriesShard &LocalSeries() {
+    static thread_local LocalSeriesShard local;
+    return local._shard;
+}
+
+// Series: series of key in this thread, created on first use
+tracing::Histogram *Series(SeriesShard &shard, const SeriesKey &key) {
+    auto it = shard._index.find(key);
+    if (it != shard._index.end()) {
+        return it->second;
+    }
+
+    auto admitted = shard._index.size() < kMaxIndex ? GetSeriesRegistry().Admit(key) : kOverflowKey;
+    auto series = shard._series.find(admitted);
+    tracing::Histogram *h = nullptr;
+    if (series != shard._series.end()) {
+        h = series->second.get();
+    } else {
+        h = new tracing::Histogram;
+        lock_guard<mutex> lock(shard._mtx);
+        shard._series.emplace(admitted, unique_ptr<tracing::Histogram>(h));
+    }
+    if (shard._index.size() < kMaxIndex) {
+        shard._index.emplace(key, h);
+    }
+    return h;
+}
+
+} // namespace detail
+
+namespace tracing {
+
+void Metrics::Setup(bool enable, size_t maxSeries) noexcept {
+    auto &registry = detail::GetSeriesRegistry();
+    registry._enable.store(enable, memory_order_relaxed);
+    registry._maxSeries.store(maxSeries, memory_order_relaxed);
+}
+
+bool Metrics::IsEnabled() noexcept {
+    return detail::GetSeriesRegistry()._enable.load(memory_order_relaxed);
+}
+
+void Metrics::Record(const SpanMark &mark, int err) noexcept {
+    if (mark._start == 0 || !IsEnabled()) {
+        return;
+    }
+    auto now = Clock::SteadyNs();
+    auto us = now > mark._start ? (uint64_t)(now - mark._start) / 1000u : 0u;
+    detail::Series(detail::LocalSeries(), detail::SeriesKey{mark._name, mark._cmd, err})->Record(us);
+}
+
+void Metrics::Merge() noexcept {
+    detail::GetSeriesRegistry().Merge();
+}
+
+void Metrics::BeforeFork() noexcept {
+    detail::GetSeriesRegistry().Lock();
+}
+
+void Metrics::AfterFork() noexcept {
+    detail::GetSeriesRegistry().Unlock();
+}
+
+MetricsSnapshot Metrics::Snapshot() noexcept {
+    return detail::GetSeriesRegistry().Snapshot();
+}
+
+bool Metrics::Dump(const string &path) noexcept {
+    auto tmp = path + ".tmp";
+    {
+        ofstream out(tmp, ios::trunc);
+        if (!out) {
+            return false;
+        }
+        out << Snapshot().Format();
+        if (!out) {
+            return false;
+        }
+    }
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+string MetricsSnapshot::Format() const {
+    stringstream ss;
+    for (const auto &s : _series) {
+        ss << "span{name=\"" << s._name << "\",cmd=\"" << s._cmd << "\",err=\"" << s._err << "\"} count=" << s._count
+           << " rate=" << s._rate << " sum_us=" << s._latency._sum << " max_us=" << s._latency._max
+           << " p50_us=" << s._latency._p50 << " p90_us=" << s._latency._p90 << " p99_us=" << s._latency._p99 << "\n";
+    }
+    return ss.str();
+}
+
+} // namespace tracing
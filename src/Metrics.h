@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Stats.h"
+
+namespace tracing {
+
+// SpanMark: what the RED metrics and the flight recorder keep of a span from start to end
+struct SpanMark {
+    uint32_t _name;     // interned span name, see Names::Intern()
+    uint32_t _cmd;      // cmd of the sample hint
+    int64_t _start;     // Clock::SteadyNs() at start, 0 means not marked
+    int64_t _wall;      // Clock::WallNs() at start, 0 means not recorded, see Recorder::Record()
+    uint8_t _trace[16]; // trace id
+    uint8_t _span[8];   // span id
+    uint8_t _parent[8]; // parent span id, zeros for a root span
+    uint32_t _uid;      // uid of the sample hint
+    uint8_t _kind;      // span kind
+    bool _sampled;      // whether the sampler has kept the span
+    bool _pinned;       // sampled and white-listed or forced by the caller, see ExportLane
+};
+
+// SeriesSummary: RED metrics of one (span name, cmd, err) series since start
+struct SeriesSummary {
+    std::string _name;         // span name, Names::kOverflow for spans over the cardinality bound
+    unsigned _cmd;             // cmd
+    int _err;                  // error code
+    uint64_t _count;           // spans ended
+    double _rate;              // spans per second over the last merge interval
+    HistogramSummary _latency; // us
+};
+
+// MetricsSnapshot: see Tracing::GetMetrics()
+struct MetricsSnapshot {
+    int64_t _time;                      // Clock::WallNs() of the merge
+    std::vector<SeriesSummary> _series; // sorted by (name, cmd, err)
+
+    // Format: plain text, one series per line
+    std::string Format() const;
+};
+
+// Metrics: span-derived RED metrics of every span started through Hornet, sampled or not.
+// Recorded into per-thread tables at span end, merged by the ticker thread.
+class Metrics final {
+public:
+    // Setup: maxSeries bounds the (name, cmd, err) series process-wide, the rest goes to one overflow series
+    static void Setup(bool enable, size_t maxSeries) noexcept;
+    // IsEnabled: whether spans are recorded
+    static bool IsEnabled() noexcept;
+    // Record: record a span ended with err into the table of this thread
+    static void Record(const SpanMark &mark, int err) noexcept;
+    // Merge: merge the tables of all threads into a new snapshot, called periodically by the ticker thread
+    static void Merge() noexcept;
+    // Snapshot: snapshot of the last merge
+    static MetricsSnapshot Snapshot() noexcept;
+    // Dump: write the snapshot of the last merge into path, replacing it atomically
+    static bool Dump(const std::string &path) noexcept;
+    // BeforeFork: hold the registry, every table and the snapshot across fork()
+    static void BeforeFork() noexcept;
+    // AfterFork: release them on either side
+    static void AfterFork() noexcept;
+};
+
+} // namespace tracing
@@ -0,0 +1,86 @@
+#include "Names.h"
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+using namespace std;
+
+namespace detail {
+
+class NameRegistry final {
+public:
+    NameRegistry()
+        : _mtx()
+        , _names(1, tracing::Names::kOverflow)
+        , _ids() {}
+
+    uint32_t Intern(const string &name) {
+        lock_guard<mutex> lock(_mtx);
+        auto it = _ids.find(name);
+        if (it != _ids.end()) {
+            return it->second;
+        }
+        if (_names.size() >= tracing::Names::kMaxNames) {
+            return 0;
+        }
+        auto id = (uint32_t)_names.size();
+        _names.push_back(name);
+        _ids.emplace(name, id);
+        return id;
+    }
+
+    const string &Get(uint32_t id) {
+        lock_guard<mutex> lock(_mtx);
+        return id < _names.size() ? _names[id] : _names[0];
+    }
+
+    void Lock() {
+        _mtx.lock();
+    }
+
+    void Unlock() {
+        _mtx.unlock();
+    }
+
+private:
+    mutex _mtx;
+    deque<string> _names; // never shrinks, references stay valid
+    unordered_map<string, uint32_t> _ids;
+};
+
+NameRegistry &GetNameRegistry() {
+    static auto registry = new NameRegistry; // never destroyed, names are read at exit
+    return *registry;
+}
+
+} // namespace detail
+
+namespace tracing {
+
+uint32_t Names::Intern(const string &name) noexcept {
+    static thread_local unordered_map<string, uint32_t> cache;
+    auto it = cache.find(name);
+    if (it != cache.end()) {
+        return it->second;
+    }
+    auto id = detail::GetNameRegistry().Intern(name);
+    if (cache.size() < kMaxNames) {
+        cache.emplace(name, id);
+    }
+    return id;
+}
+
+const string &Names::Get(uint32_t id) noexcept {
+    return detail::GetNameRegistry().Get(id);
+}
+
+void Names::BeforeFork() noexcept {
+    detail::GetNameRegistry().Lock();
+}
+
+void Names::AfterFork() noexcept {
+    detail::GetNameRegistry().Unlock();
+}
+
+} // namespace tracing
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace tracing {
+
+// Names: process-wide registry of span names, so hot paths keep a small id instead of the name
+class Names final {
+public:
+    static constexpr size_t kMaxNames = 4096; // bound of distinct names, ids fit in 16 bits
+    static constexpr const char *kOverflow = "_overflow"; // name of id 0, shared by names over the bound
+
+    // Intern: id of name, ids are never reused. Looked up in a per-thread cache first.
+    static uint32_t Intern(const std::string &name) noexcept;
+    // Get: name of id, valid for the life of the process
+    static const std::string &Get(uint32_t id) noexcept;
+    // BeforeFork: hold the registry across fork(), so the child never inherits it locked by a thread it lacks
+    static void BeforeFork() noexcept;
+    // AfterFork: release it on either side
+    static void AfterFork() noexcept;
+};
+
+} // namespace tracing
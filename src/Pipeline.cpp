@@ -0,0 +1,334 @@
+#include "Pipeline.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Budget.h"
+#include "Stats.h"
+
+using namespace std;
+using namespace opentelemetry;
+
+namespace detail {
+
+// lane of the span being ended on this thread, see PriorityProcessor::EndScope
+thread_local tracing::ExportLane t_endLane = tracing::kLaneNormal;
+thread_local uint64_t t_endTrace = 0;
+
+// queue drops of each lane, see tracing::PriorityProcessor
+constexpr tracing::StatsCounter kLaneDrops[tracing::kMaxExportLane] = {
+    tracing::kStatsDropLaneError,
+    tracing::kStatsDropLaneDebug,
+    tracing::kStatsDropLaneNormal,
+};
+
+// DropQueued: a span queued in lane is dropped since the queue is full
+void DropQueued(unsigned lane) {
+    tracing::Stats::Add(tracing::kStatsDropQueueFull);
+    tracing::Stats::Add(kLaneDrops[lane]);
+}
+
+// DropBudget: a span queued in lane is dropped over the memory budget
+void DropBudget(unsigned lane) {
+    tracing::Stats::Add(tracing::kStatsDropBudget);
+    tracing::Stats::Add(kLaneDrops[lane]);
+}
+
+// TraceKey: low half of the trace id, random in either layout of CustomIdGenerator
+uint64_t TraceKey(const trace::TraceId &trace) {
+    uint64_t key;
+    memcpy(&key, trace.Id().data() + trace::TraceId::kSize - sizeof(key), sizeof(key));
+    return key;
+}
+
+// SteadyNs: now, as Queued::_end
+int64_t SteadyNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// WaitFor: cv.wait_for() which takes microseconds::max() (the SDK default) as no timeout
+template <typename P>
+bool WaitFor(condition_variable &cv, unique_lock<mutex> &lock, chrono::microseconds timeout, P pred) {
+    if (timeout >= chrono::hours(24)) {
+        cv.wait(lock, pred);
+        return true;
+    }
+    return cv.wait_for(lock, timeout, pred);
+}
+
+} // namespace detail
+
+namespace tracing {
+
+PriorityProcessor::EndScope::EndScope(ExportLane lane, const trace::TraceId &trace) noexcept
+    : _prev(detail::t_endLane)
+    , _prevTrace(detail::t_endTrace) {
+    detail::t_endLane = lane;
+    detail::t_endTrace = detail::TraceKey(trace);
+}
+
+PriorityProcessor::EndScope::~EndScope() {
+    detail::t_endLane = _prev;
+    detail::t_endTrace = _prevTrace;
+}
+
+PriorityProcessor::PriorityProcessor(unique_ptr<sdk::trace::SpanExporter> exporter,
+                                     const PriorityProcessorOptions &options)
+    : _exporter(move(exporter))
+    , _maxQueueSize(max<size_t>(options._maxQueueSize, 1))
+    , _maxBatchSize(max<size_t>(options._maxBatchSize, 1))
+    , _delay(options._delay)
+    , _group(options._group)
+    , _groupWindow(options._groupWindow)
+    , _mtx()
+    , _wake()
+    , _flushed()
+    , _lanes()
+    , _size(0)
+    , _carry()
+    , _carryUntil()
+    , _flushWanted(0)
+    , _flushDone(0)
+    , _stop(false)
+    , _held()
+    , _shutdown(false)
+    , _worker() {
+    for (auto i = 0u; i < kMaxExportLane; i++) {
+        // a lane holds no more than the whole queue, and is drained by one span per round at least
+        _lanes[i]._ring.resize(min(max<size_t>(options._laneSizes[i], 1), _maxQueueSize));
+        _lanes[i]._head = 0;
+        _lanes[i]._size = 0;
+        _lanes[i]._weight = max(options._laneWeights[i], 1u);
+    }
+    _worker = thread([this]() { run(); });
+}
+
+PriorityProcessor::~PriorityProcessor() {
+    Shutdown(chrono::microseconds::max());
+}
+
+unique_ptr<sdk::trace::Recordable> PriorityProcessor::MakeRecordable() noexcept {
+    return _exporter->MakeRecordable();
+}
+
+void PriorityProcessor::OnStart(sdk::trace::Recordable &, const trace::SpanContext &) noexcept {}
+
+void PriorityProcessor::OnEnd(unique_ptr<sdk::trace::Recordable> &&span) noexcept {
+    if (_shutdown.load(memory_order_relaxed)) {
+        return; // released here, never exported
+    }
+    const auto lane = detail::t_endLane;
+    const auto end = _group ? detail::SteadyNs() : 0;
+    auto &l = _lanes[lane];
+    bool wake;
+    {
+        lock_guard<mutex> lock(_mtx);
+        // over the memory budget, the queued spans of lower lanes are released before this one
+        while (Budget::Exhausted()) {
+            auto evicted = evict(lane);
+            if (evicted == kMaxExportLane) {
+                detail::DropBudget(lane);
+                return;
+            }
+            detail::DropBudget(evicted);
+        }
+        if (l._size == l._ring.size()) {
+            detail::DropQueued(lane);
+            return;
+        }
+        if (_size + _carry.size() >= _maxQueueSize) {
+            auto evicted = evict(lane);
+            if (evicted == kMaxExportLane) {
+                detail::DropQueued(lane);
+                return;
+            }
+            detail::DropQueued(evicted);
+        }
+        l._ring[(l._head + l._size) % l._ring.size()] = Queued{move(span), lane, detail::t_endTrace, end, false};
+        ++l._size;
+        ++_size;
+        wake = _size == _maxBatchSize; // once per full batch, the export thread takes more while it can
+    }
+    Stats::AddQueueDepth(1);
+    if (wake) {
+        _wake.notify_one();
+    }
+}
+
+bool PriorityProcessor::ForceFlush(chrono::microseconds timeout) noexcept {
+    unique_lock<mutex> lock(_mtx);
+    auto wanted = ++_flushWanted;
+    _wake.notify_one();
+    return detail::WaitFor(_flushed, lock, timeout, [this, wanted]() { return _flushDone >= wanted || _stop; });
+}
+
+bool PriorityProcessor::Shutdown(chrono::microseconds timeout) noexcept {
+    if (_shutdown.exchange(true)) {
+        return true;
+    }
+    {
+        lock_guard<mutex> lock(_mtx);
+        _stop = true; // the export thread drains the lanes before it quits
+    }
+    _wake.notify_one();
+    _worker.join();
+    return _exporter->Shutdown(timeout);
+}
+
+ExportLane PriorityProcessor::evict(unsigned lane) noexcept {
+    for (auto i = (unsigned)kMaxExportLane - 1u; i > lane; i--) {
+        // the runs held back were taken before what is left in the lane
+        auto carried = find_if(_carry.begin(), _carry.end(), [i](const Queued &q) { return q._lane == i; });
+        auto &l = _lanes[i];
+        if (carried != _carry.end()) {
+            _carry.erase(carried);
+        } else if (l._size != 0) {
+            l._ring[l._head]._span.reset();
+            l._head = (l._head + 1) % l._ring.size();
+            --l._size;
+            --_size;
+        } else {
+            continue;
+        }
+        Stats::AddQueueDepth(-1);
+        return (ExportLane)i;
+    }
+    return kMaxExportLane;
+}
+
+size_t PriorityProcessor::take(vector<Queued> &batch) noexcept {
+    // the runs held back have waited for one batch already
+    for (auto &q : _carry) {
+        batch.push_back(move(q));
+    }
+    _carry.clear();
+    size_t taken = 0;
+    while (batch.size() < _maxBatchSize && _size > 0) {
+        for (auto &l : _lanes) {
+            for (auto n = 0u; n < l._weight && l._size > 0 && batch.size() < _maxBatchSize; n++) {
+                batch.push_back(move(l._ring[l._head]));
+                l._head = (l._head + 1) % l._ring.size();
+                --l._size;
+                --_size;
+                ++taken;
+            }
+        }
+    }
+    return taken;
+}
+
+void PriorityProcessor::group(vector<Queued> &batch, bool final) noexcept {
+    // one run per trace, in the order its spans ended
+    stable_sort(batch.begin(), batch.end(), [](const Queued &a, const Queued &b) { return a._trace < b._trace; });
+    if (final) {
+        return;
+    }
+    const auto recent = detail::SteadyNs() - chrono::duration_cast<chrono::nanoseconds>(_groupWindow).count();
+    const auto room = _maxBatchSize / 2; // the next batch takes the lanes too
+    size_t kept = 0;
+    for (size_t i = 0, j = 0; i < batch.size(); i = j) {
+        auto carried = false;
+        auto last = batch[i]._end;
+        for (j = i; j < batch.size() && batch[j]._trace == batch[i]._trace; j++) {
+            carried = carried || batch[j]._carried;
+            last = max(last, batch[j]._end);
+        }
+        // a trace which is still ending spans waits for its siblings, but once only and never without a trace
+        if (batch[i]._trace != 0 && !carried && last > recent && _held.size() + (j - i) <= room) {
+            for (auto k = i; k < j; k++) {
+                batch[k]._carried = true;
+                _held.push_back(move(batch[k]));
+            }
+            continue;
+        }
+        for (auto k = i; k < j; k++, kept++) {
+            if (kept != k) {
+                batch[kept] = move(batch[k]);
+            }
+        }
+    }
+    batch.resize(kept);
+}
+
+void PriorityProcessor::run() noexcept {
+    vector<Queued> batch;
+    vector<unique_ptr<sdk::trace::Recordable>> spans;
+    batch.reserve(_maxBatchSize);
+    spans.reserve(_maxBatchSize);
+    unique_lock<mutex> lock(_mtx);
+    for (;;) {
+        auto until = chrono::steady_clock::now() + _delay;
+        if (!_carry.empty()) {
+            until = min(until, _carryUntil);
+        }
+        _wake.wait_until(lock, until,
+                         [this]() { return _stop || _flushDone < _flushWanted || _size >= _maxBatchSize; });
+        // what is queued by now for a flush or at the end, full batches (or the leftovers once per delay) otherwise
+        const auto wanted = _flushWanted;
+        const auto final = _stop || _flushDone < wanted;
+        auto left = final ? _size : 0;
+        do {
+            left -= min(left, take(batch));
+            if (batch.empty()) {
+                break;
+            }
+            if (_group) {
+                // the runs held back stay queued, for the depth and the budget to see
+                lock.unlock();
+                group(batch, final);
+                lock.lock();
+                if (!_held.empty()) {
+                    _carryUntil = chrono::steady_clock::now() + _groupWindow;
+                    _carry.swap(_held);
+                }
+            }
+            Stats::AddQueueDepth(-(int64_t)batch.size());
+            lock.unlock();
+            for (auto &q : batch) {
+                spans.push_back(move(q._span));
+            }
+            batch.clear();
+            if (!spans.empty()) {
+                _exporter->Export(nostd::span<unique_ptr<sdk::trace::Recordable>>(spans.data(), spans.size()));
+                spans.clear();
+            }
+            lock.lock();
+        } while (left > 0 || _size >= _maxBatchSize);
+        if (_flushDone < wanted) {
+            _flushDone = wanted;
+            _flushed.notify_all();
+        }
+        if (_stop) {
+            _flushed.notify_all();
+            return;
+        }
+    }
+}
+
+MeteredExporter::MeteredExporter(unique_ptr<sdk::trace::SpanExporter> exporter) noexcept
+    : _exporter(move(exporter)) {}
+
+unique_ptr<sdk::trace::Recordable> MeteredExporter::MakeRecordable() noexcept {
+    return _exporter->MakeRecordable();
+}
+
+sdk::common::ExportResult
+MeteredExporter::Export(const nostd::span<unique_ptr<sdk::trace::Recordable>> &spans) noexcept {
+    const auto size = spans.size();
+
+    const auto start = chrono::steady_clock::now();
+    auto result = _exporter->Export(spans);
+    const auto cost = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+
+    Stats::Add(kStatsExportBatches);
+    Stats::Record(kStatsExportBatchSize, (uint64_t)size);
+    Stats::Record(kStatsExportLatency, (uint64_t)cost.count());
+    Stats::Add(result == sdk::common::ExportResult::kSuccess ? kStatsSpansExported : kStatsDropExport, (uint64_t)size);
+    return result;
+}
+
+bool MeteredExporter::Shutdown(chrono::microseconds timeout) noexcept {
+    return _exporter->Shutdown(timeout);
+}
+
+} // namespace tracing
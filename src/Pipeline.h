@@ -0,0 +1,156 @@
+#pragma once
+
+#include <opentelemetry/sdk/trace/exporter.h>
+#include <opentelemetry/sdk/trace/processor.h>
+#include <opentelemetry/trace/trace_id.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tracing {
+
+// ExportLane: lanes of PriorityProcessor, from the highest priority down
+enum ExportLane : unsigned {
+    kLaneError = 0, // spans which failed
+    kLaneDebug,     // spans white-listed by their sample hint, or forced by the caller's debug flag
+    kLaneNormal,    // the other sampled spans
+    kMaxExportLane,
+};
+
+// PriorityProcessorOptions: see reporter.queue in tracing.yml
+struct PriorityProcessorOptions {
+    PriorityProcessorOptions() noexcept
+        : _maxQueueSize(2048)
+        , _maxBatchSize(512)
+        , _delay(5000)
+        , _laneSizes{{512, 512, 2048}}
+        , _laneWeights{{4, 2, 1}}
+        , _group(false)
+        , _groupWindow(100) {}
+
+    size_t _maxQueueSize;                              // spans of all lanes
+    size_t _maxBatchSize;                              // spans per export call
+    std::chrono::milliseconds _delay;                  // spans are exported at least this often
+    std::array<size_t, kMaxExportLane> _laneSizes;     // spans each lane holds at most
+    std::array<unsigned, kMaxExportLane> _laneWeights; // spans taken from each lane per round of a batch
+    bool _group;                                       // the spans of a trace are exported as one run of a batch
+    std::chrono::milliseconds _groupWindow;            // a run which ended within it waits for the next batch once
+};
+
+// PriorityProcessor: batches ended spans for the exporter in bounded lanes by priority, see ExportLane. Batches are
+// drained from the lanes by weighted rounds, so error spans get through first while the export falls behind. Once
+// the queue is full a span evicts the oldest one of the lowest lane below its own, or is dropped if there is none.
+// Over the memory budget spans of lower lanes are evicted the same way, see Budget. Drops (evictions included) are
+// counted per lane for both causes. With grouping each batch is ordered by trace, and the runs of traces still ending
+// spans are held back for the next batch once, so a trace reaches the collector in as few writes as it can.
+class PriorityProcessor final : public opentelemetry::sdk::trace::SpanProcessor {
+public:
+    PriorityProcessor(std::unique_ptr<opentelemetry::sdk::trace::SpanExporter> exporter,
+                      const PriorityProcessorOptions &options);
+    ~PriorityProcessor() override;
+
+    PriorityProcessor(const PriorityProcessor &) = delete;
+    PriorityProcessor &operator=(const PriorityProcessor &) = delete;
+
+public:
+    // EndScope: hand the lane and the trace of the span being ended on this thread to OnEnd(), kLaneNormal and no
+    // trace (never grouped) without one
+    class EndScope final {
+    public:
+        explicit EndScope(ExportLane lane,
+                          const opentelemetry::trace::TraceId &trace = opentelemetry::trace::TraceId()) noexcept;
+        ~EndScope();
+
+        EndScope(const EndScope &) = delete;
+        EndScope &operator=(const EndScope &) = delete;
+
+    private:
+        const ExportLane _prev;
+        const uint64_t _prevTrace;
+    };
+
+public:
+    std::unique_ptr<opentelemetry::sdk::trace::Recordable> MakeRecordable() noexcept override;
+    void OnStart(opentelemetry::sdk::trace::Recordable &span,
+                 const opentelemetry::trace::SpanContext &parent) noexcept override;
+    void OnEnd(std::unique_ptr<opentelemetry::sdk::trace::Recordable> &&span) noexcept override;
+    bool ForceFlush(std::chrono::microseconds timeout) noexcept override;
+    bool Shutdown(std::chrono::microseconds timeout) noexcept override;
+
+private:
+    // Queued: a span and what grouping needs of it
+    struct Queued {
+        std::unique_ptr<opentelemetry::sdk::trace::Recordable> _span;
+        ExportLane _lane;
+        uint64_t _trace; // low half of the trace id, 0 if unknown
+        int64_t _end;    // steady ns it was queued at, 0 without grouping
+        bool _carried;   // held back from a batch already
+    };
+
+    // Lane: ring buffer of the spans queued in one lane
+    struct Lane {
+        std::vector<Queued> _ring;
+        size_t _head;     // oldest span
+        size_t _size;     // spans queued
+        unsigned _weight; // see PriorityProcessorOptions::_laneWeights
+    };
+
+    // evict: drop the oldest span of the lowest non-empty lane below lane, held back or not, returns its lane,
+    // kMaxExportLane if none
+    ExportLane evict(unsigned lane) noexcept;
+    // take: fill batch with the held back runs, then by weighted rounds over the lanes, returns the spans dequeued
+    size_t take(std::vector<Queued> &batch) noexcept;
+    // group: order batch by trace, the runs of traces which ended spans within the window go to _held unless final
+    void group(std::vector<Queued> &batch, bool final) noexcept;
+    // run: the export thread
+    void run() noexcept;
+
+private:
+    std::unique_ptr<opentelemetry::sdk::trace::SpanExporter> _exporter;
+    const size_t _maxQueueSize;
+    const size_t _maxBatchSize;
+    const std::chrono::milliseconds _delay;
+    const bool _group;
+    const std::chrono::milliseconds _groupWindow;
+
+    std::mutex _mtx;                  // guards the fields below
+    std::condition_variable _wake;    // the export thread
+    std::condition_variable _flushed; // callers of ForceFlush()
+    std::array<Lane, kMaxExportLane> _lanes;
+    size_t _size;                                      // spans of all lanes
+    std::vector<Queued> _carry;                        // runs held back, still queued, half a batch at most
+    std::chrono::steady_clock::time_point _carryUntil; // the runs held back go with the next batch by then
+    uint64_t _flushWanted;                             // ForceFlush() calls so far
+    uint64_t _flushDone;                               // of the above, drained by the export thread
+    bool _stop;
+
+    // only touched by the export thread
+    std::vector<Queued> _held; // runs held back by group(), to _carry once the lock is taken again
+
+    std::atomic<bool> _shutdown;
+    std::thread _worker;
+};
+
+// MeteredExporter: batch size, latency and result of each export
+class MeteredExporter final : public opentelemetry::sdk::trace::SpanExporter {
+public:
+    explicit MeteredExporter(std::unique_ptr<opentelemetry::sdk::trace::SpanExporter> exporter) noexcept;
+
+public:
+    std::unique_ptr<opentelemetry::sdk::trace::Recordable> MakeRecordable() noexcept override;
+    opentelemetry::sdk::common::ExportResult
+    Export(const opentelemetry::nostd::span<std::unique_ptr<opentelemetry::sdk::trace::Recordable>> &spans) noexcept
+        override;
+    bool Shutdown(std::chrono::microseconds timeout) noexcept override;
+
+private:
+    std::unique_ptr<opentelemetry::sdk::trace::SpanExporter> _exporter;
+};
+
+} // namespace tracing
@@ -4,7 +4,10 @@
 #include <opentelemetry/context/propagation/global_propagator.h>
 #include <opentelemetry/trace/context.h>
 
+#include <atomic>
+
 #include "Common.h"
+#include "ContextStorage.h"
 #include "Tracing.h"
 
 using namespace std;
@@ -14,7 +17,7 @@ constexpr size_t kTraceLen = trace::TraceId::kSize;                            /
 constexpr size_t kSpanLen = trace::SpanId::kSize;                              // 8
 constexpr size_t kFlagLen = sizeof(char);                                      // 1
 constexpr size_t kSizeLen = sizeof(uint32_t);                                  // 4
-constexpr size_t kBinCtxLen = kTraceLen + kSpanLen * 2u + kFlagLen + kSizeLen; // 37
+constexpr size_t kBinCtxLen = tracing::jaeger::kBinaryHeaderSize;             // 37
 
 constexpr int8_t kHexDigits[256] = {
     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
@@ -58,159 +61,423 @@ uint64_t fromBigEndian(uint64_t value) {
 
 namespace detail {
 
-unsigned char HexToInt(char c) {
-    return (unsigned char)kHexDigits[uint8_t(c)];
-}
-
-bool HexToBinary(const string &hex, uint8_t *buffer, size_t buffer_size) {
+// HexToBinary: up to buffer_size * 2 hex chars into buffer, left-padded with zeros, false on any other char or if
+// there are more. Callers which take exactly buffer_size * 2 chars check the size first.
+bool HexToBinary(nostd::string_view hex, uint8_t *buffer, size_t buffer_size) {
     memset(buffer, 0, buffer_size);
-    if (hex.size() > buffer_size * 2) {
+    if (hex.size() > buffer_size * 2u) {
         return false;
     }
-    auto hex_size = (hex.size());
-    auto buffer_pos = buffer_size - (hex_size + 1) / 2;
-    auto last_hex_pos = hex_size - 1;
-    auto i = 0u;
-    for (; i < last_hex_pos; i += 2) {
-        buffer[buffer_pos++] = static_cast<uint8_t>((HexToInt(hex[i]) << 4) | HexToInt(hex[i + 1]));
+    auto nibble = buffer_size * 2u - hex.size();
+    for (size_t i = 0; i < hex.size(); i++, nibble++) {
+        auto digit = kHexDigits[uint8_t(hex[i])];
+        if (digit < 0) {
+            return false;
+        }
+        buffer[nibble / 2u] |= static_cast<uint8_t>(digit << (nibble % 2u == 0 ? 4u : 0u));
     }
-    if (i == last_hex_pos) {
-        buffer[buffer_pos] = HexToInt(hex[i]);
+    return true;
+}
+
+// baggage caps, see tracing::CustomPropagator::SetBaggageLimits()
+atomic<size_t> g_maxEntries(trace::TraceState::kMaxKeyValuePairs);
+atomic<size_t> g_maxKeyLen(trace::TraceState::kKeyMaxSize);
+atomic<size_t> g_maxValueLen(trace::TraceState::kValueMaxSize);
+atomic<size_t> g_maxBytes(4096);
+
+// baggage entries dropped by the caps
+atomic<uint64_t> g_dropEntries(0);
+atomic<uint64_t> g_dropKeyLen(0);
+atomic<uint64_t> g_dropValueLen(0);
+atomic<uint64_t> g_dropBytes(0);
+atomic<uint64_t> g_dropInvalid(0);
+
+uint32_t ReadSize(const char *data) {
+    uint32_t size;
+    memcpy(&size, data, kSizeLen);
+    return endian::fromBigEndian(size);
+}
+
+// ReadId: 8 bytes of an id into id, in the byte order EncodeJaegerHeader() reads them from
+void ReadId(const char *data, uint8_t *id) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    value = endian::fromBigEndian(value);
+    memcpy(id, &value, sizeof(value));
+}
+
+// ForEachBaggage: walk the baggage behind the header, entries within the caps are handed to f (which returns false
+// if it rejects an entry), the others are counted and skipped. Returns false if the context is malformed.
+template <typename F>
+bool ForEachBaggage(nostd::string_view context, uint32_t baggage, F &&f) {
+    const auto maxEntries = g_maxEntries.load(memory_order_relaxed);
+    const auto maxKeyLen = g_maxKeyLen.load(memory_order_relaxed);
+    const auto maxValueLen = g_maxValueLen.load(memory_order_relaxed);
+    const auto maxBytes = g_maxBytes.load(memory_order_relaxed);
+
+    size_t offset = kBinCtxLen;
+    size_t entries = 0u;
+    size_t bytes = 0u;
+    for (auto i = 0u; i < baggage; i++) {
+        // get the key
+        if (offset + kSizeLen > context.size()) {
+            return false;
+        }
+        size_t keySize = ReadSize(context.data() + offset);
+        offset += kSizeLen;
+        if (offset + keySize > context.size()) {
+            return false;
+        }
+        nostd::string_view key(context.data() + offset, keySize);
+        offset += keySize;
+        // get the value
+        if (offset + kSizeLen > context.size()) {
+            return false;
+        }
+        size_t valSize = ReadSize(context.data() + offset);
+        offset += kSizeLen;
+        if (offset + valSize > context.size()) {
+            return false;
+        }
+        nostd::string_view val(context.data() + offset, valSize);
+        offset += valSize;
+        // apply the caps
+        if (entries >= maxEntries) {
+            g_dropEntries.fetch_add(1, memory_order_relaxed);
+            continue;
+        }
+        if (keySize > maxKeyLen) {
+            g_dropKeyLen.fetch_add(1, memory_order_relaxed);
+            continue;
+        }
+        if (valSize > maxValueLen) {
+            g_dropValueLen.fetch_add(1, memory_order_relaxed);
+            continue;
+        }
+        if (bytes + keySize + valSize > maxBytes) {
+            g_dropBytes.fetch_add(1, memory_order_relaxed);
+            continue;
+        }
+        if (!f(key, val)) {
+            g_dropInvalid.fetch_add(1, memory_order_relaxed);
+            continue;
+        }
+        ++entries;
+        bytes += keySize + valSize;
     }
     return true;
 }
 
-// Inject: context -> carrier
-void Inject(const trace::SpanContext &ctx, context::propagation::TextMapCarrier &car) {
-    // prepare buffer for trace-id span-id parent-span-id sample-flag baggage-number <- attention
-    unsigned char buffer[kBinCtxLen];
-    memset(buffer, 0, kBinCtxLen);
+// formats written by Inject(), see tracing::CustomPropagator::SetInjectFormats()
+atomic<unsigned> g_injectFormats(tracing::kFormatJaeger);
 
-    // trace id
-    auto high = endian::toBigEndian(*(uint64_t *)ctx.trace_id().Id().data());
-    auto low = endian::toBigEndian(*(uint64_t *)(ctx.trace_id().Id().data() + kTraceLen / 2u));
-    *(uint64_t *)buffer = high;
-    *(uint64_t *)(buffer + kTraceLen / 2u) = low;
+// offsets in traceparent, 00-<trace id>-<span id>-<flags>
+constexpr size_t kW3CTraceAt = 3u;
+constexpr size_t kW3CSpanAt = kW3CTraceAt + kTraceLen * 2u + 1u; // 36
+constexpr size_t kW3CFlagsAt = kW3CSpanAt + kSpanLen * 2u + 1u;  // 53
 
-    // span id
-    auto span = endian::toBigEndian(*(uint64_t *)ctx.span_id().Id().data());
-    *(uint64_t *)(buffer + kTraceLen) = span;
+// DecodeSpanId: exactly 16 hex chars
+bool DecodeSpanId(nostd::string_view hex, uint8_t *id) {
+    return hex.size() == kSpanLen * 2u && HexToBinary(hex, id, kSpanLen);
+}
 
-    // parent span id: unnecessary
-    // *(uint64_t *)(buffer + kTraceLen + kSpanLen) = 0;
+// DecodeTraceId: 32 hex chars, or 16 as B3 allows for 64-bit ids which are left-padded with zeros
+bool DecodeTraceId(nostd::string_view hex, uint8_t *id) {
+    return (hex.size() == kTraceLen * 2u || hex.size() == kTraceLen) && HexToBinary(hex, id, kTraceLen);
+}
 
-    // flag
-    buffer[kTraceLen + kSpanLen * 2u] = ctx.trace_flags().IsSampled() ? '1' : '0';
+constexpr uint8_t kB3Debug = trace::TraceFlags::kIsSampled | tracing::jaeger::kDebugFlag; // debug implies sampled
+constexpr uint8_t kB3Defer = tracing::b3::kDeferFlag; // no sampling state, this service decides
 
-    // fast return
-    if (ctx.trace_state()->Empty()) {
-        car.Set(tracing::jaeger::kBinaryFormat, nostd::string_view((char *)buffer, kBinCtxLen));
-        return;
+// RemoteContext: ids holds the trace id followed by the span id, both must not be all zeros
+trace::SpanContext RemoteContext(const uint8_t *ids, uint8_t flags,
+                                 nostd::shared_ptr<trace::TraceState> state = trace::TraceState::GetDefault()) {
+    trace::TraceId traceId({ids, kTraceLen});
+    trace::SpanId spanId({ids + kTraceLen, kSpanLen});
+    if (!traceId.IsValid() || !spanId.IsValid()) {
+        return trace::SpanContext::GetInvalid();
     }
+    return {traceId, spanId, trace::TraceFlags(flags), true, state};
+}
 
-    // get all baggage into content, NOT SPECIFIED BY THE SPEC!
-    stringstream content;
-    uint32_t num = 0u;
-    unsigned char size[kSizeLen];
-    ctx.trace_state()->GetAllEntries([&](nostd::string_view key, nostd::string_view val) noexcept -> bool {
-        // memset(size, 0, kSizeLen);
-        *((uint32_t *)size) = endian::toBigEndian((uint32_t)key.size());
-        content << string((char *)size, kSizeLen) << string(key.data(), key.size());
-        // memset(size, 0, kSizeLen);
-        *((uint32_t *)size) = endian::toBigEndian((uint32_t)val.size());
-        content << string((char *)size, kSizeLen) << string(val.data(), val.size());
-        ++num;
-        return true;
-    });
+// InjectJaeger: context -> trace-ctx
+void InjectJaeger(const trace::SpanContext &ctx, context::propagation::TextMapCarrier &car) {
+    char buffer[kBinCtxLen];
+    if (tracing::EncodeJaegerHeader(ctx, buffer)) {
+        // fast return
+        car.Set(tracing::jaeger::kBinaryFormat, nostd::string_view(buffer, kBinCtxLen));
+        return;
+    }
+    car.Set(tracing::jaeger::kBinaryFormat, tracing::EncodeJaegerContext(ctx));
+}
 
-    // DO NOT forget to correct baggage number
-    *((uint32_t *)(&buffer[kTraceLen + kSpanLen * 2u + kFlagLen])) = endian::toBigEndian(num);
+// InjectW3C: context -> traceparent and tracestate
+void InjectW3C(const trace::SpanContext &ctx, context::propagation::TextMapCarrier &car) {
+    char buffer[tracing::w3c::kTraceParentSize];
+    memcpy(buffer, "00-", kW3CTraceAt);
+    ctx.trace_id().ToLowerBase16(nostd::span<char, kTraceLen * 2u>{&buffer[kW3CTraceAt], kTraceLen * 2u});
+    buffer[kW3CSpanAt - 1u] = '-';
+    ctx.span_id().ToLowerBase16(nostd::span<char, kSpanLen * 2u>{&buffer[kW3CSpanAt], kSpanLen * 2u});
+    buffer[kW3CFlagsAt - 1u] = '-';
+    buffer[kW3CFlagsAt] = '0';
+    buffer[kW3CFlagsAt + 1u] = ctx.IsSampled() ? '1' : '0';
+    car.Set(tracing::w3c::kTraceParent, nostd::string_view(buffer, sizeof(buffer)));
+    if (!ctx.trace_state()->Empty()) {
+        car.Set(tracing::w3c::kTraceState, ctx.trace_state()->ToHeader());
+    }
+}
 
-    // construct trace context all-in-one
-    stringstream context;
-    context << string((char *)buffer, kBinCtxLen) << content.str();
-    car.Set(tracing::jaeger::kBinaryFormat, context.str());
+// InjectB3: context -> b3 and/or x-b3-*
+void InjectB3(const trace::SpanContext &ctx, context::propagation::TextMapCarrier &car, unsigned formats) {
+    // trace-id-span-id-sampled, the ids are shared with the multi headers
+    char buffer[kTraceLen * 2u + 1u + kSpanLen * 2u + 2u];
+    ctx.trace_id().ToLowerBase16(nostd::span<char, kTraceLen * 2u>{&buffer[0], kTraceLen * 2u});
+    buffer[kTraceLen * 2u] = '-';
+    ctx.span_id().ToLowerBase16(nostd::span<char, kSpanLen * 2u>{&buffer[kTraceLen * 2u + 1u], kSpanLen * 2u});
+    buffer[sizeof(buffer) - 2u] = '-';
+    buffer[sizeof(buffer) - 1u] = ctx.IsSampled() ? '1' : '0';
+    if (formats & tracing::kFormatB3) {
+        car.Set(tracing::b3::kSingle, nostd::string_view(buffer, sizeof(buffer)));
+    }
+    if (formats & tracing::kFormatB3Multi) {
+        car.Set(tracing::b3::kTraceId, nostd::string_view(buffer, kTraceLen * 2u));
+        car.Set(tracing::b3::kSpanId, nostd::string_view(&buffer[kTraceLen * 2u + 1u], kSpanLen * 2u));
+        car.Set(tracing::b3::kSampled, nostd::string_view(&buffer[sizeof(buffer) - 1u], 1u));
+    }
 }
 
-// Extract: carrier -> context
-trace::SpanContext Extract(const context::propagation::TextMapCarrier &car) {
-    // get jaeger trace context all-in-one
-    auto context = car.Get(tracing::jaeger::kBinaryFormat);
+// Inject: context -> carrier, in every configured format
+void Inject(const trace::SpanContext &ctx, context::propagation::TextMapCarrier &car) {
+    auto formats = g_injectFormats.load(memory_order_relaxed);
+    if (formats & tracing::kFormatJaeger) {
+        InjectJaeger(ctx, car);
+    }
+    if (formats & tracing::kFormatW3C) {
+        InjectW3C(ctx, car);
+    }
+    if (formats & (tracing::kFormatB3 | tracing::kFormatB3Multi)) {
+        InjectB3(ctx, car, formats);
+    }
+}
 
+// ExtractJaeger: trace-ctx -> context
+trace::SpanContext ExtractJaeger(nostd::string_view context) {
     // fast return
-    if (context.empty() || context.size() < kBinCtxLen) {
+    if (context.size() < kBinCtxLen) {
         return trace::SpanContext::GetInvalid();
     }
 
-    // trace id
-    auto high = endian::fromBigEndian(*(uint64_t *)context.data());
-    auto low = endian::fromBigEndian(*(uint64_t *)(context.data() + kTraceLen / 2u));
-    *(uint64_t *)context.data() = high;
-    *(uint64_t *)(context.data() + kTraceLen / 2u) = low;
-    trace::TraceId traceId({(uint8_t *)context.data(), kTraceLen});
-
-    // span id
-    auto span = endian::fromBigEndian(*(uint64_t *)(context.data() + kTraceLen));
-    *(uint64_t *)(context.data() + kTraceLen) = span;
-    trace::SpanId spanId({(uint8_t *)(context.data() + kTraceLen), kSpanLen});
+    // ids are decoded into a copy, the context may be the caller's receive buffer
+    uint8_t ids[kTraceLen + kSpanLen];
+    ReadId(context.data(), ids);
+    ReadId(context.data() + kTraceLen / 2u, ids + kTraceLen / 2u);
+    ReadId(context.data() + kTraceLen, ids + kTraceLen);
+    trace::TraceId traceId({ids, kTraceLen});
+    trace::SpanId spanId({ids + kTraceLen, kSpanLen});
 
-    // parend span id: unnecessary
-    // auto parent = endian::fromBigEndian(*(uint64_t *)(context.data() + kTraceLen + kSpanLen));
-    // *(uint64_t *)(context.data() + kTraceLen + kSpanLen) = parent;
-    // trace::SpanId parentId({(uint8_t *)(context.data() + kTraceLen + kSpanLen), kSpanLen});
+    // parent span id: unnecessary
 
     // flag
-    trace::TraceFlags flag{*((uint8_t *)(context.data() + kTraceLen + kSpanLen * 2u))};
+    trace::TraceFlags flag{*((const uint8_t *)(context.data() + kTraceLen + kSpanLen * 2u))};
 
     // get number of baggage which is well-known as trace-state
-    unsigned char size[kSizeLen];
-    memcpy(size, context.data() + kTraceLen + kSpanLen * 2u + kFlagLen, kSizeLen);
-    auto baggage = endian::fromBigEndian(*((uint32_t *)size));
+    auto baggage = ReadSize(context.data() + kTraceLen + kSpanLen * 2u + kFlagLen);
 
     // fast return
     if (baggage == 0u) {
         return {traceId, spanId, flag, true};
     }
 
-    // get all baggage, NOT SPECIFIED BY THE SPEC!
-    auto state = trace::TraceState::GetDefault();
-    size_t offset = kBinCtxLen;
-    for (auto i = 0u; i < baggage; i++) {
-        // get the key
-        if (offset + kSizeLen > context.size()) {
-            return trace::SpanContext::GetInvalid();
+    // get all baggage in one pass and build the trace state at once, NOT SPECIFIED BY THE SPEC!
+    static thread_local string header;
+    header.clear();
+    auto ok = ForEachBaggage(context, baggage, [](nostd::string_view key, nostd::string_view val) -> bool {
+        if (!trace::TraceState::IsValidKey(key) || !trace::TraceState::IsValidValue(val)) {
+            return false;
         }
-        auto keySize = endian::fromBigEndian(*(uint32_t *)nostd::string_view(context.data() + offset, kSizeLen).data());
-        offset += kSizeLen;
-        if (offset + keySize > context.size()) {
-            return trace::SpanContext::GetInvalid();
+        if (!header.empty()) {
+            header.push_back(',');
         }
-        auto key = string(context.data() + offset, keySize);
-        offset += keySize;
-        // get the value
-        if (offset + kSizeLen > context.size()) {
+        header.append(key.data(), key.size()).append(1, '=').append(val.data(), val.size());
+        return true;
+    });
+    if (!ok) {
+        return trace::SpanContext::GetInvalid();
+    }
+
+    // finally
+    return {traceId, spanId, flag, true, trace::TraceState::FromHeader(header)};
+}
+
+// ExtractW3C: traceparent and tracestate -> context, later versions may append fields behind the flags
+trace::SpanContext ExtractW3C(nostd::string_view parent, nostd::string_view state) {
+    const auto *p = parent.data();
+    if (parent.size() < tracing::w3c::kTraceParentSize || p[kW3CTraceAt - 1u] != '-' || p[kW3CSpanAt - 1u] != '-' ||
+        p[kW3CFlagsAt - 1u] != '-') {
+        return trace::SpanContext::GetInvalid();
+    }
+    uint8_t version, flags;
+    uint8_t ids[kTraceLen + kSpanLen];
+    if (!HexToBinary({p, 2u}, &version, 1u) || version == 0xffu ||
+        !HexToBinary({p + kW3CTraceAt, kTraceLen * 2u}, ids, kTraceLen) ||
+        !HexToBinary({p + kW3CSpanAt, kSpanLen * 2u}, ids + kTraceLen, kSpanLen) ||
+        !HexToBinary({p + kW3CFlagsAt, 2u}, &flags, 1u)) {
+        return trace::SpanContext::GetInvalid();
+    }
+    // version 00 is exactly 55 chars
+    if (parent.size() != tracing::w3c::kTraceParentSize &&
+        (version == 0u || p[tracing::w3c::kTraceParentSize] != '-')) {
+        return trace::SpanContext::GetInvalid();
+    }
+    // bits besides sampled mean other things in W3C
+    flags &= trace::TraceFlags::kIsSampled;
+    if (state.empty()) {
+        return RemoteContext(ids, flags);
+    }
+    return RemoteContext(ids, flags, trace::TraceState::FromHeader(state));
+}
+
+// ExtractB3: b3 -> context, a header with the sampling state only ("0", "1" or "d") carries no context. Without a
+// sampling state the decision is deferred to this service, see tracing::DeferSampler.
+trace::SpanContext ExtractB3(nostd::string_view b3) {
+    const auto *p = b3.data();
+    size_t dash = 0u;
+    while (dash < b3.size() && p[dash] != '-') {
+        ++dash;
+    }
+    uint8_t ids[kTraceLen + kSpanLen];
+    auto offset = dash + 1u;
+    if (offset + kSpanLen * 2u > b3.size() || !DecodeTraceId({p, dash}, ids) ||
+        !DecodeSpanId({p + offset, kSpanLen * 2u}, ids + kTraceLen)) {
+        return trace::SpanContext::GetInvalid();
+    }
+    offset += kSpanLen * 2u;
+    // sampling state, then parent span id: unnecessary
+    uint8_t flags = kB3Defer;
+    if (offset < b3.size()) {
+        if (p[offset] != '-' || offset + 1u == b3.size() || (offset + 2u < b3.size() && p[offset + 2u] != '-')) {
             return trace::SpanContext::GetInvalid();
         }
-        auto valSize =
-            endian::fromBigEndian(*(uint32_t *)(nostd::string_view(context.data() + offset, kSizeLen).data()));
-        offset += kSizeLen;
-        if (offset + valSize > context.size()) {
+        auto state = p[offset + 1u];
+        if (state != '0' && state != '1' && state != 'd') {
             return trace::SpanContext::GetInvalid();
         }
-        auto val = string(context.data() + offset, valSize);
-        offset += valSize;
-        // write into trace state
-        state = state->Set(key, val);
+        flags = state == 'd' ? kB3Debug : state == '1' ? trace::TraceFlags::kIsSampled : 0u;
     }
+    return RemoteContext(ids, flags);
+}
 
-    // finally
-    return {traceId, spanId, flag, true, move(state)};
+// ExtractB3Multi: x-b3-* -> context, debug implies sampled, the decision is deferred without x-b3-sampled
+trace::SpanContext ExtractB3Multi(const context::propagation::TextMapCarrier &car, nostd::string_view traceId) {
+    uint8_t ids[kTraceLen + kSpanLen];
+    if (!DecodeTraceId(traceId, ids) || !DecodeSpanId(car.Get(tracing::b3::kSpanId), ids + kTraceLen)) {
+        return trace::SpanContext::GetInvalid();
+    }
+    auto sampled = car.Get(tracing::b3::kSampled);
+    auto debug = car.Get(tracing::b3::kFlags);
+    if (debug == "1") {
+        return RemoteContext(ids, kB3Debug);
+    }
+    if (sampled.empty()) {
+        return RemoteContext(ids, kB3Defer);
+    }
+    return RemoteContext(ids, sampled == "1" || sampled == "true" ? trace::TraceFlags::kIsSampled : 0u);
 }
 
+// Extract: carrier -> context, by the first format found
+trace::SpanContext Extract(const context::propagation::TextMapCarrier &car) {
+    // get jaeger trace context all-in-one
+    auto context = car.Get(tracing::jaeger::kBinaryFormat);
+    if (!context.empty()) {
+        return ExtractJaeger(context);
+    }
+    auto parent = car.Get(tracing::w3c::kTraceParent);
+    if (!parent.empty()) {
+        return ExtractW3C(parent, car.Get(tracing::w3c::kTraceState));
+    }
+    auto b3 = car.Get(tracing::b3::kSingle);
+    if (!b3.empty()) {
+        return ExtractB3(b3);
+    }
+    auto traceId = car.Get(tracing::b3::kTraceId);
+    if (!traceId.empty()) {
+        return ExtractB3Multi(car, traceId);
+    }
+    return trace::SpanContext::GetInvalid();
+}
+
+constexpr uint64_t kRelayGeneration = ~0ull; // LogIdCache filled from the relayed context
+
+// LogIdCache: see Tracing::GetLogIds()
+struct LogIdCache {
+    LogIdCache()
+        : _generation(0) // nothing attached yet at generation 0, _valid is right
+        , _valid(false)
+        , _trace()
+        , _span()
+        , _relay() {}
+
+    uint64_t _generation; // of the context stack when filled
+    bool _valid;
+    char _trace[kTraceLen * 2];
+    char _span[kSpanLen * 2];
+    string _relay; // relayed context when filled while tracing is off
+};
+
+thread_local LogIdCache t_logIds;
+
 } // namespace detail
 
 namespace tracing {
 
+bool EncodeJaegerHeader(const trace::SpanContext &ctx, char (&buffer)[jaeger::kBinaryHeaderSize]) noexcept {
+    // prepare buffer for trace-id span-id parent-span-id sample-flag baggage-number <- attention
+    memset(buffer, 0, kBinCtxLen);
+
+    // trace id
+    auto high = endian::toBigEndian(*(uint64_t *)ctx.trace_id().Id().data());
+    auto low = endian::toBigEndian(*(uint64_t *)(ctx.trace_id().Id().data() + kTraceLen / 2u));
+    *(uint64_t *)buffer = high;
+    *(uint64_t *)(buffer + kTraceLen / 2u) = low;
+
+    // span id
+    auto span = endian::toBigEndian(*(uint64_t *)ctx.span_id().Id().data());
+    *(uint64_t *)(buffer + kTraceLen) = span;
+
+    // parent span id: unnecessary
+    // *(uint64_t *)(buffer + kTraceLen + kSpanLen) = 0;
+
+    // flag
+    buffer[kTraceLen + kSpanLen * 2u] = ctx.trace_flags().IsSampled() ? '1' : '0';
+
+    // baggage number is left 0, see EncodeJaegerContext()
+    return ctx.trace_state()->Empty();
+}
+
+string EncodeJaegerContext(const trace::SpanContext &ctx) noexcept {
+    char buffer[kBinCtxLen];
+    if (EncodeJaegerHeader(ctx, buffer)) {
+        return {buffer, kBinCtxLen};
+    }
+
+    // get all baggage behind the header, NOT SPECIFIED BY THE SPEC!
+    string context(buffer, kBinCtxLen);
+    uint32_t num = 0u;
+    unsigned char size[kSizeLen];
+    ctx.trace_state()->GetAllEntries([&](nostd::string_view key, nostd::string_view val) noexcept -> bool {
+        *((uint32_t *)size) = endian::toBigEndian((uint32_t)key.size());
+        context.append((char *)size, kSizeLen).append(key.data(), key.size());
+        *((uint32_t *)size) = endian::toBigEndian((uint32_t)val.size());
+        context.append((char *)size, kSizeLen).append(val.data(), val.size());
+        ++num;
+        return true;
+    });
+
+    // DO NOT forget to correct baggage number
+    *((uint32_t *)(&context[kTraceLen + kSpanLen * 2u + kFlagLen])) = endian::toBigEndian(num);
+    return context;
+}
+
 nostd::string_view CustomCarrier::Get(nostd::string_view key) const noexcept {
     auto it = _headers.find(key);
     if (it != _headers.end()) {
@@ -223,6 +490,15 @@ void CustomCarrier::Set(nostd::string_view key, nostd::string_view value) noexce
     _headers[key] = {value.data(), value.size()};
 }
 
+CustomCarrierView::CustomCarrierView(nostd::string_view context) noexcept
+    : _context(context) {}
+
+nostd::string_view CustomCarrierView::Get(nostd::string_view key) const noexcept {
+    return key == jaeger::kBinaryFormat ? _context : nostd::string_view();
+}
+
+void CustomCarrierView::Set(nostd::string_view, nostd::string_view) noexcept {}
+
 void CustomPropagator::Inject(context::propagation::TextMapCarrier &carrier, const context::Context &context) noexcept {
     auto spanContext = trace::GetSpan(context)->GetContext();
     if (!spanContext.IsValid()) {
@@ -239,14 +515,65 @@ context::Context CustomPropagator::Extract(const context::propagation::TextMapCa
 }
 
 bool CustomPropagator::Fields(nostd::function_ref<bool(nostd::string_view)> callback) const noexcept {
-    return callback(jaeger::kBinaryFormat);
+    auto formats = detail::g_injectFormats.load(memory_order_relaxed);
+    if ((formats & kFormatJaeger) && !callback(jaeger::kBinaryFormat)) {
+        return false;
+    }
+    if ((formats & kFormatW3C) && (!callback(w3c::kTraceParent) || !callback(w3c::kTraceState))) {
+        return false;
+    }
+    if ((formats & kFormatB3) && !callback(b3::kSingle)) {
+        return false;
+    }
+    if ((formats & kFormatB3Multi) && (!callback(b3::kTraceId) || !callback(b3::kSpanId) || !callback(b3::kSampled))) {
+        return false;
+    }
+    return true;
+}
+
+void CustomPropagator::SetBaggageLimits(const BaggageLimits &limits) noexcept {
+    // the trace state can not hold more than kMaxKeyValuePairs entries
+    detail::g_maxEntries.store(min<size_t>(limits._maxEntries, trace::TraceState::kMaxKeyValuePairs),
+                               memory_order_relaxed);
+    detail::g_maxKeyLen.store(limits._maxKeyLen, memory_order_relaxed);
+    detail::g_maxValueLen.store(limits._maxValueLen, memory_order_relaxed);
+    detail::g_maxBytes.store(limits._maxBytes, memory_order_relaxed);
+}
+
+void CustomPropagator::SetInjectFormats(unsigned formats) noexcept {
+    detail::g_injectFormats.store(formats, memory_order_relaxed);
+}
+
+bool CustomPropagator::ParseFormat(const string &name, PropagationFormat &format) noexcept {
+    if (name == "jaeger") {
+        format = kFormatJaeger;
+    } else if (name == "w3c") {
+        format = kFormatW3C;
+    } else if (name == "b3") {
+        format = kFormatB3;
+    } else if (name == "b3multi") {
+        format = kFormatB3Multi;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+BaggageDrops CustomPropagator::GetBaggageDrops() noexcept {
+    BaggageDrops drops;
+    drops._entries = detail::g_dropEntries.load(memory_order_relaxed);
+    drops._keyLen = detail::g_dropKeyLen.load(memory_order_relaxed);
+    drops._valueLen = detail::g_dropValueLen.load(memory_order_relaxed);
+    drops._bytes = detail::g_dropBytes.load(memory_order_relaxed);
+    drops._invalid = detail::g_dropInvalid.load(memory_order_relaxed);
+    return drops;
 }
 
 } // namespace tracing
 
 namespace tracing {
 
-Context::Context(const string &context)
+Context::Context(nostd::string_view context)
     : _traceId("000000000000000000")
     , _spanId("000000000")
     , _parentSpanId("000000000")
@@ -256,21 +583,14 @@ Context::Context(const string &context)
         return;
     }
 
-    trace::TraceId traceId({(uint8_t *)context.data(), kTraceLen});
-    auto high = endian::fromBigEndian(*(uint64_t *)traceId.Id().data());
-    auto low = endian::fromBigEndian(*(uint64_t *)(traceId.Id().data() + kTraceLen / 2u));
-    *(uint64_t *)traceId.Id().data() = high;
-    *(uint64_t *)(traceId.Id().data() + kTraceLen / 2u) = low;
+    uint8_t ids[kTraceLen + kSpanLen];
+    detail::ReadId(context.data(), ids);
+    detail::ReadId(context.data() + kTraceLen / 2u, ids + kTraceLen / 2u);
+    detail::ReadId(context.data() + kTraceLen, ids + kTraceLen);
+    trace::TraceId traceId({ids, kTraceLen});
+    trace::SpanId spanId({ids + kTraceLen, kSpanLen});
 
-    trace::SpanId spanId({(uint8_t *)(context.data() + kTraceLen), kSpanLen});
-    auto span = endian::fromBigEndian(*(uint64_t *)spanId.Id().data());
-    *(uint64_t *)spanId.Id().data() = span;
-
-    // trace::SpanId parendId({(uint8_t *)(context.data() + kTraceLen + kSpanLen), kSpanLen});
-    // auto parent = endian::fromBigEndian(*(uint64_t *)parendId.Id().data());
-    // *(uint64_t *)parendId.Id().data() = parent;
-
-    trace::TraceFlags flag{*((uint8_t *)(context.data() + kTraceLen + kSpanLen * 2u))};
+    trace::TraceFlags flag{*((const uint8_t *)(context.data() + kTraceLen + kSpanLen * 2u))};
 
     constexpr const size_t length = kTraceLen * 2u + kSpanLen * 2u + kSpanLen * 2u;
     char buffer[length];
@@ -291,38 +611,15 @@ Context::Context(const string &context)
     // }
     _sampled = flag.IsSampled();
 
-    unsigned char size[kSizeLen];
-    memcpy(size, context.data() + kTraceLen + kSpanLen * 2u + kFlagLen, kSizeLen);
-    auto baggage = endian::fromBigEndian(*((uint32_t *)size));
+    auto baggage = detail::ReadSize(context.data() + kTraceLen + kSpanLen * 2u + kFlagLen);
     if (baggage == 0) {
         return;
     }
 
-    size_t offset = kBinCtxLen;
-    for (auto i = 0u; i < baggage; i++) {
-        if (offset + kSizeLen > context.size()) {
-            return;
-        }
-        auto keySize = endian::fromBigEndian(*(uint32_t *)nostd::string_view(context.data() + offset, kSizeLen).data());
-        offset += kSizeLen;
-        if (offset + keySize > context.size()) {
-            return;
-        }
-        auto key = string(context.data() + offset, keySize);
-        offset += keySize;
-        if (offset + kSizeLen > context.size()) {
-            return;
-        }
-        auto valSize =
-            endian::fromBigEndian(*(uint32_t *)(nostd::string_view(context.data() + offset, kSizeLen).data()));
-        offset += kSizeLen;
-        if (offset + valSize > context.size()) {
-            return;
-        }
-        auto val = string(context.data() + offset, valSize);
-        offset += valSize;
-        _baggage.emplace(move(key), move(val));
-    }
+    detail::ForEachBaggage(context, baggage, [&](nostd::string_view key, nostd::string_view val) -> bool {
+        _baggage.emplace_hint(_baggage.end(), string(key.data(), key.size()), string(val.data(), val.size()));
+        return true;
+    });
 }
 
 Context::Context(const trace::SpanContext &context)
@@ -358,39 +655,100 @@ Context::Context(const string &traceId, const string &spanId, const string &pare
     , _baggage(baggage) {}
 
 Context Tracing::GetPlainTextContext() noexcept {
+    if (!IsEnabled()) {
+        return Context(relayed());
+    }
     auto ctx = context::RuntimeContext::GetCurrent();
     return Context(trace::GetSpan(ctx)->GetContext());
 }
 
 string Tracing::GetJaegerContext() noexcept {
-    auto pr = context::propagation::GlobalTextMapPropagator::GetGlobalPropagator();
-    auto ctx = context::RuntimeContext::GetCurrent();
-    CustomCarrier carrier;
-    pr->Inject(carrier, ctx);
-
-    auto tc = carrier.Get(jaeger::kBinaryFormat);
+    auto tc = GetJaegerContextView();
     return {tc.data(), tc.size()};
 }
 
-Context Tracing::ParseFromJaegerContext(const string &context) noexcept {
+nostd::string_view Tracing::GetJaegerContextView() noexcept {
+    if (!IsEnabled()) {
+        return relayed();
+    }
+    auto memo = CustomContextStorage::Memo();
+    if (memo == nullptr) {
+        return {};
+    }
+    if (memo->empty()) {
+        auto ctx = trace::GetSpan(CustomContextStorage::Current())->GetContext();
+        if (ctx.IsValid()) {
+            *memo = EncodeJaegerContext(ctx);
+        }
+    }
+    return *memo;
+}
+
+LogIds Tracing::GetLogIds() noexcept {
+    auto &cache = detail::t_logIds;
+    if (!IsEnabled()) {
+        // rare, decoded again only when the relayed context changes
+        auto relay = relayed();
+        if (cache._generation != detail::kRelayGeneration || relay != nostd::string_view(cache._relay)) {
+            Context ctx(relay);
+            cache._relay.assign(relay.data(), relay.size());
+            cache._generation = detail::kRelayGeneration;
+            cache._valid = ctx._traceId.size() == sizeof(cache._trace) && ctx._spanId.size() == sizeof(cache._span);
+            if (cache._valid) {
+                memcpy(cache._trace, ctx._traceId.data(), sizeof(cache._trace));
+                memcpy(cache._span, ctx._spanId.data(), sizeof(cache._span));
+            }
+        }
+    } else if (cache._generation != CustomContextStorage::Generation()) {
+        cache._generation = CustomContextStorage::Generation();
+        auto ctx = trace::GetSpan(CustomContextStorage::Current())->GetContext();
+        cache._valid = ctx.IsValid();
+        if (cache._valid) {
+            ctx.trace_id().ToLowerBase16(cache._trace);
+            ctx.span_id().ToLowerBase16(cache._span);
+        }
+    }
+    if (!cache._valid) {
+        return {};
+    }
+    return {{cache._trace, sizeof(cache._trace)}, {cache._span, sizeof(cache._span)}};
+}
+
+Context Tracing::ParseFromJaegerContext(nostd::string_view context) noexcept {
     return Context(context);
 }
 
+size_t Tracing::DumpFlight(const string &traceId, const string &path) noexcept {
+    FlightFilter filter{};
+    filter._byTrace = true;
+    if (traceId.size() != kTraceLen * 2u || !detail::HexToBinary(traceId, filter._trace, kTraceLen)) {
+        return 0;
+    }
+    return dumpFlight(filter, path);
+}
+
 string Tracing::FormatAsJaegerContext(const Context &context) noexcept {
+    string out;
+    FormatAsJaegerContext(context, out);
+    return out;
+}
+
+bool Tracing::FormatAsJaegerContext(const Context &context, string &out) noexcept {
+    out.clear();
     if (context._traceId.size() != kTraceLen * 2u || context._spanId.size() != kSpanLen * 2u) {
-        return {};
+        return false;
     }
     unsigned char buffer[kTraceLen + kSpanLen + kSpanLen];
     if (!detail::HexToBinary(context._traceId, buffer, kTraceLen)) {
-        return {};
+        return false;
     }
     trace::TraceId traceId({(uint8_t *)buffer, kTraceLen});
     if (!detail::HexToBinary(context._spanId, buffer + kTraceLen, kSpanLen)) {
-        return {};
+        return false;
     }
     trace::SpanId spanId({(uint8_t *)buffer + kTraceLen, kSpanLen});
     if (!detail::HexToBinary(context._parentSpanId, buffer + kTraceLen + kSpanLen, kSpanLen)) {
-        return {};
+        return false;
     }
     trace::SpanId parent({(uint8_t *)buffer + kTraceLen + kSpanLen, kSpanLen});
     trace::TraceFlags flag(context._sampled ? trace::TraceFlags::kIsSampled : 0);
@@ -400,11 +758,13 @@ string Tracing::FormatAsJaegerContext(const Context &context) noexcept {
     }
 
     trace::SpanContext ctx(traceId, spanId, flag, true, state);
-    CustomCarrier carrier;
-    detail::Inject(ctx, carrier);
-
-    auto tc = carrier.Get(jaeger::kBinaryFormat);
-    return {tc.data(), tc.size()};
+    char header[kBinCtxLen];
+    if (EncodeJaegerHeader(ctx, header)) {
+        out.assign(header, kBinCtxLen);
+    } else {
+        out = EncodeJaegerContext(ctx);
+    }
+    return true;
 }
 
 } // namespace tracing
@@ -1,11 +1,52 @@
 #pragma once
 
 #include <opentelemetry/context/propagation/text_map_propagator.h>
+#include <opentelemetry/trace/span_context.h>
 
 #include <map>
+#include <string>
+
+#include "Common.h"
 
 namespace tracing {
 
+// EncodeJaegerHeader: encode the fixed-size part of jaeger binary context, returns false if baggage should follow
+bool EncodeJaegerHeader(const opentelemetry::trace::SpanContext &context,
+                        char (&buffer)[jaeger::kBinaryHeaderSize]) noexcept;
+// EncodeJaegerContext: encode the whole jaeger binary context with baggage
+std::string EncodeJaegerContext(const opentelemetry::trace::SpanContext &context) noexcept;
+
+// BaggageLimits: caps on the baggage decoded from remote contexts, see baggage in tracing.yml
+struct BaggageLimits {
+    BaggageLimits() noexcept
+        : _maxEntries(32)
+        , _maxKeyLen(256)
+        , _maxValueLen(256)
+        , _maxBytes(4096) {}
+
+    size_t _maxEntries;  // entries per context, no more than TraceState::kMaxKeyValuePairs
+    size_t _maxKeyLen;   // bytes per key
+    size_t _maxValueLen; // bytes per value
+    size_t _maxBytes;    // bytes of all keys and values
+};
+
+// BaggageDrops: baggage entries dropped since start, by reason
+struct BaggageDrops {
+    uint64_t _entries;  // over _maxEntries
+    uint64_t _keyLen;   // over _maxKeyLen
+    uint64_t _valueLen; // over _maxValueLen
+    uint64_t _bytes;    // over _maxBytes
+    uint64_t _invalid;  // not a valid trace state key/value
+};
+
+// PropagationFormat: context formats CustomPropagator understands, see propagation in tracing.yml
+enum PropagationFormat : unsigned {
+    kFormatJaeger = 1u << 0u,  // trace-ctx, jaeger binary context
+    kFormatW3C = 1u << 1u,     // traceparent and tracestate
+    kFormatB3 = 1u << 2u,      // b3 single header
+    kFormatB3Multi = 1u << 3u, // x-b3-traceid, x-b3-spanid and x-b3-sampled
+};
+
 class CustomCarrier final : public opentelemetry::context::propagation::TextMapCarrier {
 public:
     // Get: Return the value associated with the key if it exists.
@@ -17,6 +58,23 @@ private:
     std::map<opentelemetry::nostd::string_view, std::string> _headers;
 };
 
+// CustomCarrierView: read-only carrier over jaeger binary context owned by the caller (e.g. an RPC receive buffer),
+// which Extract() decodes without a copy. Set() is ignored.
+class CustomCarrierView final : public opentelemetry::context::propagation::TextMapCarrier {
+public:
+    explicit CustomCarrierView(opentelemetry::nostd::string_view context) noexcept;
+
+public:
+    opentelemetry::nostd::string_view Get(opentelemetry::nostd::string_view key) const noexcept override;
+    void Set(opentelemetry::nostd::string_view key, opentelemetry::nostd::string_view value) noexcept override;
+
+private:
+    opentelemetry::nostd::string_view _context;
+};
+
+// CustomPropagator: Extract() picks the format by the keys present, trying trace-ctx, traceparent, b3 and
+// x-b3-traceid in this order, and decodes it without a heap allocation unless there is baggage. Inject() writes the
+// formats set by SetInjectFormats(), jaeger binary context only by default.
 class CustomPropagator final : public opentelemetry::context::propagation::TextMapPropagator {
 public:
     // Inject: Inject the context into the carrier.
@@ -29,6 +87,16 @@ public:
     // false to stop.
     bool Fields(
         opentelemetry::nostd::function_ref<bool(opentelemetry::nostd::string_view)> callback) const noexcept override;
+
+public:
+    // SetBaggageLimits: caps applied by Extract() and Context(nostd::string_view)
+    static void SetBaggageLimits(const BaggageLimits &limits) noexcept;
+    // GetBaggageDrops: entries dropped by the caps
+    static BaggageDrops GetBaggageDrops() noexcept;
+    // SetInjectFormats: formats Inject() writes for the next hop, a mask of PropagationFormat
+    static void SetInjectFormats(unsigned formats) noexcept;
+    // ParseFormat: "jaeger", "w3c", "b3" or "b3multi", false if name is none of them
+    static bool ParseFormat(const std::string &name, PropagationFormat &format) noexcept;
 };
 
 } // namespace tracing
@@ -0,0 +1,288 @@
+#include "Recorder.h"
+
+#include <opentelemetry/trace/span_id.h>
+#include <opentelemetry/trace/trace_id.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <new>
+
+#include "Clock.h"
+#include "Names.h"
+
+using namespace std;
+using namespace opentelemetry;
+
+namespace detail {
+
+constexpr unsigned kMaxReadRetries = 4; // a slot rewritten that often while read is skipped
+
+// FlightSlot: one record in 7 words, written by the owner thread only
+struct FlightSlot {
+    atomic<uint32_t> _seq; // odd while being written
+    atomic<uint32_t> _uid;
+    atomic<uint64_t> _words[7];
+};
+
+static_assert(sizeof(FlightSlot) == 64, "flight slot should fit in a cache line");
+
+// FlightRing: records of one thread, handed over to another thread once the owner exits
+struct FlightRing {
+    explicit FlightRing(size_t capacity)
+        : _slots(nullptr)
+        , _capacity(capacity)
+        , _head(0)
+        , _owned(true) {
+        // cache line aligned, which operator new does not promise in C++11
+        void *slots = nullptr;
+        if (posix_memalign(&slots, 64, capacity * sizeof(FlightSlot)) != 0) {
+            throw bad_alloc();
+        }
+        _slots = static_cast<FlightSlot *>(slots);
+        for (size_t i = 0; i < capacity; i++) {
+            new (&_slots[i]) FlightSlot();
+        }
+    }
+    ~FlightRing() {
+        free(_slots);
+    }
+
+    FlightRing(const FlightRing &) = delete;
+    FlightRing &operator=(const FlightRing &) = delete;
+
+    FlightSlot *_slots;
+    const size_t _capacity;
+    atomic<uint64_t> _head; // records written so far
+    atomic<bool> _owned;
+};
+
+uint64_t Load64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+void Store64(uint8_t *p, uint64_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+class FlightRegistry final {
+public:
+    FlightRegistry()
+        : _enable(false)
+        , _capacity(4096)
+        , _mtx()
+        , _rings() {}
+
+public:
+    atomic<bool> _enable;
+    atomic<size_t> _capacity;
+
+    // Acquire: a ring left by an exited thread, or a new one
+    FlightRing *Acquire() {
+        lock_guard<mutex> lock(_mtx);
+        const auto capacity = _capacity.load(memory_order_relaxed);
+        for (auto &ring : _rings) {
+            auto owned = false;
+            if (ring->_capacity == capacity && ring->_owned.compare_exchange_strong(owned, true)) {
+                return ring.get();
+            }
+        }
+        _rings.emplace_back(new FlightRing(capacity));
+        return _rings.back().get();
+    }
+
+    template <typename F>
+    void ForEach(F f) {
+        lock_guard<mutex> lock(_mtx);
+        for (const auto &ring : _rings) {
+            f(*ring);
+        }
+    }
+
+    void Lock() {
+        _mtx.lock();
+    }
+
+    void Unlock() {
+        _mtx.unlock();
+    }
+
+private:
+    mutex _mtx; // guards _rings, rings are never released
+    vector<unique_ptr<FlightRing>> _rings;
+};
+
+FlightRegistry &GetFlightRegistry() {
+    static auto registry = new FlightRegistry; // never destroyed, threads may exit after static destruction
+    return *registry;
+}
+
+struct LocalFlightRing {
+    LocalFlightRing()
+        : _ring(GetFlightRegistry().Acquire()) {}
+    ~LocalFlightRing() {
+        _ring->_owned.store(false);
+    }
+    FlightRing *_ring;
+};
+
+FlightRing &LocalRing() {
+    static thread_local LocalFlightRing local;
+    return *local._ring;
+}
+
+// Read: copy a slot out, false if it is being written or empty
+bool Read(const FlightSlot &slot, tracing::FlightRecord &record) {
+    for (auto i = 0u; i < kMaxReadRetries; i++) {
+        auto seq = slot._seq.load(memory_order_acquire);
+        if (seq == 0) {
+            return false;
+        }
+        if (seq & 1u) {
+            continue;
+        }
+        uint64_t words[7];
+        for (auto j = 0u; j < 7; j++) {
+            words[j] = slot._words[j].load(memory_order_relaxed);
+        }
+        auto uid = slot._uid.load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (slot._seq.load(memory_order_relaxed) != seq) {
+            continue;
+        }
+
+        Store64(record._trace, words[0]);
+        Store64(record._trace + 8, words[1]);
+        Store64(record._span, words[2]);
+        Store64(record._parent, words[3]);
+        record._start = (int64_t)words[4];
+        record._duration = (uint32_t)words[5];
+        record._cmd = (uint32_t)(words[5] >> 32u);
+        record._err = (int32_t)(uint32_t)words[6];
+        record._name = (uint32_t)(words[6] >> 32u) & 0xffffu;
+        record._kind = (uint8_t)(words[6] >> 48u);
+        record._sampled = (words[6] >> 56u) != 0;
+        record._uid = uid;
+        return true;
+    }
+    return false;
+}
+
+bool Match(const tracing::FlightFilter &filter, const tracing::FlightRecord &record) {
+    if (filter._byTrace) {
+        return memcmp(filter._trace, record._trace, sizeof(record._trace)) == 0;
+    }
+    auto end = record._start + (int64_t)record._duration * 1000;
+    return end >= filter._since && end <= filter._until;
+}
+
+// Hex: an id in lower case hex, as the propagators write it
+template <typename Id>
+void Hex(ostream &out, const uint8_t *p) {
+    char hex[Id::kSize * 2];
+    Id(nostd::span<const uint8_t, Id::kSize>(p, Id::kSize)).ToLowerBase16(hex);
+    out.write(hex, sizeof(hex));
+}
+
+} // namespace detail
+
+namespace tracing {
+
+void Recorder::Setup(bool enable, size_t capacity) noexcept {
+    size_t rounded = 1;
+    while (rounded < capacity) {
+        rounded <<= 1u;
+    }
+    auto &registry = detail::GetFlightRegistry();
+    registry._capacity.store(rounded, memory_order_relaxed);
+    registry._enable.store(enable, memory_order_relaxed);
+}
+
+bool Recorder::IsEnabled() noexcept {
+    return detail::GetFlightRegistry()._enable.load(memory_order_relaxed);
+}
+
+void Recorder::Record(const SpanMark &mark, int err) noexcept {
+    if (mark._wall == 0) {
+        return;
+    }
+    auto duration = (uint64_t)max<int64_t>(Clock::SteadyNs() - mark._start, 0) / 1000u;
+
+    auto &ring = detail::LocalRing();
+    auto head = ring._head.load(memory_order_relaxed);
+    auto &slot = ring._slots[head & (ring._capacity - 1)];
+    auto seq = slot._seq.load(memory_order_relaxed);
+    slot._seq.store(seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot._words[0].store(detail::Load64(mark._trace), memory_order_relaxed);
+    slot._words[1].store(detail::Load64(mark._trace + 8), memory_order_relaxed);
+    slot._words[2].store(detail::Load64(mark._span), memory_order_relaxed);
+    slot._words[3].store(detail::Load64(mark._parent), memory_order_relaxed);
+    slot._words[4].store((uint64_t)mark._wall, memory_order_relaxed);
+    slot._words[5].store(min<uint64_t>(duration, UINT32_MAX) | (uint64_t)mark._cmd << 32u, memory_order_relaxed);
+    slot._words[6].store((uint64_t)(uint32_t)err | (uint64_t)(mark._name & 0xffffu) << 32u |
+                             (uint64_t)mark._kind << 48u | (uint64_t)mark._sampled << 56u,
+                         memory_order_relaxed);
+    slot._uid.store(mark._uid, memory_order_relaxed);
+
+    slot._seq.store(seq + 2, memory_order_release);
+    ring._head.store(head + 1, memory_order_release);
+}
+
+vector<FlightRecord> Recorder::Collect(const FlightFilter &filter) noexcept {
+    vector<FlightRecord> records;
+    detail::GetFlightRegistry().ForEach([&](const detail::FlightRing &ring) {
+        auto head = ring._head.load(memory_order_acquire);
+        auto count = min<uint64_t>(head, ring._capacity);
+        for (auto i = head - count; i < head; i++) {
+            FlightRecord record{};
+            if (detail::Read(ring._slots[i & (ring._capacity - 1)], record) && detail::Match(filter, record)) {
+                records.push_back(record);
+            }
+        }
+    });
+    sort(records.begin(), records.end(),
+         [](const FlightRecord &a, const FlightRecord &b) { return a._start < b._start; });
+    return records;
+}
+
+void Recorder::BeforeFork() noexcept {
+    detail::GetFlightRegistry().Lock();
+}
+
+void Recorder::AfterFork() noexcept {
+    detail::GetFlightRegistry().Unlock();
+}
+
+bool Recorder::Dump(const vector<FlightRecord> &records, const string &path) noexcept {
+    auto tmp = path + ".tmp";
+    {
+        ofstream out(tmp, ios::trunc);
+        if (!out) {
+            return false;
+        }
+        for (const auto &r : records) {
+            detail::Hex<trace::TraceId>(out, r._trace);
+            out << " ";
+            detail::Hex<trace::SpanId>(out, r._span);
+            out << " ";
+            detail::Hex<trace::SpanId>(out, r._parent);
+            out << " name=" << Names::Get(r._name) << " kind=" << (unsigned)r._kind << " start=" << r._start
+                << " dur_us=" << r._duration << " cmd=" << r._cmd << " uid=" << r._uid << " err=" << r._err
+                << " sampled=" << r._sampled << "\n";
+        }
+        if (!out) {
+            return false;
+        }
+    }
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+} // namespace tracing
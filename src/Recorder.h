@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Metrics.h"
+
+namespace tracing {
+
+// FlightRecord: a span kept by the flight recorder
+struct FlightRecord {
+    uint8_t _trace[16];
+    uint8_t _span[8];
+    uint8_t _parent[8];
+    uint32_t _name;     // see Names::Get()
+    uint8_t _kind;      // span kind
+    bool _sampled;      // whether the sampler has kept the span (and so it has been exported already)
+    int64_t _start;     // wall ns
+    uint32_t _duration; // us
+    uint32_t _cmd;
+    uint32_t _uid;
+    int32_t _err;
+};
+
+// FlightFilter: which records to collect
+struct FlightFilter {
+    int64_t _since; // wall ns, spans ended before are skipped
+    int64_t _until; // wall ns, spans ended after are skipped
+    bool _byTrace;  // whether only the spans of _trace are collected
+    uint8_t _trace[16];
+};
+
+// Recorder: flight recorder of the spans ended recently, sampled or not. Each thread writes compact records into
+// its own fixed-size ring (one cache line per record, seqlock per slot), so recording costs some stores and no lock.
+class Recorder final {
+public:
+    // Setup: capacity is the number of records per thread, rounded up to a power of two
+    static void Setup(bool enable, size_t capacity) noexcept;
+    // IsEnabled: whether spans are recorded
+    static bool IsEnabled() noexcept;
+    // Record: record a span ended with err into the ring of this thread
+    static void Record(const SpanMark &mark, int err) noexcept;
+    // Collect: records matching filter in all rings, ordered by start time
+    static std::vector<FlightRecord> Collect(const FlightFilter &filter) noexcept;
+    // Dump: write records into path, one span per line, replacing it atomically
+    static bool Dump(const std::vector<FlightRecord> &records, const std::string &path) noexcept;
+    // BeforeFork: hold the ring registry across fork(), rings owned by threads the child lacks stay owned
+    static void BeforeFork() noexcept;
+    // AfterFork: release it on either side
+    static void AfterFork() noexcept;
+};
+
+} // namespace tracing
@@ -5,21 +5,33 @@
 #include <yaml-cpp/yaml.h>
 
 #include <atomic>
-#include <random>
 #include <set>
 
+#include "Budget.h"
+#include "Clock.h"
 #include "Common.h"
+#include "IdGenerator.h"
+#include "Stats.h"
+#include "Throttle.h"
 
 using namespace std;
 using namespace opentelemetry;
 
 namespace detail {
 
-// GetRandom: range [0, 10000)
+// typed hint of the span being started on this thread, see CustomSampler::HintScope
+thread_local const tracing::SampleHint *t_hint = nullptr;
+
+// names of the typed sampling keys under sampler.keys in tracing.yml
+constexpr const char *kSampleKeyNames[tracing::kMaxSampleKey] = {
+    "tenant", "region", "custom0", "custom1", "custom2", "custom3",
+};
+
+using KeyLists = array<set<unsigned>, tracing::kMaxSampleKey>;
+
+// GetRandom: range [0, 10000), per-thread state which is reseeded after fork()
 unsigned long int GetRandom() {
-    static random_device r;
-    static default_random_engine e(r());
-    return e() % tracing::kMaxRatioValue;
+    return tracing::CustomIdGenerator::Random() % tracing::kMaxRatioValue;
 }
 
 // Format std::set<T> to std::string
@@ -39,48 +51,52 @@ public:
         , _ratio(tracing::kMaxRatioValue)
         , _cmdList()
         , _idx(0)
-        , _uidList() {
+        , _uidList()
+        , _keyList() {
         for (auto &item : _cmdList) {
             item.store(0, std::memory_order_relaxed);
         }
+    }
 
-        const char *path = getenv(tracing::k_DefaultPathEnv);
-        if (path == nullptr || strlen(path) == 0) {
-            _path = tracing::k_DefaultPath;
-        } else {
-            _path = path;
-        }
-
-        unsigned ratio;
+public:
+    // Setup: load from the config already parsed by Tracing, the file at path is re-read when it changes
+    void Setup(const string &path, const YAML::Node &root) {
+        _path = path;
+        unsigned ratio = tracing::kMaxRatioValue;
         set<unsigned> list;
-        if (loadRatioAndWhiteList(_path, ratio, list)) {
+        KeyLists keys;
+        if (parseRatioAndWhiteList(root, ratio, list, keys)) {
             _ratio.store(ratio, std::memory_order_relaxed);
-            _uidList[_idx.load(memory_order_relaxed)].swap(list);
+            publish(list, keys);
         }
     }
 
 public:
-    bool CheckPass(unsigned uid, unsigned cmd, bool rot) {
-        if (!rot) {
+    bool CheckPass(const tracing::SampleHint &hint) {
+        if (!hint._root) {
             return false;
         }
+        const auto cmd = hint._cmd;
 
-        static auto lastLoadTs = time(nullptr);
+        static atomic<int64_t> lastLoadTs(tracing::Clock::Seconds());
 
-        const auto now = time(nullptr);
-        if (now > lastLoadTs + 60) {
-            static auto lastModifyTs = lastLoadTs;
+        const auto now = tracing::Clock::Seconds();
+        auto checked = lastLoadTs.load(memory_order_relaxed);
+        // one thread checks the file each minute, the others go on with the lists published
+        if (now > checked + 60 && lastLoadTs.compare_exchange_strong(checked, now, memory_order_relaxed)) {
+            static auto lastModifyTs = checked;
 
             struct stat st {};
-            if (stat(_path, &st) == 0 && st.st_mtime > lastModifyTs) {
+            if (stat(_path.c_str(), &st) == 0 && st.st_mtime > lastModifyTs) {
                 unsigned ratio;
                 set<unsigned> list;
-                if (loadRatioAndWhiteList(_path, ratio, list)) {
+                KeyLists keys;
+                if (loadRatioAndWhiteList(_path, ratio, list, keys)) {
                     _ratio.store(ratio, std::memory_order_relaxed);
-                    _uidList[_idx.load(memory_order_relaxed)].swap(list);
+                    publish(list, keys);
+                    tracing::Stats::Add(tracing::kStatsConfigReloads);
                 }
 
-                lastLoadTs = now;
                 lastModifyTs = st.st_mtime;
             }
         }
@@ -90,23 +106,22 @@ public:
         if (ratio == 0) {
             return false;
         }
-        if (ratio == tracing::kMaxRatioValue) {
+        auto scale = tracing::Throttle::Scale(); // [0, 10000], lowered while the export queue is backed up
+        if (ratio == tracing::kMaxRatioValue && scale == tracing::kMaxRatioValue) {
             return true;
         }
 
-        auto &cur = _uidList[_idx.load(std::memory_order_relaxed) % 2u];
-
-        // hit the white-list
-        if (uid > 0 && cur.count(uid) != 0) {
+        // hit the white-lists
+        if (HitWhiteList(hint)) {
             if (cmd > 0 && cmd < tracing::kMaxCmdValue) {
                 _cmdList[cmd].store(now, memory_order_relaxed);
             }
             return true;
         }
 
-        // decide by the ratio
+        // decide by the ratio, white-lists above are not throttled
         auto r = GetRandom();
-        if (r < ratio) {
+        if (r < ratio * scale / tracing::kMaxRatioValue) {
             if (cmd > 0 && cmd < tracing::kMaxCmdValue) {
                 _cmdList[cmd] = now;
             }
@@ -122,16 +137,49 @@ public:
             }
         }
 
+        // dropped by the throttle only, the configured ratio would keep it
+        if (r < ratio) {
+            tracing::Stats::Add(tracing::kStatsDropThrottle);
+        }
+
+        return false;
+    }
+
+    // HitWhiteList: whether the uid or a typed key of hint is white-listed
+    bool HitWhiteList(const tracing::SampleHint &hint) {
+        auto idx = _idx.load(std::memory_order_acquire);
+        auto &cur = _uidList[idx];
+        if (hint._uid > 0 && cur.count(hint._uid) != 0) {
+            return true;
+        }
+        auto &keys = _keyList[idx];
+        for (auto mask = hint._mask; mask != 0; mask &= mask - 1) {
+            auto key = (unsigned)__builtin_ctz(mask);
+            if (keys[key].count(hint._keys[key]) != 0) {
+                return true;
+            }
+        }
         return false;
     }
 
 private:
-    static bool loadRatioAndWhiteList(const char *path, unsigned &r, set<unsigned> &s) {
-        if (access(path, F_OK) != 0) {
+    // publish: fill the inactive slot and flip to it, readers still on the slot flipped away from are done long before
+    // it is filled again by the next reload a minute later
+    void publish(set<unsigned> &list, KeyLists &keys) {
+        auto next = _idx.load(memory_order_relaxed) ^ 1u;
+        _uidList[next].swap(list);
+        _keyList[next].swap(keys);
+        _idx.store(next, memory_order_release);
+    }
+
+    static bool loadRatioAndWhiteList(const string &path, unsigned &r, set<unsigned> &s, KeyLists &k) {
+        if (access(path.c_str(), F_OK) != 0) {
             return false;
         }
+        return parseRatioAndWhiteList(YAML::LoadFile(path), r, s, k);
+    }
 
-        auto root = YAML::LoadFile(path);
+    static bool parseRatioAndWhiteList(const YAML::Node &root, unsigned &r, set<unsigned> &s, KeyLists &k) {
         if (root.IsNull() || !root.IsMap()) {
             return false;
         }
@@ -152,16 +200,27 @@ private:
             auto l = whiteList.as<vector<unsigned int>>();
             s = set<unsigned int>(l.begin(), l.end());
         }
+        auto keys = sampler["keys"];
+        if (!keys.IsNull() && keys.IsMap()) {
+            for (auto i = 0u; i < tracing::kMaxSampleKey; i++) {
+                auto key = keys[kSampleKeyNames[i]];
+                if (!key.IsNull() && key.IsSequence()) {
+                    auto l = key.as<vector<unsigned int>>();
+                    k[i] = set<unsigned int>(l.begin(), l.end());
+                }
+            }
+        }
 
         return true;
     }
 
 private:
-    const char *_path;
+    string _path;
     atomic<unsigned> _ratio;
     array<atomic<long>, tracing::kMaxCmdValue> _cmdList;
     atomic<unsigned> _idx;
     array<set<unsigned>, 2u> _uidList;
+    array<KeyLists, 2u> _keyList;
 };
 
 SampleConf *GetControlConfig() {
@@ -176,29 +235,44 @@ namespace tracing {
 CustomSampler::CustomSampler() noexcept
     : _desc("CustomSampler{conf-based sampler}") {}
 
+CustomSampler::HintScope::HintScope(const SampleHint &hint) noexcept
+    : _prev(detail::t_hint) {
+    detail::t_hint = &hint;
+}
+
+CustomSampler::HintScope::~HintScope() {
+    detail::t_hint = _prev;
+}
+
 SampleResult CustomSampler::ShouldSample(const trace::SpanContext &context, trace::TraceId trace,
                                          nostd::string_view name, trace::SpanKind kind,
                                          const common::KeyValueIterable &attr,
                                          const trace::SpanContextKeyValueIterable &link) noexcept {
-    // get cmd/uid/root flag from attr
-    auto uid = 0u;
-    auto cmd = 0u;
-    auto rot = false;
-    attr.ForEachKeyValue([&](nostd::string_view key, common::AttributeValue value) noexcept -> bool {
-        if (key == kTraceTagUid && nostd::holds_alternative<unsigned>(value)) {
-            uid = nostd::get<unsigned>(value);
-        }
-        if (key == kTraceTagCmd && nostd::holds_alternative<unsigned>(value)) {
-            cmd = nostd::get<unsigned>(value);
-        }
-        if (key == kTraceTagRot && nostd::holds_alternative<bool>(value)) {
-            rot = nostd::get<bool>(value);
-        }
-        return true; // which means continue
-    });
+    // typed hint from Tracing::StartSpan(), attributes are not scanned
+    auto hint = detail::t_hint;
+
+    // spans started without Hornet: get cmd/uid/root flag from attr
+    SampleHint scanned;
+    if (hint == nullptr) {
+        attr.ForEachKeyValue([&](nostd::string_view key, common::AttributeValue value) noexcept -> bool {
+            if (key == kTraceTagUid && nostd::holds_alternative<unsigned>(value)) {
+                scanned._uid = nostd::get<unsigned>(value);
+            }
+            if (key == kTraceTagCmd && nostd::holds_alternative<unsigned>(value)) {
+                scanned._cmd = nostd::get<unsigned>(value);
+            }
+            if (key == kTraceTagRot && nostd::holds_alternative<bool>(value)) {
+                scanned._root = nostd::get<bool>(value);
+            }
+            return true; // which means continue
+        });
+        hint = &scanned;
+    }
 
     // conf-base sampler, so
-    if (detail::GetControlConfig()->CheckPass(uid, cmd, rot)) {
+    auto pass = detail::GetControlConfig()->CheckPass(*hint);
+    tracing::Stats::RecordDecision(hint->_cmd, pass);
+    if (pass) {
         return {sdk::trace::Decision::RECORD_AND_SAMPLE, nullptr, nostd::shared_ptr<trace::TraceState>(nullptr)};
     }
     return {sdk::trace::Decision::DROP, nullptr, nostd::shared_ptr<trace::TraceState>(nullptr)};
@@ -208,4 +282,48 @@ nostd::string_view CustomSampler::GetDescription() const noexcept {
     return _desc;
 }
 
+DeferSampler::DeferSampler(unique_ptr<sdk::trace::Sampler> delegate, shared_ptr<sdk::trace::Sampler> root) noexcept
+    : _delegate(move(delegate))
+    , _root(move(root)) {}
+
+SampleResult DeferSampler::ShouldSample(const trace::SpanContext &context, trace::TraceId trace,
+                                        nostd::string_view name, trace::SpanKind kind,
+                                        const common::KeyValueIterable &attr,
+                                        const trace::SpanContextKeyValueIterable &link) noexcept {
+    if (context.IsValid() && context.IsRemote() && (context.trace_flags().flags() & b3::kDeferFlag) != 0) {
+        return _root->ShouldSample(context, trace, name, kind, attr, link);
+    }
+    return _delegate->ShouldSample(context, trace, name, kind, attr, link);
+}
+
+nostd::string_view DeferSampler::GetDescription() const noexcept {
+    return _delegate->GetDescription();
+}
+
+BudgetSampler::BudgetSampler(unique_ptr<sdk::trace::Sampler> delegate) noexcept
+    : _delegate(move(delegate)) {}
+
+SampleResult BudgetSampler::ShouldSample(const trace::SpanContext &context, trace::TraceId trace,
+                                         nostd::string_view name, trace::SpanKind kind,
+                                         const common::KeyValueIterable &attr,
+                                         const trace::SpanContextKeyValueIterable &link) noexcept {
+    if (Budget::Exhausted()) {
+        tracing::Stats::Add(kStatsDropBudget);
+        return {sdk::trace::Decision::DROP, nullptr, nostd::shared_ptr<trace::TraceState>(nullptr)};
+    }
+    return _delegate->ShouldSample(context, trace, name, kind, attr, link);
+}
+
+nostd::string_view BudgetSampler::GetDescription() const noexcept {
+    return _delegate->GetDescription();
+}
+
+void CustomSampler::Setup(const string &path, const YAML::Node &config) {
+    detail::GetControlConfig()->Setup(path, config);
+}
+
+bool CustomSampler::IsWhiteListed(const SampleHint &hint) noexcept {
+    return detail::GetControlConfig()->HitWhiteList(hint);
+}
+
 } // namespace tracing
\ No newline at end of file
@@ -2,6 +2,12 @@
 
 #include <opentelemetry/sdk/trace/sampler.h>
 
+#include "Tracing.h"
+
+namespace YAML {
+class Node;
+} // namespace YAML
+
 namespace tracing {
 
 // TLDR: just a alias
@@ -11,6 +17,26 @@ class CustomSampler final : public opentelemetry::sdk::trace::Sampler {
 public:
     CustomSampler() noexcept;
 
+public:
+    // Setup: load sampler in the config, which is re-read from path when the file changes
+    static void Setup(const std::string &path, const YAML::Node &config);
+    // IsWhiteListed: whether the uid or a typed key of hint is in the white-lists, regardless of the ratio
+    static bool IsWhiteListed(const SampleHint &hint) noexcept;
+
+public:
+    // HintScope: hand the typed hint of the span being started to ShouldSample() on this thread
+    class HintScope final {
+    public:
+        explicit HintScope(const SampleHint &hint) noexcept;
+        ~HintScope();
+
+        HintScope(const HintScope &) = delete;
+        HintScope &operator=(const HintScope &) = delete;
+
+    private:
+        const SampleHint *_prev;
+    };
+
 public:
     // ShouldSample: Decide whether the span should be collected
     SampleResult ShouldSample(const opentelemetry::trace::SpanContext &context,              // parent span context
@@ -27,4 +53,40 @@ private:
     const std::string _desc;
 };
 
+// DeferSampler: a remote parent without a sampling state (B3 without it, see b3::kDeferFlag) leaves the decision to
+// the root sampler as if the span were a root, the delegate decides otherwise
+class DeferSampler final : public opentelemetry::sdk::trace::Sampler {
+public:
+    DeferSampler(std::unique_ptr<opentelemetry::sdk::trace::Sampler> delegate,
+                 std::shared_ptr<opentelemetry::sdk::trace::Sampler> root) noexcept;
+
+public:
+    SampleResult ShouldSample(const opentelemetry::trace::SpanContext &context, opentelemetry::trace::TraceId trace,
+                              opentelemetry::nostd::string_view name, opentelemetry::trace::SpanKind kind,
+                              const opentelemetry::common::KeyValueIterable &attr,
+                              const opentelemetry::trace::SpanContextKeyValueIterable &link) noexcept override;
+    opentelemetry::nostd::string_view GetDescription() const noexcept override;
+
+private:
+    const std::unique_ptr<opentelemetry::sdk::trace::Sampler> _delegate;
+    const std::shared_ptr<opentelemetry::sdk::trace::Sampler> _root;
+};
+
+// BudgetSampler: drops every new span, a child of a sampled parent too, while the memory budget is exhausted (see
+// Budget), the delegate decides otherwise
+class BudgetSampler final : public opentelemetry::sdk::trace::Sampler {
+public:
+    explicit BudgetSampler(std::unique_ptr<opentelemetry::sdk::trace::Sampler> delegate) noexcept;
+
+public:
+    SampleResult ShouldSample(const opentelemetry::trace::SpanContext &context, opentelemetry::trace::TraceId trace,
+                              opentelemetry::nostd::string_view name, opentelemetry::trace::SpanKind kind,
+                              const opentelemetry::common::KeyValueIterable &attr,
+                              const opentelemetry::trace::SpanContextKeyValueIterable &link) noexcept override;
+    opentelemetry::nostd::string_view GetDescription() const noexcept override;
+
+private:
+    const std::unique_ptr<opentelemetry::sdk::trace::Sampler> _delegate;
+};
+
 } // namespace tracing
\ No newline at end of file
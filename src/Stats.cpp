@@ -0,0 +1,405 @@
+#include "Stats.h"
+
+#include <cmath>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <sstream>
+
+#include "Budget.h"
+#include "Propagator.h"
+#include "Throttle.h"
+
+using namespace std;
+
+namespace detail {
+
+// Inc: single-writer increment, no locked instruction
+inline void Inc(atomic<uint64_t> &value, uint64_t n) {
+    value.store(value.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// sampler decisions per cmd: cmds are interned in one process-wide table, which bounds how many are reported,
+// and counted per thread; both tables use open addressing on cmd + 1 (0 marks a free slot)
+constexpr size_t kCmdSlots = 4096;
+constexpr size_t kLocalCmdSlots = 1024;
+constexpr size_t kCmdProbes = 16;
+constexpr unsigned kCmdOverflow = ~0u; // cmds which do not fit are reported under this cmd
+
+// CmdCount: decisions of one thread on one cmd
+struct CmdCount {
+    atomic<unsigned> _key;
+    atomic<uint64_t> _sampled;
+    atomic<uint64_t> _dropped;
+};
+
+using CmdDecisions = map<unsigned, pair<uint64_t, uint64_t>>;
+
+struct Shard {
+    Shard() noexcept
+        : _counters()
+        , _histograms()
+        , _cmds()
+        , _cmdOverflow() {
+        for (auto &c : _counters) {
+            c.store(0, memory_order_relaxed);
+        }
+        for (auto &c : _cmds) {
+            c._key.store(0, memory_order_relaxed);
+            c._sampled.store(0, memory_order_relaxed);
+            c._dropped.store(0, memory_order_relaxed);
+        }
+        _cmdOverflow._key.store(0, memory_order_relaxed);
+        _cmdOverflow._sampled.store(0, memory_order_relaxed);
+        _cmdOverflow._dropped.store(0, memory_order_relaxed);
+    }
+
+    array<atomic<uint64_t>, tracing::kMaxStatsCounter> _counters;
+    array<tracing::Histogram, tracing::kMaxStatsHistogram> _histograms;
+    array<CmdCount, kLocalCmdSlots> _cmds;
+    CmdCount _cmdOverflow;
+};
+
+// Registry: shards of live threads, and what the exited threads left behind
+class Registry final {
+public:
+    void Register(Shard *shard) {
+        lock_guard<mutex> lock(_mtx);
+        _shards.insert(shard);
+    }
+
+    void Retire(Shard *shard) {
+        lock_guard<mutex> lock(_mtx);
+        merge(*shard, _retired);
+        mergeCmds(*shard, _retiredCmds);
+        _shards.erase(shard);
+    }
+
+    // Merge: merge all shards into out, their decisions per cmd into cmds
+    void Merge(Shard &out, CmdDecisions &cmds) {
+        lock_guard<mutex> lock(_mtx);
+        merge(_retired, out);
+        cmds = _retiredCmds;
+        for (auto shard : _shards) {
+            merge(*shard, out);
+            mergeCmds(*shard, cmds);
+        }
+    }
+
+    void Lock() {
+        _mtx.lock();
+    }
+
+    void Unlock() {
+        _mtx.unlock();
+    }
+
+private:
+    static void merge(const Shard &from, Shard &to) {
+        for (auto i = 0u; i < tracing::kMaxStatsCounter; i++) {
+            to._counters[i].fetch_add(from._counters[i].load(memory_order_relaxed), memory_order_relaxed);
+        }
+        for (auto i = 0u; i < tracing::kMaxStatsHistogram; i++) {
+            to._histograms[i].Merge(from._histograms[i]);
+        }
+    }
+
+    static void mergeCmds(const Shard &from, CmdDecisions &to) {
+        for (const auto &count : from._cmds) {
+            auto key = count._key.load(memory_order_acquire);
+            if (key != 0u) {
+                add(count, to[key - 1u]);
+            }
+        }
+        const auto &overflow = from._cmdOverflow;
+        if (overflow._sampled.load(memory_order_relaxed) + overflow._dropped.load(memory_order_relaxed) > 0) {
+            add(overflow, to[kCmdOverflow]);
+        }
+    }
+
+    static void add(const CmdCount &from, pair<uint64_t, uint64_t> &to) {
+        to.first += from._sampled.load(memory_order_relaxed);
+        to.second += from._dropped.load(memory_order_relaxed);
+    }
+
+private:
+    mutex _mtx;
+    set<Shard *> _shards;
+    Shard _retired;
+    CmdDecisions _retiredCmds; // decisions of exited threads
+};
+
+Registry &GetRegistry() {
+    static auto registry = new Registry; // never destroyed, threads may exit after static destruction
+    return *registry;
+}
+
+struct LocalShard {
+    LocalShard() {
+        GetRegistry().Register(&_shard);
+    }
+    ~LocalShard() {
+        GetRegistry().Retire(&_shard);
+    }
+    Shard _shard;
+};
+
+Shard &Local() {
+    static thread_local LocalShard local;
+    return local._shard;
+}
+
+atomic<unsigned> g_cmds[kCmdSlots]; // interned cmd + 1, 0 when free
+
+atomic<int64_t> g_queueDepth(0);
+
+// Intern: whether cmd is or now is in the process-wide table
+bool Intern(unsigned cmd) {
+    const auto key = cmd + 1u;
+    auto idx = (key * 2654435761u) % kCmdSlots;
+    for (auto i = 0u; i < kCmdProbes; i++, idx = (idx + 1) % kCmdSlots) {
+        auto cur = g_cmds[idx].load(memory_order_relaxed);
+        if (cur == key) {
+            return true;
+        }
+        if (cur == 0u && g_cmds[idx].compare_exchange_strong(cur, key, memory_order_relaxed)) {
+            return true;
+        }
+        if (cur == key) { // lost the race to the same cmd
+            return true;
+        }
+    }
+    return false;
+}
+
+// CountOf: the decisions of this thread on cmd, a cmd is interned the first time the thread sees it
+CmdCount &CountOf(Shard &shard, unsigned cmd) {
+    const auto key = cmd + 1u;
+    auto idx = (key * 2654435761u) % kLocalCmdSlots;
+    for (auto i = 0u; i < kCmdProbes; i++, idx = (idx + 1) % kLocalCmdSlots) {
+        auto &count = shard._cmds[idx];
+        auto cur = count._key.load(memory_order_relaxed);
+        if (cur == key) {
+            return count;
+        }
+        if (cur == 0u) {
+            if (!Intern(cmd)) {
+                break;
+            }
+            count._key.store(key, memory_order_release); // single writer, published for the merge
+            return count;
+        }
+    }
+    return shard._cmdOverflow;
+}
+
+tracing::HistogramSummary Summarize(const tracing::Histogram &h) {
+    tracing::HistogramSummary s{};
+    s._count = h.Count();
+    s._sum = h.Sum();
+    s._max = h.Max();
+    s._p50 = h.Percentile(50);
+    s._p90 = h.Percentile(90);
+    s._p99 = h.Percentile(99);
+    return s;
+}
+
+constexpr const char *kCounterNames[tracing::kMaxStatsCounter] = {
+    "spans.started",
+    "spans.sampled",
+    "spans.dropped.sampler",
+    "spans.dropped.throttle",
+    "spans.dropped.queue_full",
+    "spans.dropped.queue_full.error",
+    "spans.dropped.queue_full.debug",
+    "spans.dropped.queue_full.normal",
+    "spans.dropped.export",
+    "spans.dropped.oversize",
+    "spans.dropped.budget",
+    "spans.exported",
+    "export.batches",
+    "export.retries",
+    "export.shed",
+    "config.reloads",
+    "events.dropped",
+    "attributes.dropped",
+    "attributes.truncated",
+};
+
+constexpr const char *kHistogramNames[tracing::kMaxStatsHistogram] = {
+    "export.batch_size",
+    "export.latency_us",
+};
+
+} // namespace detail
+
+namespace tracing {
+
+Histogram::Histogram() noexcept
+    : _buckets()
+    , _sum()
+    , _max() {
+    for (auto &b : _buckets) {
+        b.store(0, memory_order_relaxed);
+    }
+    _sum.store(0, memory_order_relaxed);
+    _max.store(0, memory_order_relaxed);
+}
+
+unsigned Histogram::BucketOf(uint64_t value) noexcept {
+    if (value < (1u << kSubBits)) {
+        return (unsigned)value;
+    }
+    auto msb = 63u - (unsigned)__builtin_clzll(value);
+    auto shift = msb - kSubBits;
+    return ((shift + 1u) << kSubBits) + (unsigned)((value >> shift) & ((1u << kSubBits) - 1u));
+}
+
+uint64_t Histogram::UpperBoundOf(unsigned bucket) noexcept {
+    if (bucket < (1u << kSubBits)) {
+        return bucket;
+    }
+    auto shift = (bucket >> kSubBits) - 1u;
+    auto sub = (uint64_t)(bucket & ((1u << kSubBits) - 1u));
+    return (((1ull << kSubBits) + sub + 1u) << shift) - 1u;
+}
+
+void Histogram::Record(uint64_t value) noexcept {
+    detail::Inc(_buckets[BucketOf(value)], 1);
+    detail::Inc(_sum, value);
+    if (value > _max.load(memory_order_relaxed)) {
+        _max.store(value, memory_order_relaxed);
+    }
+}
+
+void Histogram::Merge(const Histogram &other) noexcept {
+    for (auto i = 0u; i < kBuckets; i++) {
+        auto n = other._buckets[i].load(memory_order_relaxed);
+        if (n != 0) {
+            _buckets[i].fetch_add(n, memory_order_relaxed);
+        }
+    }
+    _sum.fetch_add(other._sum.load(memory_order_relaxed), memory_order_relaxed);
+    auto max = other._max.load(memory_order_relaxed);
+    if (max > _max.load(memory_order_relaxed)) {
+        _max.store(max, memory_order_relaxed);
+    }
+}
+
+uint64_t Histogram::Count() const noexcept {
+    uint64_t count = 0;
+    for (const auto &b : _buckets) {
+        count += b.load(memory_order_relaxed);
+    }
+    return count;
+}
+
+uint64_t Histogram::Sum() const noexcept {
+    return _sum.load(memory_order_relaxed);
+}
+
+uint64_t Histogram::Max() const noexcept {
+    return _max.load(memory_order_relaxed);
+}
+
+uint64_t Histogram::Percentile(double p) const noexcept {
+    auto count = Count();
+    if (count == 0) {
+        return 0;
+    }
+    auto rank = (uint64_t)ceil(p / 100.0 * (double)count);
+    uint64_t seen = 0;
+    for (auto i = 0u; i < kBuckets; i++) {
+        seen += _buckets[i].load(memory_order_relaxed);
+        if (seen >= rank) {
+            return min(UpperBoundOf(i), Max());
+        }
+    }
+    return Max();
+}
+
+void Stats::Add(StatsCounter counter, uint64_t n) noexcept {
+    detail::Inc(detail::Local()._counters[counter], n);
+}
+
+void Stats::Record(StatsHistogram histogram, uint64_t value) noexcept {
+    detail::Local()._histograms[histogram].Record(value);
+}
+
+void Stats::RecordDecision(unsigned cmd, bool sampled) noexcept {
+    auto &count = detail::CountOf(detail::Local(), cmd);
+    detail::Inc(sampled ? count._sampled : count._dropped, 1);
+}
+
+void Stats::BeforeFork() noexcept {
+    detail::GetRegistry().Lock();
+}
+
+void Stats::AfterFork() noexcept {
+    detail::GetRegistry().Unlock();
+}
+
+int64_t Stats::AddQueueDepth(int64_t n) noexcept {
+    return detail::g_queueDepth.fetch_add(n, memory_order_relaxed);
+}
+
+int64_t Stats::QueueDepth() noexcept {
+    return detail::g_queueDepth.load(memory_order_relaxed);
+}
+
+StatsSnapshot Stats::Snapshot() noexcept {
+    detail::Shard merged;
+    StatsSnapshot snapshot{};
+    detail::GetRegistry().Merge(merged, snapshot._cmdDecisions);
+
+    for (auto i = 0u; i < kMaxStatsCounter; i++) {
+        snapshot._counters[i] = merged._counters[i].load(memory_order_relaxed);
+    }
+    for (auto i = 0u; i < kMaxStatsHistogram; i++) {
+        snapshot._histograms[i] = detail::Summarize(merged._histograms[i]);
+    }
+    snapshot._queueDepth = QueueDepth();
+    auto baggage = CustomPropagator::GetBaggageDrops();
+    snapshot._baggageDrops = baggage._entries + baggage._keyLen + baggage._valueLen + baggage._bytes + baggage._invalid;
+    snapshot._samplerScale = Throttle::Scale();
+    snapshot._budgetUsed = Budget::Used();
+    return snapshot;
+}
+
+bool Stats::Dump(const string &path) noexcept {
+    auto tmp = path + ".tmp";
+    {
+        ofstream out(tmp, ios::trunc);
+        if (!out) {
+            return false;
+        }
+        out << Snapshot().Format();
+        if (!out) {
+            return false;
+        }
+    }
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+string StatsSnapshot::Format() const {
+    stringstream ss;
+    for (auto i = 0u; i < kMaxStatsCounter; i++) {
+        ss << detail::kCounterNames[i] << " " << _counters[i] << "\n";
+    }
+    for (auto i = 0u; i < kMaxStatsHistogram; i++) {
+        const auto &h = _histograms[i];
+        ss << detail::kHistogramNames[i] << " count=" << h._count << " sum=" << h._sum << " max=" << h._max
+           << " p50=" << h._p50 << " p90=" << h._p90 << " p99=" << h._p99 << "\n";
+    }
+    ss << "queue.depth " << _queueDepth << "\n";
+    ss << "baggage.dropped " << _baggageDrops << "\n";
+    ss << "sampler.scale " << _samplerScale << "\n";
+    ss << "budget.used " << _budgetUsed << "\n";
+    for (const auto &item : _cmdDecisions) {
+        ss << "sampler.cmd." << item.first << " sampled=" << item.second.first << " dropped=" << item.second.second
+           << "\n";
+    }
+    return ss.str();
+}
+
+} // namespace tracing
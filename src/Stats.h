@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace tracing {
+
+// StatsCounter: self-telemetry counters of the tracing pipeline
+enum StatsCounter : unsigned {
+    kStatsSpansStarted = 0, // spans started through Tracing
+    kStatsSpansSampled,     // spans started and sampled
+    kStatsDropSampler,      // spans dropped by the sampler
+    kStatsDropThrottle,     // of the above, root spans which the configured ratio would keep
+    kStatsDropQueueFull,    // spans dropped since the processor queue is full, all lanes
+    kStatsDropLaneError,    // of the above and of budget once queued, spans of the error lane, see PriorityProcessor
+    kStatsDropLaneDebug,    // of the same, spans of the debug lane
+    kStatsDropLaneNormal,   // of the same, spans of the normal lane
+    kStatsDropExport,       // spans dropped since the exporter failed
+    kStatsDropOversize,     // spans dropped since they cannot fit in one datagram
+    kStatsDropBudget,       // spans dropped over the memory budget, at start (also by the sampler) or once queued
+    kStatsSpansExported,    // spans exported
+    kStatsExportBatches,    // export calls
+    kStatsExportRetries,    // export attempts retried
+    kStatsExportShed,       // export calls shed while the collector is failing or slow
+    kStatsConfigReloads,    // tracing.yml reloads
+    kStatsEventsDropped,    // span events over SpanEvents::kCapacity or the memory budget
+    kStatsAttrsDropped,     // attributes over budget.max-attributes or the memory budget
+    kStatsAttrsTruncated,   // string values and status messages cut to budget.max-value-len
+    kMaxStatsCounter,
+};
+
+// StatsHistogram: self-telemetry histograms of the tracing pipeline
+enum StatsHistogram : unsigned {
+    kStatsExportBatchSize = 0, // spans per export call
+    kStatsExportLatency,       // us per export call
+    kMaxStatsHistogram,
+};
+
+// Histogram: HDR-style log-linear histogram with 8 sub-buckets per power of two (relative error < 12.5%).
+// Written by a single thread, read by any.
+class Histogram final {
+public:
+    static constexpr unsigned kSubBits = 3u;
+    static constexpr unsigned kBuckets = (64u - kSubBits + 1u) << kSubBits;
+
+    Histogram() noexcept;
+
+    Histogram(const Histogram &) = delete;
+    Histogram &operator=(const Histogram &) = delete;
+
+public:
+    void Record(uint64_t value) noexcept;
+    // Merge: add other into this, the caller owns this exclusively
+    void Merge(const Histogram &other) noexcept;
+    // Count: number of recorded values
+    uint64_t Count() const noexcept;
+    // Sum: sum of recorded values
+    uint64_t Sum() const noexcept;
+    // Max: largest recorded value
+    uint64_t Max() const noexcept;
+    // Percentile: upper bound of the bucket holding the p-th (0, 100] percentile
+    uint64_t Percentile(double p) const noexcept;
+
+public:
+    static unsigned BucketOf(uint64_t value) noexcept;
+    static uint64_t UpperBoundOf(unsigned bucket) noexcept;
+
+private:
+    std::array<std::atomic<uint64_t>, kBuckets> _buckets;
+    std::atomic<uint64_t> _sum;
+    std::atomic<uint64_t> _max;
+};
+
+// HistogramSummary: what a snapshot keeps of a histogram
+struct HistogramSummary {
+    uint64_t _count;
+    uint64_t _sum;
+    uint64_t _max;
+    uint64_t _p50;
+    uint64_t _p90;
+    uint64_t _p99;
+};
+
+// StatsSnapshot: see Tracing::GetStats()
+struct StatsSnapshot {
+    std::array<uint64_t, kMaxStatsCounter> _counters;
+    std::array<HistogramSummary, kMaxStatsHistogram> _histograms;
+    int64_t _queueDepth;                                             // spans queued in the processor
+    std::map<unsigned, std::pair<uint64_t, uint64_t>> _cmdDecisions; // cmd -> (sampled, dropped) by the sampler
+    uint64_t _baggageDrops;                                          // baggage entries over the caps
+    unsigned _samplerScale;                                          // see Throttle::Scale()
+    size_t _budgetUsed;                                              // bytes charged to the budget, see Budget
+
+    // Format: plain text, one metric per line
+    std::string Format() const;
+};
+
+// Stats: lock-free per-thread self-telemetry
+class Stats final {
+public:
+    // Add: add n to a counter of this thread
+    static void Add(StatsCounter counter, uint64_t n = 1) noexcept;
+    // Record: record a value into a histogram of this thread
+    static void Record(StatsHistogram histogram, uint64_t value) noexcept;
+    // RecordDecision: record a sampler decision on cmd
+    static void RecordDecision(unsigned cmd, bool sampled) noexcept;
+    // AddQueueDepth: adjust the processor queue depth gauge, returns the depth before
+    static int64_t AddQueueDepth(int64_t n) noexcept;
+    // QueueDepth: current processor queue depth
+    static int64_t QueueDepth() noexcept;
+    // Snapshot: merge all threads
+    static StatsSnapshot Snapshot() noexcept;
+    // Dump: write the snapshot into path, replacing it atomically
+    static bool Dump(const std::string &path) noexcept;
+    // BeforeFork: hold the shard registry across fork(), threads registering or exiting meanwhile wait
+    static void BeforeFork() noexcept;
+    // AfterFork: release it on either side
+    static void AfterFork() noexcept;
+};
+
+} // namespace tracing
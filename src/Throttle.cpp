@@ -0,0 +1,70 @@
+#include "Throttle.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "Common.h"
+#include "Stats.h"
+
+using namespace std;
+
+namespace detail {
+
+// ThrottleState: only touched by the ticker but g_scale
+struct ThrottleState {
+    tracing::ThrottleOptions _options;
+    double _maxQueueSize;
+    uint64_t _sampled; // counters at the last step
+    uint64_t _exported;
+    uint64_t _dropped;
+};
+
+ThrottleState g_throttle{};
+atomic<unsigned> g_scale(tracing::kMaxRatioValue);
+
+} // namespace detail
+
+namespace tracing {
+
+void Throttle::Setup(const ThrottleOptions &options, size_t maxQueueSize) noexcept {
+    auto &state = detail::g_throttle;
+    state._options = options;
+    state._options._minScale = min(options._minScale, kMaxRatioValue);
+    state._maxQueueSize = (double)max(maxQueueSize, (size_t)1);
+    detail::g_scale.store(kMaxRatioValue, memory_order_relaxed);
+}
+
+unsigned Throttle::Scale() noexcept {
+    return detail::g_scale.load(memory_order_relaxed);
+}
+
+void Throttle::Update() noexcept {
+    auto &state = detail::g_throttle;
+    if (!state._options._enable) {
+        return;
+    }
+    auto snapshot = Stats::Snapshot();
+    auto sampled = snapshot._counters[kStatsSpansSampled];
+    auto exported = snapshot._counters[kStatsSpansExported] + snapshot._counters[kStatsDropExport];
+    auto dropped = snapshot._counters[kStatsDropQueueFull] + snapshot._counters[kStatsDropBudget];
+    auto in = (double)(sampled - state._sampled);
+    auto out = (double)(exported - state._exported);
+    auto overflowed = dropped != state._dropped;
+    state._sampled = sampled;
+    state._exported = exported;
+    state._dropped = dropped;
+
+    auto occupancy = (double)max(snapshot._queueDepth, (int64_t)0) / state._maxQueueSize;
+    auto scale = (double)Scale();
+    if (overflowed || occupancy > state._options._high) {
+        // towards what the exporter drains, but no faster than halving per step
+        auto factor = in > 0 ? state._options._headroom * out / in : 0.5;
+        scale *= min(max(factor, 0.5), 0.9);
+        scale = max(scale, (double)state._options._minScale);
+    } else if (occupancy < state._options._low) {
+        scale = min(scale + state._options._recoverStep, (double)kMaxRatioValue);
+    }
+    detail::g_scale.store((unsigned)scale, memory_order_relaxed);
+}
+
+} // namespace tracing
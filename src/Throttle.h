@@ -0,0 +1,42 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+namespace tracing {
+
+// ThrottleOptions: see sampler.adaptive in tracing.yml
+struct ThrottleOptions {
+    ThrottleOptions()
+        : _enable(true)
+        , _interval(1000)
+        , _high(0.5)
+        , _low(0.2)
+        , _headroom(0.8)
+        , _minScale(10)
+        , _recoverStep(500) {}
+
+    bool _enable;
+    std::chrono::milliseconds _interval; // of each step
+    double _high;                        // queue occupancy which lowers the scale
+    double _low;                         // queue occupancy under which the scale recovers
+    double _headroom;                    // share of the export throughput the sampled spans are lowered to
+    unsigned _minScale;                  // floor of the scale, of kMaxRatioValue
+    unsigned _recoverStep;               // scale regained per step, of kMaxRatioValue
+};
+
+// Throttle: feedback from the export queue to the sampler. While the queue fills up or drops spans (when full or over
+// the memory budget), the share of the configured ratio which is applied (the scale) is cut towards what the exporter
+// drains, so whole traces are dropped by the sampler instead of random spans by the queue. It recovers step by step
+// once the queue is drained.
+class Throttle final {
+public:
+    // Setup: before the first Update()
+    static void Setup(const ThrottleOptions &options, size_t maxQueueSize) noexcept;
+    // Scale: share of the configured ratio applied now, of kMaxRatioValue
+    static unsigned Scale() noexcept;
+    // Update: one step of the controller, run by the ticker every interval
+    static void Update() noexcept;
+};
+
+} // namespace tracing
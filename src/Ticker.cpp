@@ -0,0 +1,75 @@
+#include "Ticker.h"
+
+using namespace std;
+
+namespace tracing {
+
+Ticker *Ticker::Instance() {
+    static Ticker instance;
+    return &instance;
+}
+
+Ticker::Ticker()
+    : _mtx()
+    , _cv()
+    , _tasks()
+    , _stop(true)
+    , _thread() {
+    Start();
+}
+
+Ticker::~Ticker() {
+    Stop();
+}
+
+void Ticker::Register(function<void()> task, chrono::milliseconds period) {
+    lock_guard<mutex> lock(_mtx);
+    _tasks.push_back(Task{move(task), period, chrono::steady_clock::now() + period});
+    _cv.notify_one();
+}
+
+void Ticker::Stop() noexcept {
+    {
+        lock_guard<mutex> lock(_mtx);
+        _stop = true;
+        _cv.notify_one();
+    }
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+void Ticker::Start() {
+    lock_guard<mutex> lock(_mtx);
+    if (!_stop) {
+        return;
+    }
+    _stop = false;
+    _thread = thread(&Ticker::run, this);
+}
+
+void Ticker::run() {
+    unique_lock<mutex> lock(_mtx);
+    while (!_stop) {
+        auto now = chrono::steady_clock::now();
+        auto next = now + chrono::seconds(1);
+        for (size_t i = 0; i < _tasks.size(); i++) {
+            if (_tasks[i]._next <= now) {
+                _tasks[i]._next = now + _tasks[i]._period;
+                auto task = _tasks[i]._task; // Register() may grow _tasks while unlocked
+                lock.unlock();
+                task();
+                lock.lock();
+                if (_stop) {
+                    return;
+                }
+            }
+            if (_tasks[i]._next < next) {
+                next = _tasks[i]._next;
+            }
+        }
+        _cv.wait_until(lock, next);
+    }
+}
+
+} // namespace tracing
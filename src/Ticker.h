@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tracing {
+
+// Ticker: a single background thread running Hornet's periodic housekeeping tasks
+class Ticker final {
+public:
+    static Ticker *Instance();
+
+    ~Ticker();
+
+    Ticker(const Ticker &) = delete;
+    Ticker &operator=(const Ticker &) = delete;
+
+public:
+    // Register: run task on the ticker thread every period
+    void Register(std::function<void()> task, std::chrono::milliseconds period);
+    // Stop: stop and join the ticker thread, registered tasks are kept
+    void Stop() noexcept;
+    // Start: (re)start the ticker thread if it is not running
+    void Start();
+
+private:
+    Ticker();
+
+    void run();
+
+private:
+    struct Task {
+        std::function<void()> _task;
+        std::chrono::milliseconds _period;
+        std::chrono::steady_clock::time_point _next;
+    };
+
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    std::vector<Task> _tasks;
+    bool _stop;
+    std::thread _thread;
+};
+
+} // namespace tracing
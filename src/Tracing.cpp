@@ -2,14 +2,25 @@
 
 #include <opentelemetry/context/propagation/global_propagator.h>
 
+#include "Budget.h"
+#include "Clock.h"
 #include "Common.h"
+#include "ContextStorage.h"
+#include "IdGenerator.h"
 #include "LogHandler.h"
+#include "Metrics.h"
+#include "Names.h"
+#include "Pipeline.h"
 #include "Propagator.h"
+#include "Recorder.h"
 #include "Sampler.h"
+#include "Throttle.h"
+#include "Ticker.h"
+#include "Transport.h"
 #ifdef JAEGER_EXPORTER
-#include <opentelemetry/exporters/jaeger/jaeger_exporter.h>
+#include "Jaeger.h"
 #else
-#include <opentelemetry/exporters/zipkin/zipkin_exporter.h>
+#include "Zipkin.h"
 #endif
 #ifdef OSTREAM_EXPORTER_DEBUG
 #include <opentelemetry/exporters/ostream/span_exporter.h>
@@ -19,10 +30,16 @@
 #include <opentelemetry/sdk/trace/batch_span_processor.h>
 #include <opentelemetry/sdk/trace/samplers/parent.h>
 #include <opentelemetry/sdk/trace/tracer_provider.h>
+#include <opentelemetry/trace/noop.h>
 #include <opentelemetry/trace/provider.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <yaml-cpp/yaml.h>
 
+#include <atomic>
+
 using namespace std;
 using namespace opentelemetry;
 
@@ -47,99 +64,472 @@ const string &GetProcName() {
     return name;
 }
 
+// process-wide state, the only one read by the hot path while tracing is off
+constexpr unsigned kStateSwitch = 1u; // reporter.enable, Enable() and the switch signal
+constexpr unsigned kStateReady = 2u;  // brought up by Init() or Instance(), until Shutdown()
+constexpr unsigned kStateDown = 4u;   // set for good by Shutdown(), set and read under Tracing::_mtx
+atomic<unsigned> g_state(kStateSwitch);
+
+void SetSwitch(bool on) {
+    if (on) {
+        g_state.fetch_or(kStateSwitch, memory_order_relaxed);
+    } else {
+        g_state.fetch_and(~kStateSwitch, memory_order_relaxed);
+    }
+}
+
+bool Switched() {
+    return (g_state.load(memory_order_relaxed) & kStateSwitch) != 0;
+}
+
+bool Down() {
+    return (g_state.load(memory_order_relaxed) & kStateDown) != 0;
+}
+
+// options of Init(), read by the constructor. Guarded by g_initMtx.
+mutex g_initMtx;
+tracing::TracingOptions g_options;
+bool g_constructed = false;
+
+// RelayStack: incoming contexts relayed as-is while tracing is off, copied into buffers reused across spans so that
+// a steady relay allocates nothing and the caller's buffer may go away
+struct RelayStack {
+    RelayStack()
+        : _contexts()
+        , _depth(0) {}
+
+    vector<string> _contexts; // the first _depth are relayed, the top one is reported
+    size_t _depth;
+};
+
+thread_local RelayStack t_relay;
+
+// Relay: relay a copy of context while tracing is off, the depth to restore is saved
+bool Relay(nostd::string_view context, size_t &saved) {
+    if (context.empty()) {
+        return false;
+    }
+    auto &relay = t_relay;
+    saved = relay._depth;
+    if (relay._depth == relay._contexts.size()) {
+        relay._contexts.emplace_back();
+    }
+    relay._contexts[relay._depth++].assign(context.data(), context.size());
+    return true;
+}
+
+// Unrelay: back to the context relayed before Relay()
+void Unrelay(size_t saved) {
+    t_relay._depth = saved;
+}
+
+// Relayed: the context relayed on this thread, valid until the next Relay() on it
+nostd::string_view Relayed() {
+    const auto &relay = t_relay;
+    if (relay._depth == 0) {
+        return {};
+    }
+    const auto &top = relay._contexts[relay._depth - 1];
+    return {top.data(), top.size()};
+}
+
+constexpr uint32_t kUnnamed = ~0u; // SpanName::_id of names built per span
+
+// SpanNameBuffer: names built from proc and func on this thread, the buffers are reused across spans
+struct SpanNameBuffer {
+    string _name;
+    string _tracer;
+};
+
+thread_local SpanNameBuffer t_spanName;
+
+// BuildName: "proc.func" and the lower-cased proc into t_spanName, valid until the next call on this thread
+tracing::SpanName BuildName(nostd::string_view proc, nostd::string_view func) {
+    auto &buffer = t_spanName;
+    if (proc.empty()) {
+        proc = "proc";
+    }
+    if (func.empty()) {
+        func = "func";
+    }
+    buffer._tracer.assign(proc.data(), proc.size());
+    for (auto &c : buffer._tracer) {
+        c = (char)tolower((unsigned char)c);
+    }
+    buffer._name.assign(proc.data(), proc.size()).append(1, '.').append(func.data(), func.size());
+    return {kUnnamed, &buffer._name, &buffer._tracer};
+}
+
+// GuardName: name of a SpanGuard, none while switched off. Brings tracing up first like Tracing::Instance().
+tracing::SpanName GuardName(nostd::string_view proc, nostd::string_view func) {
+    tracing::Tracing::Instance();
+    return tracing::Tracing::IsEnabled() ? BuildName(proc, func) : tracing::SpanName{};
+}
+
+// OnSwitchSignal: flip the switch, the exporter is stopped/restored by the ticker thread
+void OnSwitchSignal(int) {
+    g_state.fetch_xor(kStateSwitch, memory_order_relaxed);
+}
+
+// flight recorder dump requested by signal, done by the ticker thread
+atomic<bool> g_flightRequested(false);
+
+// OnFlightSignal: request a dump of the flight recorder
+void OnFlightSignal(int) {
+    g_flightRequested.store(true, memory_order_relaxed);
+}
+
+// names of the lanes under reporter.queue.lanes in tracing.yml, see tracing::ExportLane
+constexpr const char *kExportLaneNames[tracing::kMaxExportLane] = {"error", "debug", "normal"};
+
+// processor of the installed provider, spans of the flight recorder are exported through it. Guarded by Tracing::_mtx.
+sdk::trace::SpanProcessor *g_processor = nullptr;
+// exporter of the installed provider, shut down first by Tracing::Shutdown() to cut retries short. Same as above.
+sdk::trace::SpanExporter *g_exporter = nullptr;
+
+// ConfigPath: the given path, $TRACING_CTRL_CONF or the default one
+string ConfigPath(const string &path) {
+    if (!path.empty()) {
+        return path;
+    }
+    const char *env = getenv(tracing::k_DefaultPathEnv);
+    return env == nullptr || strlen(env) == 0 ? tracing::k_DefaultPath : env;
+}
+
+// LoadConfig: parsed once at startup for every part of Hornet, null if there is no such file
+YAML::Node LoadConfig(const string &path) {
+    if (access(path.c_str(), F_OK) != 0) {
+        return YAML::Node();
+    }
+    return YAML::LoadFile(path);
+}
+
+// EndOptions: end timestamp from the Hornet clock, left to the SDK in precise mode
+trace::EndSpanOptions EndOptions() {
+    trace::EndSpanOptions opts;
+    if (tracing::Clock::Mode() != tracing::ClockMode::kPrecise) {
+        opts.end_steady_time = common::SteadyTimestamp(chrono::nanoseconds(tracing::Clock::SteadyNs()));
+    }
+    return opts;
+}
+
 } // namespace detail
 
 namespace tracing {
 
+bool SpanEvents::Add(nostd::string_view name) noexcept {
+    if (_size >= kCapacity) {
+        return false;
+    }
+    // back off continuation bytes, a code point is never split
+    auto n = name.size();
+    if (n > kNameSize) {
+        n = kNameSize;
+        while (n > 0 && ((uint8_t)name[n] & 0xc0u) == 0x80u) {
+            n--;
+        }
+    }
+    memcpy(_names[_size], name.data(), n);
+    _lens[_size] = (uint8_t)n;
+    _times[_size] = Clock::WallNs();
+    _size++;
+    return true;
+}
+
+SpanHandle::SpanHandle(nostd::shared_ptr<trace::Span> span) noexcept
+    : _span(move(span))
+    , _mark()
+    , _events() {}
+
+void SpanHandle::SetAttr(nostd::string_view key, const common::AttributeValue &value) noexcept {
+    if (IsRecording()) {
+        _span->SetAttribute(key, value);
+    }
+}
+
+void SpanHandle::AddEvent(nostd::string_view name) noexcept {
+    if (IsRecording() && !_events.Add(name)) {
+        tracing::Stats::Add(kStatsEventsDropped);
+    }
+}
+
 Scope::Scope()
-    : _span(nullptr)
-    , _token(nullptr) {}
+    : SpanHandle()
+    , _token(nullptr)
+    , _relay(0)
+    , _relayed(false) {}
 
 Scope::Scope(nostd::shared_ptr<trace::Span> span, unique_ptr<context::Token> token)
-    : _span(move(span))
-    , _token(move(token)) {}
+    : SpanHandle(move(span))
+    , _token(move(token))
+    , _relay(0)
+    , _relayed(false) {}
 
-Scope::~Scope() = default;
+Scope::~Scope() {
+    if (_relayed) {
+        detail::Unrelay(_relay);
+    }
+}
 
 Scope::Scope(Scope &&sc) noexcept
-    : _span(move(sc._span))
-    , _token(move(sc._token)) {}
+    : SpanHandle(move(sc))
+    , _token(move(sc._token))
+    , _relay(sc._relay)
+    , _relayed(sc._relayed) {
+    sc._relayed = false;
+}
 
 Scope &Scope::operator=(Scope &&sc) noexcept {
     if (this != &sc) {
-        _span = move(sc._span);
+        if (_relayed) {
+            detail::Unrelay(_relay);
+        }
+        SpanHandle::operator=(move(sc));
         _token = move(sc._token);
+        _relay = sc._relay;
+        _relayed = sc._relayed;
+        sc._relayed = false;
     }
     return *this;
 }
 
-void Scope::SetAttr(nostd::string_view key, const common::AttributeValue &value) noexcept {
-    if (_span != nullptr) {
-        _span->SetAttribute(key, value);
-    }
-}
-
 IsolatedScope::IsolatedScope()
-    : _ctx()
-    , _span(nullptr) {}
+    : SpanHandle()
+    , _header()
+    , _inlined(false)
+    , _ctx() {}
 
 IsolatedScope::IsolatedScope(string ctx, nostd::shared_ptr<trace::Span> span)
-    : _ctx(move(ctx))
-    , _span(move(span)) {}
+    : SpanHandle(move(span))
+    , _header()
+    , _inlined(false)
+    , _ctx(move(ctx)) {}
 
 IsolatedScope::~IsolatedScope() = default;
 
 IsolatedScope::IsolatedScope(IsolatedScope &&isc) noexcept
-    : _ctx(move(isc._ctx))
-    , _span(move(isc._span)) {}
+    : SpanHandle(move(isc))
+    , _inlined(isc._inlined)
+    , _ctx(move(isc._ctx)) {
+    if (_inlined) {
+        memcpy(_header, isc._header, kHeaderSize);
+    }
+}
 
 IsolatedScope &IsolatedScope::operator=(IsolatedScope &&isc) noexcept {
     if (this != &isc) {
+        if (isc._inlined) {
+            memcpy(_header, isc._header, kHeaderSize);
+        }
+        SpanHandle::operator=(move(isc));
+        _inlined = isc._inlined;
         _ctx = move(isc._ctx);
-        _span = move(isc._span);
     }
     return *this;
 }
 
 string IsolatedScope::GetContext() noexcept {
+    auto ctx = ContextView();
+    return {ctx.data(), ctx.size()};
+}
+
+nostd::string_view IsolatedScope::ContextView() const noexcept {
+    if (_inlined) {
+        return {_header, kHeaderSize};
+    }
     return _ctx;
 }
 
+void IsolatedScope::encode() noexcept {
+    static_assert(kHeaderSize == jaeger::kBinaryHeaderSize, "jaeger binary header size mismatch");
+    auto ctx = _span->GetContext();
+    if (!ctx.IsValid()) {
+        return;
+    }
+    _inlined = EncodeJaegerHeader(ctx, _header);
+    if (!_inlined) {
+        _ctx = EncodeJaegerContext(ctx);
+    }
+}
+
 string IsolatedScope::GetTraceId() noexcept {
+    if (_span == nullptr) {
+        return {};
+    }
     char trace[32];
     _span->GetContext().trace_id().ToLowerBase16(trace);
     return string(trace, sizeof(trace));
 }
 
-void IsolatedScope::SetAttr(nostd::string_view key, const common::AttributeValue &value) noexcept {
-    if (_span != nullptr) {
-        _span->SetAttribute(key, value);
-    }
-}
-
 struct Tracing::TraceConf {
-    TraceConf()
-        : _logSpan(false)
+    TraceConf(const string &path, const YAML::Node &config)
+        : _path(path)
+        , _logSpan(false)
 #ifdef JAEGER_EXPORTER
-        , _address("localhost:6831") {
+        , _address("localhost:6831")
 #else
-        , _address("http://localhost:9411/api/v2/spans") {
+        , _address("http://localhost:9411/api/v2/spans")
 #endif
-        const char *path = getenv(k_DefaultPathEnv);
-        if (path == nullptr || strlen(path) == 0) {
-            path = k_DefaultPath;
-        }
-
-        int ret = access(path, F_OK);
-        if (ret != 0) {
+        , _enable(true)
+        , _signal(0)
+        , _lastModify(0)
+        , _clockMode(ClockMode::kPrecise)
+        , _clockTick(1000)
+        , _timeOrdered(false)
+        , _baggage()
+        , _budget()
+        , _injectFormats(kFormatJaeger)
+        , _statsPath()
+        , _statsInterval(10000)
+        , _metricsEnable(true)
+        , _metricsMaxSeries(256)
+        , _metricsPath()
+        , _metricsInterval(10000)
+        , _flightEnable(true)
+        , _flightCapacity(4096)
+        , _flightSignal(0)
+        , _flightWindow(10)
+        , _flightPath()
+        , _http()
+        , _maxPacketSize(65000)
+        , _queue()
+        , _throttle()
+        , _shutdownTimeout(2000)
+        , _forkTimeout(100) {
+        struct stat st {};
+        if (stat(path.c_str(), &st) != 0) {
             return;
         }
+        _lastModify = st.st_mtime;
 
-        auto config = YAML::LoadFile(path);
         if (config.IsNull() || !config.IsMap()) {
             return;
         }
 
+        auto clock = config["clock"];
+        if (!clock.IsNull() && clock.IsMap()) {
+            auto mode = clock["mode"];
+            if (!mode.IsNull() && mode.IsScalar()) {
+                Clock::ParseMode(mode.as<string>(), _clockMode);
+            }
+            auto tick = clock["tick"];
+            if (!tick.IsNull() && tick.IsScalar()) {
+                _clockTick = chrono::microseconds(tick.as<long>());
+            }
+        }
+
+        auto id = config["id"];
+        if (!id.IsNull() && id.IsMap()) {
+            auto timeOrdered = id["time-ordered"];
+            if (!timeOrdered.IsNull() && timeOrdered.IsScalar()) {
+                _timeOrdered = timeOrdered.as<bool>();
+            }
+        }
+
+        auto baggage = config["baggage"];
+        if (!baggage.IsNull() && baggage.IsMap()) {
+            loadSize(baggage["max-entries"], _baggage._maxEntries);
+            loadSize(baggage["max-key-len"], _baggage._maxKeyLen);
+            loadSize(baggage["max-value-len"], _baggage._maxValueLen);
+            loadSize(baggage["max-bytes"], _baggage._maxBytes);
+        }
+
+        auto budget = config["budget"];
+        if (!budget.IsNull() && budget.IsMap()) {
+            loadSize(budget["max-bytes"], _budget._maxBytes);
+            loadSize(budget["max-attributes"], _budget._maxAttributes);
+            loadSize(budget["max-value-len"], _budget._maxValueLen);
+        }
+
+        auto propagation = config["propagation"];
+        if (!propagation.IsNull() && propagation.IsMap()) {
+            auto inject = propagation["inject"];
+            if (!inject.IsNull() && inject.IsSequence()) {
+                unsigned formats = 0u;
+                for (const auto &name : inject) {
+                    PropagationFormat format;
+                    if (name.IsScalar() && CustomPropagator::ParseFormat(name.as<string>(), format)) {
+                        formats |= format;
+                    }
+                }
+                // nothing known keeps the default
+                _injectFormats = formats != 0u ? formats : _injectFormats;
+            }
+        }
+
+        auto stats = config["stats"];
+        if (!stats.IsNull() && stats.IsMap()) {
+            auto dumpPath = stats["dump-path"];
+            if (!dumpPath.IsNull() && dumpPath.IsScalar()) {
+                _statsPath = dumpPath.as<string>();
+            }
+            auto dumpInterval = stats["dump-interval"];
+            if (!dumpInterval.IsNull() && dumpInterval.IsScalar()) {
+                _statsInterval = chrono::milliseconds(dumpInterval.as<long>());
+            }
+        }
+
+        auto metrics = config["metrics"];
+        if (!metrics.IsNull() && metrics.IsMap()) {
+            auto enable = metrics["enable"];
+            if (!enable.IsNull() && enable.IsScalar()) {
+                _metricsEnable = enable.as<bool>();
+            }
+            loadSize(metrics["max-series"], _metricsMaxSeries);
+            auto dumpPath = metrics["dump-path"];
+            if (!dumpPath.IsNull() && dumpPath.IsScalar()) {
+                _metricsPath = dumpPath.as<string>();
+            }
+            auto interval = metrics["interval"];
+            if (!interval.IsNull() && interval.IsScalar()) {
+                _metricsInterval = chrono::milliseconds(interval.as<long>());
+            }
+        }
+
+        auto recorder = config["recorder"];
+        if (!recorder.IsNull() && recorder.IsMap()) {
+            auto enable = recorder["enable"];
+            if (!enable.IsNull() && enable.IsScalar()) {
+                _flightEnable = enable.as<bool>();
+            }
+            loadSize(recorder["capacity"], _flightCapacity);
+            auto signal = recorder["signal"];
+            if (!signal.IsNull() && signal.IsScalar()) {
+                _flightSignal = signal.as<int>();
+            }
+            auto window = recorder["window"];
+            if (!window.IsNull() && window.IsScalar()) {
+                _flightWindow = chrono::seconds(window.as<long>());
+            }
+            auto dumpPath = recorder["dump-path"];
+            if (!dumpPath.IsNull() && dumpPath.IsScalar()) {
+                _flightPath = dumpPath.as<string>();
+            }
+        }
+
+        auto sampler = config["sampler"];
+        if (!sampler.IsNull() && sampler.IsMap()) {
+            auto adaptive = sampler["adaptive"];
+            if (!adaptive.IsNull() && adaptive.IsMap()) {
+                auto enable = adaptive["enable"];
+                if (!enable.IsNull() && enable.IsScalar()) {
+                    _throttle._enable = enable.as<bool>();
+                }
+                loadMs(adaptive["interval"], _throttle._interval);
+                loadRatio(adaptive["high"], _throttle._high);
+                loadRatio(adaptive["low"], _throttle._low);
+                loadRatio(adaptive["headroom"], _throttle._headroom);
+                auto minScale = adaptive["min-scale"];
+                if (!minScale.IsNull() && minScale.IsScalar()) {
+                    _throttle._minScale = minScale.as<unsigned>();
+                }
+                auto recoverStep = adaptive["recover-step"];
+                if (!recoverStep.IsNull() && recoverStep.IsScalar()) {
+                    _throttle._recoverStep = recoverStep.as<unsigned>();
+                }
+            }
+        }
+
         auto reporter = config["reporter"];
         if (reporter.IsNull() || !reporter.IsMap()) {
             return;
@@ -154,47 +544,330 @@ struct Tracing::TraceConf {
         if (!jaegerEndpoint.IsNull() && jaegerEndpoint.IsScalar()) {
             _address = jaegerEndpoint.as<string>();
         }
+        auto udp = reporter["udp"];
+        if (!udp.IsNull() && udp.IsMap()) {
+            loadSize(udp["max-packet-size"], _maxPacketSize);
+        }
 #else
         auto zipkinEndpoint = reporter["zipkinEndpoint"];
         if (!zipkinEndpoint.IsNull() && zipkinEndpoint.IsScalar()) {
             _address = zipkinEndpoint.as<string>();
         }
+        auto http = reporter["http"];
+        if (!http.IsNull() && http.IsMap()) {
+            auto gzip = http["gzip"];
+            if (!gzip.IsNull() && gzip.IsScalar()) {
+                _http._gzip = gzip.as<bool>();
+            }
+            loadSize(http["gzip-min-size"], _http._gzipMinSize);
+            loadSize(http["pool-size"], _http._poolSize);
+            loadMs(http["connect-timeout"], _http._connectTimeout);
+            loadMs(http["timeout"], _http._timeout);
+            loadMs(http["budget"], _http._budget);
+            loadMs(http["backoff"], _http._backoff);
+            loadMs(http["max-backoff"], _http._maxBackoff);
+            auto breakerFailures = http["breaker-failures"];
+            if (!breakerFailures.IsNull() && breakerFailures.IsScalar()) {
+                _http._breakerFailures = breakerFailures.as<unsigned>();
+            }
+            loadMs(http["breaker-cooldown"], _http._breakerCooldown);
+            loadMs(http["slow-threshold"], _http._slowThreshold);
+        }
 #endif
+        auto queue = reporter["queue"];
+        if (!queue.IsNull() && queue.IsMap()) {
+            loadSize(queue["max-size"], _queue._maxQueueSize);
+            loadSize(queue["batch-size"], _queue._maxBatchSize);
+            loadMs(queue["delay"], _queue._delay);
+            auto lanes = queue["lanes"];
+            if (!lanes.IsNull() && lanes.IsMap()) {
+                for (auto i = 0u; i < kMaxExportLane; i++) {
+                    auto lane = lanes[detail::kExportLaneNames[i]];
+                    if (lane.IsNull() || !lane.IsMap()) {
+                        continue;
+                    }
+                    loadSize(lane["max-size"], _queue._laneSizes[i]);
+                    auto weight = lane["weight"];
+                    if (!weight.IsNull() && weight.IsScalar()) {
+                        _queue._laneWeights[i] = weight.as<unsigned>();
+                    }
+                }
+            }
+            auto group = queue["group"];
+            if (!group.IsNull() && group.IsMap()) {
+                auto enable = group["enable"];
+                if (!enable.IsNull() && enable.IsScalar()) {
+                    _queue._group = enable.as<bool>();
+                }
+                loadMs(group["window"], _queue._groupWindow);
+            }
+        }
+        loadEnable(reporter, _enable);
+        loadMs(reporter["shutdown-timeout"], _shutdownTimeout);
+        loadMs(reporter["fork-timeout"], _forkTimeout);
+        auto signal = reporter["signal"];
+        if (!signal.IsNull() && signal.IsScalar()) {
+            _signal = signal.as<int>();
+        }
+    }
+
+    // Reload: re-read the switch if the file has been modified since last load
+    bool Reload(bool &enable) {
+        struct stat st {};
+        if (stat(_path.c_str(), &st) != 0 || st.st_mtime <= _lastModify) {
+            return false;
+        }
+        _lastModify = st.st_mtime;
+
+        try {
+            auto config = YAML::LoadFile(_path);
+            if (config.IsNull() || !config.IsMap()) {
+                return false;
+            }
+            auto reporter = config["reporter"];
+            if (reporter.IsNull() || !reporter.IsMap()) {
+                return false;
+            }
+            tracing::Stats::Add(kStatsConfigReloads);
+            return loadEnable(reporter, enable);
+        } catch (const exception &) {
+            return false; // half-written file, keep the current state
+        }
+    }
+
+    static void loadSize(const YAML::Node &node, size_t &size) {
+        if (!node.IsNull() && node.IsScalar()) {
+            size = node.as<size_t>();
+        }
+    }
+
+    static void loadMs(const YAML::Node &node, chrono::milliseconds &ms) {
+        if (!node.IsNull() && node.IsScalar()) {
+            ms = chrono::milliseconds(node.as<long>());
+        }
+    }
+
+    static void loadRatio(const YAML::Node &node, double &ratio) {
+        if (!node.IsNull() && node.IsScalar()) {
+            ratio = min(max(node.as<double>(), 0.0), 1.0);
+        }
+    }
+
+    static bool loadEnable(const YAML::Node &reporter, bool &enable) {
+        auto node = reporter["enable"];
+        if (node.IsNull() || !node.IsScalar()) {
+            return false;
+        }
+        enable = node.as<bool>();
+        return true;
     }
 
+    string _path;
     bool _logSpan;
     string _address;
+    bool _enable;                          // reporter.enable: process-wide switch
+    int _signal;                           // reporter.signal: signal which flips the switch, 0 means none
+    time_t _lastModify;                    // mtime of the loaded file
+    ClockMode _clockMode;                  // clock.mode
+    chrono::microseconds _clockTick;       // clock.tick
+    bool _timeOrdered;                     // id.time-ordered
+    BaggageLimits _baggage;                // baggage
+    BudgetOptions _budget;                 // budget
+    unsigned _injectFormats;               // propagation.inject: mask of PropagationFormat
+    string _statsPath;                     // stats.dump-path, empty means no dump
+    chrono::milliseconds _statsInterval;   // stats.dump-interval
+    bool _metricsEnable;                   // metrics.enable
+    size_t _metricsMaxSeries;              // metrics.max-series
+    string _metricsPath;                   // metrics.dump-path, empty means no dump
+    chrono::milliseconds _metricsInterval; // metrics.interval: merge period
+    bool _flightEnable;                    // recorder.enable
+    size_t _flightCapacity;                // recorder.capacity: records per thread
+    int _flightSignal;                     // recorder.signal: signal which dumps the recorder, 0 means none
+    chrono::seconds _flightWindow;         // recorder.window: dumped by the signal
+    string _flightPath;                    // recorder.dump-path: empty means to the exporter
+    HttpTransportOptions _http;            // reporter.http
+    size_t _maxPacketSize;                 // reporter.udp.max-packet-size
+    PriorityProcessorOptions _queue;       // reporter.queue
+    ThrottleOptions _throttle;             // sampler.adaptive
+    chrono::milliseconds _shutdownTimeout; // reporter.shutdown-timeout: flush budget at exit
+    chrono::milliseconds _forkTimeout;     // reporter.fork-timeout: flush budget before fork()
 };
 
 Tracing::Tracing()
-    : _conf(new TraceConf) {
+    : _conf(nullptr)
+    , _mtx()
+    , _provider(nullptr)
+    , _forkInstalled(false)
+    , _starter() {
+    TracingOptions options;
+    {
+        lock_guard<mutex> lock(detail::g_initMtx);
+        detail::g_constructed = true;
+        options = detail::g_options;
+    }
+
+    // the file is parsed once for every part of Hornet, only the switch and the sampler re-read it later
+    auto file = detail::ConfigPath(options._path);
+    auto config = detail::LoadConfig(file);
+    _conf.reset(new TraceConf(file, config));
+    CustomSampler::Setup(file, config);
+
     auto lh = nostd::shared_ptr<sdk::common::internal_log::LogHandler>(new CustomLogHandler());
     sdk::common::internal_log::GlobalLogHandler::SetLogHandler(move(lh));
     sdk::common::internal_log::GlobalLogHandler::SetLogLevel(
         _conf->_logSpan ? sdk::common::internal_log::LogLevel::Debug : sdk::common::internal_log::LogLevel::Info);
+
+    // before anything gets attached, SpanGuard pushes to this storage directly
+    auto cs = nostd::shared_ptr<context::RuntimeContextStorage>(new CustomContextStorage);
+    context::RuntimeContext::SetRuntimeContextStorage(cs);
+
+    tracing::Metrics::Setup(_conf->_metricsEnable, _conf->_metricsMaxSeries);
+    Recorder::Setup(_conf->_flightEnable, _conf->_flightCapacity);
+    Throttle::Setup(_conf->_throttle, _conf->_queue._maxQueueSize);
+    Budget::Setup(_conf->_budget);
+    CustomPropagator::SetBaggageLimits(_conf->_baggage);
+    CustomPropagator::SetInjectFormats(_conf->_injectFormats);
+    auto pr = nostd::shared_ptr<context::propagation::TextMapPropagator>(new CustomPropagator);
+    context::propagation::GlobalTextMapPropagator::SetGlobalPropagator(pr);
+
+    // spans are relayed as if switched off until startup() is done
+    detail::SetSwitch(_conf->_enable);
+    Clock::Instance(); // before startup() on any thread, so it outlives the shutdown at exit
+    if (options._async) {
+        _starter = thread(&Tracing::startup, this);
+    } else {
+        startup();
+    }
+
+    if (_conf->_signal > 0) {
+        struct sigaction sa {};
+        sa.sa_handler = detail::OnSwitchSignal;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART;
+        sigaction(_conf->_signal, &sa, nullptr);
+    }
+    if (_conf->_flightEnable && _conf->_flightSignal > 0) {
+        struct sigaction sa {};
+        sa.sa_handler = detail::OnFlightSignal;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART;
+        sigaction(_conf->_flightSignal, &sa, nullptr);
+    }
+    Ticker::Instance()->Register(
+        [this]() {
+            reload();
+            reconcile();
+            if (detail::g_flightRequested.exchange(false, memory_order_relaxed)) {
+                DumpFlight(_conf->_flightWindow, _conf->_flightPath);
+            }
+        },
+        chrono::seconds(1));
+    if (!_conf->_statsPath.empty()) {
+        auto path = _conf->_statsPath;
+        auto interval = max(_conf->_statsInterval, chrono::milliseconds(100));
+        Ticker::Instance()->Register([path]() { tracing::Stats::Dump(path); }, interval);
+    }
+    if (_conf->_throttle._enable) {
+        auto interval = max(_conf->_throttle._interval, chrono::milliseconds(100));
+        Ticker::Instance()->Register([]() { Throttle::Update(); }, interval);
+    }
+    if (_conf->_metricsEnable) {
+        auto path = _conf->_metricsPath;
+        auto interval = max(_conf->_metricsInterval, chrono::milliseconds(100));
+        Ticker::Instance()->Register(
+            [path]() {
+                tracing::Metrics::Merge();
+                if (!path.empty()) {
+                    tracing::Metrics::Dump(path);
+                }
+            },
+            interval);
+    }
+
+    // prefork servers: the export, clock and ticker threads do not survive fork(), see onForkPrepare()
+    pthread_atfork(&Tracing::onForkPrepare, &Tracing::onForkParent, &Tracing::onForkChild);
+}
+
+// startup: the slow part of bringing tracing up, clock calibration, process name and the exporter
+void Tracing::startup() noexcept {
+    Clock::Instance()->Setup(_conf->_clockMode, _conf->_clockTick);
+    {
+        lock_guard<mutex> lock(_mtx);
+        if (detail::Switched()) {
+            if (_provider == nullptr) {
+                install();
+            }
+        } else {
+            uninstall();
+        }
+    }
+    detail::g_state.fetch_or(detail::kStateReady, memory_order_release);
+}
+
+// shutdown: relay new spans, flush what is queued by the deadline, then cut the export short and release it
+bool Tracing::shutdown(chrono::steady_clock::time_point deadline) noexcept {
+    if (_starter.joinable()) {
+        _starter.join();
+    }
+    detail::g_state.fetch_and(~detail::kStateReady, memory_order_relaxed);
+    Ticker::Instance()->Stop(); // no reconcile() behind our back
+    Clock::Instance()->Setup(ClockMode::kCoarse, _conf->_clockTick); // no refresh thread left, still fresh
+
+    lock_guard<mutex> lock(_mtx);
+    detail::g_state.fetch_or(detail::kStateDown, memory_order_relaxed);
+    if (_provider == nullptr) {
+        return true;
+    }
+    auto ok = flush(deadline);
+    uninstall();
+    return ok && chrono::steady_clock::now() <= deadline;
+}
+
+// flush: export what is queued by the deadline, then shut the exporter down so that an export still retrying gives up
+// and uninstall() joins the export thread quickly. Under _mtx with the provider installed.
+bool Tracing::flush(chrono::steady_clock::time_point deadline) noexcept {
+    auto left = [&deadline]() {
+        auto us = chrono::duration_cast<chrono::microseconds>(deadline - chrono::steady_clock::now());
+        return max(us, chrono::microseconds(0));
+    };
+    auto ok = detail::g_processor->ForceFlush(left());
+    detail::g_exporter->Shutdown(left());
+    return ok;
+}
+
+void Tracing::install() {
 #ifdef JAEGER_EXPORTER
-    exporter::jaeger::JaegerExporterOptions exOpts{};
-    auto pos = _conf->_address.find(':');
-    exOpts.endpoint = _conf->_address.substr(0, pos);
-    exOpts.server_port = (uint16_t)atoi(_conf->_address.substr(pos + 1).c_str());
-    auto e = unique_ptr<sdk::trace::SpanExporter>(new exporter::jaeger::JaegerExporter(exOpts));
+    JaegerExporterOptions exOpts;
+    exOpts._endpoint = _conf->_address;
+    exOpts._serviceName = detail::GetProcName();
+    exOpts._maxPacketSize = _conf->_maxPacketSize;
+    auto e = unique_ptr<sdk::trace::SpanExporter>(new CustomJaegerExporter(exOpts));
 #else
-    exporter::zipkin::ZipkinExporterOptions exOpts{};
-    exOpts.endpoint = _conf->_address;
-    exOpts.service_name = detail::GetProcName();
-    auto e = unique_ptr<sdk::trace::SpanExporter>(new exporter::zipkin::ZipkinExporter());
+    ZipkinExporterOptions exOpts;
+    exOpts._http = _conf->_http;
+    exOpts._http._url = _conf->_address;
+    exOpts._serviceName = detail::GetProcName();
+    auto e = unique_ptr<sdk::trace::SpanExporter>(new CustomZipkinExporter(exOpts));
 #endif
 
-    auto prOpts = sdk::trace::BatchSpanProcessorOptions{};
+    // metered: the queue depth is kept by the processor, the exports by the exporter it drains into
+    e = unique_ptr<sdk::trace::SpanExporter>(new MeteredExporter(move(e)));
+    auto exporter = e.get();
+    auto bp = unique_ptr<sdk::trace::SpanProcessor>(new PriorityProcessor(move(e), _conf->_queue));
+    auto processor = bp.get();
 #ifdef OSTREAM_EXPORTER_DEBUG
-    auto p1 = unique_ptr<sdk::trace::SpanProcessor>(new sdk::trace::BatchSpanProcessor(move(e), prOpts));
+    auto p1 = move(bp);
     auto e2 = unique_ptr<sdk::trace::SpanExporter>(new exporter::trace::OStreamSpanExporter);
-    auto p2 = unique_ptr<sdk::trace::SpanProcessor>(new sdk::trace::BatchSpanProcessor(move(e2), prOpts));
+    auto p2 = unique_ptr<sdk::trace::SpanProcessor>(
+        new sdk::trace::BatchSpanProcessor(move(e2), sdk::trace::BatchSpanProcessorOptions{}));
 #else
-    auto p = unique_ptr<sdk::trace::SpanProcessor>(new sdk::trace::BatchSpanProcessor(move(e), prOpts));
+    auto p = move(bp);
 #endif
     auto rootSampler = shared_ptr<sdk::trace::Sampler>(new CustomSampler);
-    auto s = unique_ptr<sdk::trace::Sampler>(new sdk::trace::ParentBasedSampler(move(rootSampler)));
+    auto s = unique_ptr<sdk::trace::Sampler>(new sdk::trace::ParentBasedSampler(rootSampler));
+    s = unique_ptr<sdk::trace::Sampler>(new DeferSampler(move(s), move(rootSampler)));
+    s = unique_ptr<sdk::trace::Sampler>(new BudgetSampler(move(s)));
+    auto g = unique_ptr<sdk::trace::IdGenerator>(new CustomIdGenerator(_conf->_timeOrdered));
 
     auto attr = sdk::resource::ResourceAttributes();
     attr.SetAttribute("service.name", detail::GetProcName());
@@ -203,148 +876,439 @@ Tracing::Tracing()
     vector<unique_ptr<sdk::trace::SpanProcessor>> ps;
     ps.emplace_back(move(p1));
     ps.emplace_back(move(p2));
-    auto pv = nostd::shared_ptr<trace::TracerProvider>(new sdk::trace::TracerProvider(move(ps), r, move(s)));
+    auto pv = nostd::shared_ptr<trace::TracerProvider>(new sdk::trace::TracerProvider(move(ps), r, move(s), move(g)));
 #else
-    auto pv = nostd::shared_ptr<trace::TracerProvider>(new sdk::trace::TracerProvider(move(p), r, move(s)));
+    auto pv = nostd::shared_ptr<trace::TracerProvider>(new sdk::trace::TracerProvider(move(p), r, move(s), move(g)));
 #endif
 
     trace::Provider::SetTracerProvider(pv);
+    _provider = pv;
+    detail::g_processor = processor;
+    detail::g_exporter = exporter;
+}
 
-    auto pr = nostd::shared_ptr<context::propagation::TextMapPropagator>(new CustomPropagator);
-    context::propagation::GlobalTextMapPropagator::SetGlobalPropagator(pr);
+void Tracing::uninstall() noexcept {
+    auto noop = nostd::shared_ptr<trace::TracerProvider>(new trace::NoopTracerProvider);
+    trace::Provider::SetTracerProvider(noop);
+
+    // flush and join the export thread, the queue is released once the spans in flight have ended
+    auto pv = _provider;
+    _provider = nullptr;
+    detail::g_processor = nullptr;
+    detail::g_exporter = nullptr;
+    if (pv != nullptr) {
+        static_cast<sdk::trace::TracerProvider *>(pv.get())->Shutdown();
+    }
+}
+
+void Tracing::reconcile() noexcept {
+    lock_guard<mutex> lock(_mtx);
+    if (detail::Down()) {
+        return;
+    }
+    auto on = detail::Switched();
+    if (on == (_provider != nullptr)) {
+        return;
+    }
+    if (on) {
+        install();
+    } else {
+        uninstall();
+    }
+}
+
+void Tracing::reload() noexcept {
+    bool enable;
+    if (_conf->Reload(enable)) {
+        detail::SetSwitch(enable);
+    }
+}
+
+// onForkPrepare: join the ticker and clock threads, then flush the export queue within reporter.fork-timeout (what is
+// left is dropped) and join the export thread by uninstalling, so neither side inherits a half-sent batch or a thread
+// which only exists in the parent. _mtx and the registries of names, stats, metrics and the recorder stay locked
+// across fork() and are released by the handlers on both sides.
+void Tracing::onForkPrepare() noexcept {
+    auto self = Instance();
+    if (self->_starter.joinable()) {
+        self->_starter.join();
+    }
+    Ticker::Instance()->Stop();
+    Clock::Instance()->Suspend();
+    self->_mtx.lock();
+    self->_forkInstalled = self->_provider != nullptr;
+    if (self->_forkInstalled) {
+        self->flush(chrono::steady_clock::now() + self->_conf->_forkTimeout);
+        self->uninstall();
+    }
+    Names::BeforeFork();
+    Stats::BeforeFork();
+    Metrics::BeforeFork();
+    Recorder::BeforeFork();
+}
+
+void Tracing::onForkParent() noexcept {
+    Instance()->afterFork();
 }
 
-Tracing::~Tracing() = default;
+// onForkChild: the forking thread is the only one left, its id generator would replay the parent's ids
+void Tracing::onForkChild() noexcept {
+    CustomIdGenerator::Reseed();
+    Instance()->afterFork();
+}
+
+// afterFork: a fresh exporter (socket, connections) and export thread on either side
+void Tracing::afterFork() noexcept {
+    Recorder::AfterFork();
+    Metrics::AfterFork();
+    Stats::AfterFork();
+    Names::AfterFork();
+    if (_forkInstalled) {
+        install();
+    }
+    auto down = detail::Down();
+    _mtx.unlock();
+    if (down) {
+        return; // the threads were stopped for good by Shutdown()
+    }
+    Clock::Instance()->Resume();
+    Ticker::Instance()->Start();
+}
+
+void Tracing::Enable(bool on) noexcept {
+    if (detail::Down()) {
+        return;
+    }
+    detail::SetSwitch(on);
+    reconcile();
+}
+
+bool Tracing::IsEnabled() noexcept {
+    return detail::g_state.load(memory_order_relaxed) == (detail::kStateSwitch | detail::kStateReady);
+}
+
+StatsSnapshot Tracing::GetStats() noexcept {
+    return Stats::Snapshot();
+}
+
+MetricsSnapshot Tracing::GetMetrics() noexcept {
+    return Metrics::Snapshot();
+}
+
+size_t Tracing::DumpFlight(chrono::seconds window, const string &path) noexcept {
+    FlightFilter filter{};
+    filter._until = Clock::WallNs();
+    filter._since = filter._until - chrono::duration_cast<chrono::nanoseconds>(window).count();
+    return dumpFlight(filter, path);
+}
+
+size_t Tracing::dumpFlight(const FlightFilter &filter, const string &path) noexcept {
+    auto records = Recorder::Collect(filter);
+    if (!path.empty()) {
+        return Recorder::Dump(records, path) ? records.size() : 0;
+    }
+
+    lock_guard<mutex> lock(_mtx);
+    if (_provider == nullptr || detail::g_processor == nullptr) {
+        return 0;
+    }
+    const auto &resource = static_cast<sdk::trace::TracerProvider *>(_provider.get())->GetResource();
+    size_t count = 0;
+    for (const auto &r : records) {
+        if (r._sampled) {
+            continue; // exported already
+        }
+        auto span = detail::g_processor->MakeRecordable();
+        if (span == nullptr) {
+            break;
+        }
+        auto ctx = trace::SpanContext(trace::TraceId(r._trace), trace::SpanId(r._span),
+                                      trace::TraceFlags(trace::TraceFlags::kIsSampled), false);
+        span->SetIdentity(ctx, trace::SpanId(r._parent));
+        span->SetName(Names::Get(r._name));
+        span->SetSpanKind((trace::SpanKind)r._kind);
+        span->SetResource(resource);
+        span->SetStartTime(common::SystemTimestamp(chrono::nanoseconds(r._start)));
+        span->SetDuration(chrono::microseconds(r._duration));
+        if (r._uid > 0) {
+            span->SetAttribute(kTraceTagUid, r._uid);
+        }
+        if (r._cmd > 0) {
+            span->SetAttribute(kTraceTagCmd, r._cmd);
+        }
+        span->SetAttribute(kTraceTagErr, r._err);
+        span->SetAttribute(kTraceTagFlt, true);
+        span->SetStatus(r._err == 0 ? trace::StatusCode::kOk : trace::StatusCode::kError, "");
+        // asked for during an incident
+        PriorityProcessor::EndScope scope(r._err != 0 ? kLaneError : kLaneDebug, trace::TraceId(r._trace));
+        detail::g_processor->OnEnd(move(span));
+        count++;
+    }
+    return count;
+}
+
+nostd::string_view Tracing::relayed() noexcept {
+    return detail::Relayed();
+}
+
+Tracing::~Tracing() {
+    shutdown(chrono::steady_clock::now() + _conf->_shutdownTimeout);
+}
 
 Tracing *Tracing::Instance() {
     static Tracing instance;
     return &instance;
 }
 
+bool Tracing::Init(const TracingOptions &options) noexcept {
+    {
+        lock_guard<mutex> lock(detail::g_initMtx);
+        if (detail::g_constructed) {
+            return false;
+        }
+        detail::g_options = options;
+    }
+    Instance();
+    return true;
+}
+
+bool Tracing::Shutdown(chrono::milliseconds deadline) noexcept {
+    return Instance()->shutdown(chrono::steady_clock::now() + deadline);
+}
+
+SpanName Tracing::RegisterName(nostd::string_view proc, nostd::string_view func) noexcept {
+    auto built = detail::BuildName(proc, func);
+    SpanName name{Names::Intern(*built._name), nullptr, nullptr};
+    name._name = &Names::Get(name._id);
+    name._tracer = &Names::Get(Names::Intern(*built._tracer));
+    return name;
+}
+
 Scope Tracing::StartSpan(const string &context, const string &proc, const string &func, trace::SpanKind kind,
                          unsigned int uid, unsigned int cmd, bool root) noexcept {
-    stringstream op;
-    if (proc.empty()) {
-        op << "proc";
-    } else {
-        op << proc;
-    }
+    return startScope(context, proc, func, kind, SampleHint(uid, cmd, root));
+}
 
-    auto svr = op.str(); // proc name
-    transform(svr.begin(), svr.end(), svr.begin(), ::tolower);
-    auto pv = trace::Provider::GetTracerProvider();
-    auto tr = pv->GetTracer(svr.c_str(), OPENTELEMETRY_SDK_VERSION);
+Scope Tracing::StartSpan(const string &context, const string &proc, const string &func, trace::SpanKind kind,
+                         const SampleHint &hint) noexcept {
+    return startScope(context, proc, func, kind, hint);
+}
 
-    if (func.empty()) {
-        op << ".func";
-    } else {
-        op << "." << func;
+Scope Tracing::startScope(nostd::string_view context, nostd::string_view proc, nostd::string_view func,
+                          trace::SpanKind kind, const SampleHint &hint) noexcept {
+    if (!IsEnabled()) {
+        return relayScope(context);
     }
+    return StartSpan(context, detail::BuildName(proc, func), kind, hint);
+}
 
-    trace::StartSpanOptions spOpts;
-    spOpts.kind = kind;
-    if (!context.empty()) {
-        CustomCarrier carrier;
-        carrier.Set(jaeger::kBinaryFormat, context);
-        auto ctx = context::RuntimeContext::GetCurrent();
-        auto pr = context::propagation::GlobalTextMapPropagator::GetGlobalPropagator();
-        spOpts.parent = pr->Extract(carrier, ctx); // carrier -> ctx
+Scope Tracing::StartSpan(nostd::string_view context, const SpanName &name, trace::SpanKind kind,
+                         const SampleHint &hint) noexcept {
+    if (name._name == nullptr || !IsEnabled()) {
+        return relayScope(context);
     }
 
-    map<nostd::string_view, common::AttributeValue> extra;
-    if (uid > 0) {
-        extra.emplace(kTraceTagUid, uid);
-    }
-    if (cmd > 0) {
-        extra.emplace(kTraceTagCmd, cmd);
-    }
-    if (root) {
-        extra.emplace(kTraceTagRot, true);
-    }
-    auto name = op.str(); // proc.func name
-    auto span = tr->StartSpan(name.c_str(), extra, spOpts);
+    SpanMark mark{};
+    auto span = startSpan(context, name, kind, hint, mark);
     auto token = context::RuntimeContext::Attach(context::RuntimeContext::GetCurrent().SetValue(trace::kSpanKey, span));
     if (_conf->_logSpan) {
         // TODO
     }
-    return Scope{move(span), move(token)};
+    Scope sc{move(span), move(token)};
+    sc._mark = mark;
+    return sc;
 }
 
 void Tracing::EndSpan(Scope context, int err, opentelemetry::nostd::string_view msg) noexcept {
+    if (context._relayed) {
+        detail::Unrelay(context._relay);
+        context._relayed = false;
+    }
     if (context._span != nullptr && context._token != nullptr) {
-        context._span->SetAttribute(kTraceTagErr, err);
-        context._span->SetStatus(err == 0 ? trace::StatusCode::kOk : trace::StatusCode::kError, msg);
-        if (_conf->_logSpan) {
-            // TODO
-        }
-        context._span->End();
+        endSpan(*context._span, context._mark, context._events, err, msg);
     }
 }
 
 IsolatedScope Tracing::StartIsolatedSpan(const string &context, const string &proc, const string &func,
                                          trace::SpanKind kind, unsigned int uid, unsigned int cmd, bool root) noexcept {
-    stringstream op;
-    if (proc.empty()) {
-        op << "proc";
-    } else {
-        op << proc;
+    return startIsolatedScope(context, proc, func, kind, SampleHint(uid, cmd, root));
+}
+
+IsolatedScope Tracing::StartIsolatedSpan(const string &context, const string &proc, const string &func,
+                                         trace::SpanKind kind, const SampleHint &hint) noexcept {
+    return startIsolatedScope(context, proc, func, kind, hint);
+}
+
+IsolatedScope Tracing::startIsolatedScope(nostd::string_view context, nostd::string_view proc,
+                                          nostd::string_view func, trace::SpanKind kind,
+                                          const SampleHint &hint) noexcept {
+    if (!IsEnabled()) {
+        return relayIsolatedScope(context);
     }
+    return StartIsolatedSpan(context, detail::BuildName(proc, func), kind, hint);
+}
 
-    auto svr = op.str(); // proc name
-    transform(svr.begin(), svr.end(), svr.begin(), ::tolower);
-    auto pv = trace::Provider::GetTracerProvider();
-    auto tr = pv->GetTracer(svr.c_str(), OPENTELEMETRY_SDK_VERSION);
+IsolatedScope Tracing::StartIsolatedSpan(nostd::string_view context, const SpanName &name, trace::SpanKind kind,
+                                         const SampleHint &hint) noexcept {
+    if (name._name == nullptr || !IsEnabled()) {
+        return relayIsolatedScope(context);
+    }
 
-    if (func.empty()) {
-        op << ".func";
-    } else {
-        op << "." << func;
+    // the runtime context is left untouched, the context is encoded from the span itself
+    SpanMark mark{};
+    IsolatedScope sc{string(), startSpan(context, name, kind, hint, mark)};
+    sc._mark = mark;
+    sc.encode();
+    if (_conf->_logSpan) {
+        // TODO
+    }
+    return sc;
+}
+
+Scope Tracing::relayScope(nostd::string_view context) noexcept {
+    Scope sc;
+    sc._relayed = detail::Relay(context, sc._relay);
+    return sc;
+}
+
+IsolatedScope Tracing::relayIsolatedScope(nostd::string_view context) noexcept {
+    auto relay = context.empty() ? detail::Relayed() : context;
+    if (relay.empty()) {
+        return IsolatedScope(); // nothing to copy
+    }
+    return IsolatedScope{string(relay.data(), relay.size()), nullptr};
+}
+
+void Tracing::EndIsolatedSpan(IsolatedScope context, int err, opentelemetry::nostd::string_view msg) noexcept {
+    if (context._span != nullptr) {
+        endSpan(*context._span, context._mark, context._events, err, msg);
     }
+}
+
+nostd::shared_ptr<trace::Span> Tracing::startSpan(nostd::string_view context, const SpanName &name,
+                                                  trace::SpanKind kind, const SampleHint &hint,
+                                                  SpanMark &mark) noexcept {
+    auto pv = trace::Provider::GetTracerProvider();
+    auto tr = pv->GetTracer(*name._tracer, OPENTELEMETRY_SDK_VERSION);
 
     trace::StartSpanOptions spOpts;
     spOpts.kind = kind;
+    if (Clock::Mode() != ClockMode::kPrecise) {
+        spOpts.start_system_time = common::SystemTimestamp(chrono::nanoseconds(Clock::WallNs()));
+        spOpts.start_steady_time = common::SteadyTimestamp(chrono::nanoseconds(Clock::SteadyNs()));
+    }
+    context::Context parent; // remote parent
     if (!context.empty()) {
-        CustomCarrier carrier;
-        carrier.Set(jaeger::kBinaryFormat, context);
+        CustomCarrierView carrier(context); // decoded straight from the caller's buffer
         auto ctx = context::RuntimeContext::GetCurrent();
         auto pr = context::propagation::GlobalTextMapPropagator::GetGlobalPropagator();
-        spOpts.parent = pr->Extract(carrier, ctx); // carrier -> ctx
+        parent = pr->Extract(carrier, ctx); // carrier -> ctx
+        spOpts.parent = parent;
     }
 
     map<nostd::string_view, common::AttributeValue> extra;
-    if (uid > 0) {
-        extra.emplace(kTraceTagUid, uid);
+    if (hint._uid > 0) {
+        extra.emplace(kTraceTagUid, hint._uid);
     }
-    if (cmd > 0) {
-        extra.emplace(kTraceTagCmd, cmd);
+    if (hint._cmd > 0) {
+        extra.emplace(kTraceTagCmd, hint._cmd);
     }
-    if (root) {
+    if (hint._root) {
         extra.emplace(kTraceTagRot, true);
     }
-    auto name = op.str(); // proc.func name
-    auto span = tr->StartSpan(name.c_str(), extra, spOpts);
-    auto token = context::RuntimeContext::Attach(context::RuntimeContext::GetCurrent().SetValue(trace::kSpanKey, span));
-    auto pr = context::propagation::GlobalTextMapPropagator::GetGlobalPropagator();
-    auto ctx = context::RuntimeContext::GetCurrent();
-    CustomCarrier carrier;
-    pr->Inject(carrier, ctx);
+    CustomSampler::HintScope hs(hint); // read by CustomSampler::ShouldSample() on this thread
+    auto span = tr->StartSpan(*name._name, extra, spOpts);
+    tracing::Stats::Add(kStatsSpansStarted);
+    mark._sampled = span->IsRecording(); // attributes and events of the others are skipped
+    tracing::Stats::Add(mark._sampled ? kStatsSpansSampled : kStatsDropSampler);
+    if (mark._sampled) {
+        // exported ahead of ordinary spans, see PriorityProcessor
+        mark._pinned = CustomSampler::IsWhiteListed(hint) ||
+                       (!context.empty() &&
+                        (trace::GetSpan(parent)->GetContext().trace_flags().flags() & jaeger::kDebugFlag) != 0);
+    }
+    if (!tracing::Metrics::IsEnabled() && !Recorder::IsEnabled()) {
+        return span;
+    }
+    mark._name = name._id != detail::kUnnamed ? name._id : Names::Intern(*name._name);
+    mark._cmd = hint._cmd;
+    mark._start = Clock::SteadyNs();
+    if (Recorder::IsEnabled()) {
+        auto ctx = span->GetContext();
+        ctx.trace_id().CopyBytesTo(mark._trace);
+        ctx.span_id().CopyBytesTo(mark._span);
+        // the remote parent if any, the active span otherwise
+        auto pc = trace::GetSpan(context.empty() ? context::RuntimeContext::GetCurrent() : parent)->GetContext();
+        if (pc.IsValid()) {
+            pc.span_id().CopyBytesTo(mark._parent);
+        }
+        mark._wall = Clock::WallNs();
+        mark._uid = hint._uid;
+        mark._kind = (uint8_t)kind;
+    }
+    return span;
+}
 
-    auto tc = carrier.Get(jaeger::kBinaryFormat);
+void Tracing::endSpan(trace::Span &span, const SpanMark &mark, const SpanEvents &events, int err,
+                      nostd::string_view msg) noexcept {
+    // every span, the sampler has dropped it or not
+    tracing::Metrics::Record(mark, err);
+    Recorder::Record(mark, err);
+    if (!mark._sampled) {
+        span.End(detail::EndOptions());
+        return;
+    }
+    for (size_t i = 0; i < events._size; i++) {
+        span.AddEvent(events.Name(i), common::SystemTimestamp(chrono::nanoseconds(events._times[i])));
+    }
+    span.SetAttribute(kTraceTagErr, err);
+    span.SetStatus(err == 0 ? trace::StatusCode::kOk : trace::StatusCode::kError, msg);
     if (_conf->_logSpan) {
         // TODO
     }
-    return IsolatedScope{string(tc.data(), tc.size()), move(span)};
+    PriorityProcessor::EndScope scope(err != 0 ? kLaneError : mark._pinned ? kLaneDebug : kLaneNormal,
+                                      span.GetContext().trace_id());
+    span.End(detail::EndOptions());
 }
 
-void Tracing::EndIsolatedSpan(IsolatedScope context, int err, opentelemetry::nostd::string_view msg) noexcept {
-    if (context._span != nullptr) {
-        context._span->SetAttribute(kTraceTagErr, err);
-        context._span->SetStatus(err == 0 ? trace::StatusCode::kOk : trace::StatusCode::kError, msg);
-        if (_conf->_logSpan) {
-            // TODO
-        }
-        context._span->End();
+SpanGuard::SpanGuard(const string &context, const string &proc, const string &func, SpanKind kind,
+                     const SampleHint &hint) noexcept
+    : SpanGuard(nostd::string_view(context), guardName(proc, func), kind, hint) {}
+
+SpanGuard::SpanGuard(nostd::string_view context, const SpanName &name, SpanKind kind,
+                     const SampleHint &hint) noexcept
+    : SpanHandle()
+    , _depth(0)
+    , _err(0)
+    , _msg()
+    , _relay(0)
+    , _relayed(false) {
+    auto tracing = Tracing::Instance();
+    if (name._name == nullptr || !Tracing::IsEnabled()) { // unnamed: switched off, see guardName()
+        _relayed = detail::Relay(context, _relay);
+        return;
     }
+    _span = tracing->startSpan(context, name, kind, hint, _mark);
+    _depth = CustomContextStorage::Push(CustomContextStorage::Current().SetValue(trace::kSpanKey, _span));
+}
+
+SpanGuard::~SpanGuard() {
+    if (_relayed) {
+        detail::Unrelay(_relay);
+    }
+    if (_span != nullptr) {
+        Tracing::Instance()->endSpan(*_span, _mark, _events, _err, _msg);
+        CustomContextStorage::Pop(_depth);
+    }
+}
+
+void SpanGuard::SetStatus(int err, nostd::string_view msg) noexcept {
+    _err = err;
+    _msg = msg;
+}
+
+SpanName SpanGuard::guardName(nostd::string_view proc, nostd::string_view func) noexcept {
+    return detail::GuardName(proc, func);
 }
 
 } // namespace tracing
\ No newline at end of file
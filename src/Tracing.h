@@ -2,14 +2,142 @@
 
 #include <opentelemetry/context/runtime_context.h>
 #include <opentelemetry/trace/span.h>
+#include <opentelemetry/trace/tracer_provider.h>
 
+#include <array>
+#include <chrono>
 #include <map>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+#include "Metrics.h"
+#include "Recorder.h"
+#include "Stats.h"
 
 namespace tracing {
 
 using SpanKind = opentelemetry::trace::SpanKind;
 
-struct Scope {
+// ViewOnly: enables an overload for an explicit nostd::string_view only, std::string and string literals keep taking
+// the const std::string & one
+template <typename T>
+using ViewOnly = typename std::enable_if<std::is_same<T, opentelemetry::nostd::string_view>::value, int>::type;
+
+// SampleKey: typed sampling keys besides uid/cmd, see sampler.keys in tracing.yml
+enum SampleKey : unsigned {
+    kSampleKeyTenant = 0,
+    kSampleKeyRegion,
+    kSampleKeyCustom0,
+    kSampleKeyCustom1,
+    kSampleKeyCustom2,
+    kSampleKeyCustom3,
+    kMaxSampleKey,
+};
+
+// SampleHint: typed sampler inputs, handed to the sampler as-is so attributes are never scanned
+struct SampleHint {
+    explicit SampleHint(unsigned uid = 0, unsigned cmd = 0, bool root = false) noexcept
+        : _uid(uid)
+        , _cmd(cmd)
+        , _root(root)
+        , _mask(0)
+        , _keys() {}
+
+    SampleHint &Set(SampleKey key, unsigned value) noexcept {
+        if (key < kMaxSampleKey) {
+            _keys[key] = value;
+            _mask |= 1u << key;
+        }
+        return *this;
+    }
+
+    bool Has(SampleKey key) const noexcept {
+        return key < kMaxSampleKey && (_mask & (1u << key)) != 0;
+    }
+
+    unsigned _uid;  // user id
+    unsigned _cmd;  // command id
+    bool _root;     // root of trace
+    unsigned _mask; // bit i set if _keys[i] is given
+    std::array<unsigned, kMaxSampleKey> _keys;
+};
+
+// SpanName: proc and func registered up front by Tracing::RegisterName(), spans started with it build no name
+struct SpanName {
+    uint32_t _id;               // see Names
+    const std::string *_name;   // "proc.func", valid for the life of the process
+    const std::string *_tracer; // proc in lower case, same as above
+};
+
+// SpanEvents: events of a recording span kept inline until it ends, then handed to the SDK in one go. Names are
+// copied, cut to kNameSize at a UTF-8 boundary. Events over kCapacity are counted in Stats and dropped.
+struct SpanEvents {
+    static constexpr size_t kCapacity = 4;
+    static constexpr size_t kNameSize = 32;
+
+    // only the first _size events are set, so a scope of a span dropped by the sampler costs a single store here
+    SpanEvents() noexcept
+        : _size(0) {}
+
+    // Add: name at Clock::WallNs(), false if full
+    bool Add(opentelemetry::nostd::string_view name) noexcept;
+    // Name: name of event i
+    opentelemetry::nostd::string_view Name(size_t i) const noexcept {
+        return {_names[i], _lens[i]};
+    }
+
+    size_t _size;
+    uint8_t _lens[kCapacity];
+    char _names[kCapacity][kNameSize];
+    int64_t _times[kCapacity]; // ns since epoch
+};
+
+// AttrOf: attribute value of what a lazy attribute returns, strings are viewed for the duration of the call
+inline opentelemetry::common::AttributeValue AttrOf(const std::string &value) noexcept {
+    return opentelemetry::nostd::string_view(value);
+}
+
+template <typename T>
+inline opentelemetry::common::AttributeValue AttrOf(const T &value) noexcept {
+    return value;
+}
+
+// SpanHandle: the span of a scope and what is recorded into it until it ends, see Scope, IsolatedScope and SpanGuard
+class SpanHandle {
+public:
+    void SetAttr(opentelemetry::nostd::string_view key, const opentelemetry::common::AttributeValue &value) noexcept;
+    // IsRecording: whether the span has been kept by the sampler, attributes and events of others are skipped
+    bool IsRecording() const noexcept {
+        return _span != nullptr && _mark._sampled;
+    }
+    // SetAttrLazy: fn() makes the value only if the span is recording, e.g. costly debug strings
+    template <typename F>
+    void SetAttrLazy(opentelemetry::nostd::string_view key, F &&fn) {
+        if (IsRecording()) {
+            SetAttr(key, AttrOf(fn()));
+        }
+    }
+    // AddEvent: event at now, see SpanEvents
+    void AddEvent(opentelemetry::nostd::string_view name) noexcept;
+
+protected:
+    explicit SpanHandle(opentelemetry::nostd::shared_ptr<opentelemetry::trace::Span> span = nullptr) noexcept;
+    ~SpanHandle() = default;
+
+    SpanHandle(const SpanHandle &) = delete;
+    SpanHandle &operator=(const SpanHandle &) = delete;
+
+    SpanHandle(SpanHandle &&) = default;
+    SpanHandle &operator=(SpanHandle &&) = default;
+
+protected:
+    opentelemetry::nostd::shared_ptr<opentelemetry::trace::Span> _span; // current span
+    SpanMark _mark;                                                     // see Metrics::Record()
+    SpanEvents _events;                                                 // handed to the span when it ends
+};
+
+struct Scope : public SpanHandle {
 public:
     Scope();
     Scope(opentelemetry::nostd::shared_ptr<opentelemetry::trace::Span> span,
@@ -22,16 +150,14 @@ public:
     Scope(Scope &&) noexcept;
     Scope &operator=(Scope &&) noexcept;
 
-public:
-    void SetAttr(opentelemetry::nostd::string_view key, const opentelemetry::common::AttributeValue &value) noexcept;
-
 private:
     friend class Tracing;
-    opentelemetry::nostd::shared_ptr<opentelemetry::trace::Span> _span; // current span
     std::unique_ptr<opentelemetry::context::Token> _token; // scope which controls the life circle of the span
+    size_t _relay;                                         // relay depth to restore while tracing is off
+    bool _relayed;                                         // whether _relay is restored by EndSpan() or ~Scope()
 };
 
-struct IsolatedScope {
+struct IsolatedScope : public SpanHandle {
 public:
     IsolatedScope();
     IsolatedScope(std::string ctx, opentelemetry::nostd::shared_ptr<opentelemetry::trace::Span> span);
@@ -46,18 +172,74 @@ public:
 public:
     std::string GetContext() noexcept;
     std::string GetTraceId() noexcept;
+    // ContextView: isolated context (jaeger binary format) without copy, valid as long as the scope
+    opentelemetry::nostd::string_view ContextView() const noexcept;
 
-public:
-    void SetAttr(opentelemetry::nostd::string_view key, const opentelemetry::common::AttributeValue &value) noexcept;
+private:
+    // encode: encode the context of _span straight into _header (or _ctx if baggage follows)
+    void encode() noexcept;
 
 private:
     friend class Tracing;
-    std::string _ctx;                                                   // isolated context
-    opentelemetry::nostd::shared_ptr<opentelemetry::trace::Span> _span; // current span
+    static constexpr size_t kHeaderSize = 37; // see jaeger::kBinaryHeaderSize
+
+    char _header[kHeaderSize]; // isolated context without baggage
+    bool _inlined;             // whether _header holds the context
+    std::string _ctx;          // isolated context with baggage or relayed
+};
+
+// SpanGuard: stack-only scope of an active span, the span is ended when the guard goes out of scope
+class SpanGuard final : public SpanHandle {
+public:
+    SpanGuard(const std::string &context, // remote context (jaeger binary context)
+              const std::string &proc,    // proc name
+              const std::string &func,    // func name
+              SpanKind kind,              // span kind
+              const SampleHint &hint = SampleHint()) noexcept;
+    // SpanGuard: same as above without a copy, only for an explicit nostd::string_view context
+    template <typename View, ViewOnly<View> = 0>
+    SpanGuard(View context,                            // remote context (jaeger binary context)
+              opentelemetry::nostd::string_view proc, // proc name
+              opentelemetry::nostd::string_view func, // func name
+              SpanKind kind,                          // span kind
+              const SampleHint &hint = SampleHint()) noexcept
+        : SpanGuard(context, guardName(proc, func), kind, hint) {}
+    SpanGuard(opentelemetry::nostd::string_view context, // remote context (jaeger binary context)
+              const SpanName &name,                      // from Tracing::RegisterName()
+              SpanKind kind,                             // span kind
+              const SampleHint &hint = SampleHint()) noexcept;
+    ~SpanGuard();
+
+    SpanGuard(const SpanGuard &) = delete;
+    SpanGuard &operator=(const SpanGuard &) = delete;
+    SpanGuard(SpanGuard &&) = delete;
+    SpanGuard &operator=(SpanGuard &&) = delete;
+
+    static void *operator new(size_t) = delete;
+    static void *operator new[](size_t) = delete;
+
+public:
+    // SetErr: error code recorded when the span ends, a single store so early exits can mark it cheaply
+    void SetErr(int err) noexcept {
+        _err = err;
+    }
+    // SetStatus: error code and status message recorded when the span ends, msg must outlive the guard
+    void SetStatus(int err, opentelemetry::nostd::string_view msg) noexcept;
+
+private:
+    // guardName: name of a guard, none while switched off
+    static SpanName guardName(opentelemetry::nostd::string_view proc, opentelemetry::nostd::string_view func) noexcept;
+
+private:
+    size_t _depth;                            // context stack depth to restore
+    int _err;                                 // error code
+    opentelemetry::nostd::string_view _msg;   // status message
+    size_t _relay;                            // see Scope::_relay
+    bool _relayed;                            // see Scope::_relayed
 };
 
 struct Context {
-    explicit Context(const std::string &context);
+    explicit Context(opentelemetry::nostd::string_view context);
     explicit Context(const opentelemetry::trace::SpanContext &context);
     Context(const std::string &traceId, const std::string &spanId, const std::string &parentSpanId, bool sampled,
             const std::map<std::string, std::string> &baggage = std::map<std::string, std::string>());
@@ -69,12 +251,39 @@ struct Context {
     std::map<std::string, std::string> _baggage;
 };
 
+// LogIds: ids of the active span in lower hex for log lines, see Tracing::GetLogIds(). Both are empty if there is
+// no active span.
+struct LogIds {
+    opentelemetry::nostd::string_view _traceId; // 32 chars
+    opentelemetry::nostd::string_view _spanId;  // 16 chars
+};
+
+// TracingOptions: see Tracing::Init()
+struct TracingOptions {
+    TracingOptions()
+        : _path()
+        , _async(true) {}
+
+    std::string _path; // config file, empty means $TRACING_CTRL_CONF or /etc/conf/tracing.yml
+    bool _async;       // bring the exporter up on a background thread, spans are relayed until it is ready
+};
+
 class Tracing final {
 public:
     static Tracing *Instance();
 
     ~Tracing();
 
+public:
+    // Init: load the config once and bring tracing up, meant to be called early in main(). Without it the first
+    // Instance() does the same synchronously with the default options. Returns false if it is up already.
+    static bool Init(const TracingOptions &options = TracingOptions()) noexcept;
+    // Shutdown: flush the queued spans within deadline and stop the exporter, spans started afterwards are relayed
+    // as if switched off. Returns false if the deadline has passed first. Done at exit with reporter.shutdown-timeout.
+    // For good: Enable(), the switch signal and fork() do not bring it back, the ticker stays stopped and the clock is
+    // left coarse without a refresh thread.
+    static bool Shutdown(std::chrono::milliseconds deadline) noexcept;
+
 public:
     // StartSpan: create a new span
     Scope StartSpan(const std::string &context,  // remote context (jaeger binary context)
@@ -84,6 +293,36 @@ public:
                     unsigned uid = 0,            // user id
                     unsigned cmd = 0,            // command id
                     bool root = false) noexcept; // root of trace
+    // StartSpan: create a new span, sampled by the typed hint
+    Scope StartSpan(const std::string &context, // remote context (jaeger binary context)
+                    const std::string &proc,    // proc name
+                    const std::string &func,    // func name
+                    SpanKind kind,              // span kind
+                    const SampleHint &hint) noexcept;
+    // StartSpan: same as above without a copy, only for an explicit nostd::string_view context
+    template <typename View, ViewOnly<View> = 0>
+    Scope StartSpan(View context,                            // remote context (jaeger binary context)
+                    opentelemetry::nostd::string_view proc, // proc name
+                    opentelemetry::nostd::string_view func, // func name
+                    SpanKind kind,                          // span kind
+                    unsigned uid = 0,                       // user id
+                    unsigned cmd = 0,                       // command id
+                    bool root = false) noexcept {           // root of trace
+        return startScope(context, proc, func, kind, SampleHint(uid, cmd, root));
+    }
+    template <typename View, ViewOnly<View> = 0>
+    Scope StartSpan(View context,                            // remote context (jaeger binary context)
+                    opentelemetry::nostd::string_view proc, // proc name
+                    opentelemetry::nostd::string_view func, // func name
+                    SpanKind kind,                          // span kind
+                    const SampleHint &hint) noexcept {
+        return startScope(context, proc, func, kind, hint);
+    }
+    // StartSpan: create a new span named up front
+    Scope StartSpan(opentelemetry::nostd::string_view context, // remote context (jaeger binary context)
+                    const SpanName &name,                      // from RegisterName()
+                    SpanKind kind,                             // span kind
+                    const SampleHint &hint = SampleHint()) noexcept;
     // EndSpan: end span with the given scope (from StartSpan())
     void EndSpan(Scope context, int err = 0, opentelemetry::nostd::string_view msg = "") noexcept;
 
@@ -96,6 +335,36 @@ public:
                                     unsigned uid = 0,            // user id
                                     unsigned cmd = 0,            // command id
                                     bool root = false) noexcept; // root of trace
+    // StartIsolatedSpan: create a new span without setting "active", sampled by the typed hint
+    IsolatedScope StartIsolatedSpan(const std::string &context, // remote context (jaeger binary context)
+                                    const std::string &proc,    // proc name
+                                    const std::string &func,    // func name
+                                    SpanKind kind,              // span kind
+                                    const SampleHint &hint) noexcept;
+    // StartIsolatedSpan: same as above without a copy, only for an explicit nostd::string_view context
+    template <typename View, ViewOnly<View> = 0>
+    IsolatedScope StartIsolatedSpan(View context,                            // remote context (jaeger binary context)
+                                    opentelemetry::nostd::string_view proc, // proc name
+                                    opentelemetry::nostd::string_view func, // func name
+                                    SpanKind kind,                          // span kind
+                                    unsigned uid = 0,                       // user id
+                                    unsigned cmd = 0,                       // command id
+                                    bool root = false) noexcept {           // root of trace
+        return startIsolatedScope(context, proc, func, kind, SampleHint(uid, cmd, root));
+    }
+    template <typename View, ViewOnly<View> = 0>
+    IsolatedScope StartIsolatedSpan(View context,                            // remote context (jaeger binary context)
+                                    opentelemetry::nostd::string_view proc, // proc name
+                                    opentelemetry::nostd::string_view func, // func name
+                                    SpanKind kind,                          // span kind
+                                    const SampleHint &hint) noexcept {
+        return startIsolatedScope(context, proc, func, kind, hint);
+    }
+    // StartIsolatedSpan: create a new span named up front without setting "active"
+    IsolatedScope StartIsolatedSpan(opentelemetry::nostd::string_view context, // remote context (jaeger binary context)
+                                    const SpanName &name,                      // from RegisterName()
+                                    SpanKind kind,                             // span kind
+                                    const SampleHint &hint = SampleHint()) noexcept;
     // EndIsolatedSpan: end span with the given scope (from StartIsolatedSpan())
     void EndIsolatedSpan(IsolatedScope context, int err = 0, opentelemetry::nostd::string_view msg = "") noexcept;
 
@@ -104,17 +373,88 @@ public:
     static Context GetPlainTextContext() noexcept;
     // GetJaegerContext: get current active context(jaeger binary format)
     static std::string GetJaegerContext() noexcept;
-    // ParseFromJaegerContext: parse jaeger binary format context into plaintext context
-    static Context ParseFromJaegerContext(const std::string &context) noexcept;
+    // GetJaegerContextView: same as GetJaegerContext() without copy, encoded once per active span and valid until
+    // the active span changes
+    static opentelemetry::nostd::string_view GetJaegerContextView() noexcept;
+    // GetLogIds: ids of the active span without copy, formatted once per active span into a per-thread buffer and
+    // valid until the active span of this thread changes. See LogCorrelation.h for logging adapters.
+    static LogIds GetLogIds() noexcept;
+    // ParseFromJaegerContext: parse jaeger binary format context into plaintext context, decoded in place from the
+    // caller's buffer
+    static Context ParseFromJaegerContext(opentelemetry::nostd::string_view context) noexcept;
     // FormatAsJaegerContext: format plaintext context into jaeger binary format context
     static std::string FormatAsJaegerContext(const Context &context) noexcept;
+    // FormatAsJaegerContext: same as above into out, which keeps its capacity. Returns false (out empty) if invalid.
+    static bool FormatAsJaegerContext(const Context &context, std::string &out) noexcept;
+
+public:
+    // RegisterName: the name of spans of proc and func, meant to be kept in a static. Shares the bound of Names, spans
+    // of names over it are named Names::kOverflow.
+    static SpanName RegisterName(opentelemetry::nostd::string_view proc,
+                                 opentelemetry::nostd::string_view func) noexcept;
+
+public:
+    // Enable: switch tracing on/off process-wide, the exporter is stopped and released while off
+    void Enable(bool on) noexcept;
+    // IsEnabled: whether tracing is switched on and up (one relaxed atomic load)
+    static bool IsEnabled() noexcept;
+    // GetStats: self-telemetry of the pipeline, merged from all threads, see stats in tracing.yml for periodic dumps
+    static StatsSnapshot GetStats() noexcept;
+    // GetMetrics: RED metrics (rate, errors, latency) per (span name, cmd, err) of every span, sampled or not, as of
+    // the last merge, see metrics in tracing.yml
+    static MetricsSnapshot GetMetrics() noexcept;
+    // DumpFlight: dump spans of the flight recorder ended within the last window into path, or to the exporter if
+    // path is empty (spans the sampler has kept are exported already and skipped). Returns the number of spans dumped.
+    size_t DumpFlight(std::chrono::seconds window, const std::string &path) noexcept;
+    // DumpFlight: same as above, spans of one trace (32 hex chars) still in the flight recorder
+    size_t DumpFlight(const std::string &traceId, const std::string &path) noexcept;
 
 private:
     Tracing();
 
+    friend class SpanGuard;
+    // startScope: StartSpan() by proc and func
+    Scope startScope(opentelemetry::nostd::string_view context, opentelemetry::nostd::string_view proc,
+                     opentelemetry::nostd::string_view func, SpanKind kind, const SampleHint &hint) noexcept;
+    // relayScope: a scope of no span which relays context while switched off, see Relay() in Tracing.cpp
+    static Scope relayScope(opentelemetry::nostd::string_view context) noexcept;
+    // relayIsolatedScope: a scope of no span with a copy of context, or of the one relayed if empty
+    static IsolatedScope relayIsolatedScope(opentelemetry::nostd::string_view context) noexcept;
+    // startIsolatedScope: StartIsolatedSpan() by proc and func
+    IsolatedScope startIsolatedScope(opentelemetry::nostd::string_view context, opentelemetry::nostd::string_view proc,
+                                     opentelemetry::nostd::string_view func, SpanKind kind,
+                                     const SampleHint &hint) noexcept;
+    opentelemetry::nostd::shared_ptr<opentelemetry::trace::Span> startSpan(opentelemetry::nostd::string_view context,
+                                                                          const SpanName &name, SpanKind kind,
+                                                                          const SampleHint &hint,
+                                                                          SpanMark &mark) noexcept;
+    void endSpan(opentelemetry::trace::Span &span, const SpanMark &mark, const SpanEvents &events, int err,
+                 opentelemetry::nostd::string_view msg) noexcept;
+
+    size_t dumpFlight(const FlightFilter &filter, const std::string &path) noexcept;
+
+    void startup() noexcept;
+    bool shutdown(std::chrono::steady_clock::time_point deadline) noexcept;
+    bool flush(std::chrono::steady_clock::time_point deadline) noexcept;
+    void install();
+    void uninstall() noexcept;
+    void reconcile() noexcept;
+    void reload() noexcept;
+    static opentelemetry::nostd::string_view relayed() noexcept;
+
+    // pthread_atfork handlers, see Tracing()
+    static void onForkPrepare() noexcept;
+    static void onForkParent() noexcept;
+    static void onForkChild() noexcept;
+    void afterFork() noexcept;
+
 private:
     struct TraceConf;
     std::unique_ptr<TraceConf> _conf;
+    std::mutex _mtx;                                                                // guards _provider
+    opentelemetry::nostd::shared_ptr<opentelemetry::trace::TracerProvider> _provider; // null while switched off
+    bool _forkInstalled;                                                              // _provider was set at fork()
+    std::thread _starter;                                                             // see TracingOptions::_async
 };
 
 } // namespace tracing
\ No newline at end of file
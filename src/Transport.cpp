@@ -0,0 +1,251 @@
+#include "Transport.h"
+
+#include <curl/curl.h>
+#include <zlib.h>
+
+#include <random>
+
+#include "Stats.h"
+
+using namespace std;
+
+namespace detail {
+
+size_t DiscardResponse(char *, size_t size, size_t n, void *) {
+    return size * n;
+}
+
+// Aborted: progress callback of curl, aborts the transfer once shut down
+int Aborted(void *shutdown, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+    return static_cast<atomic<bool> *>(shutdown)->load(memory_order_relaxed) ? 1 : 0;
+}
+
+// Jitter: uniform in [0, upper]
+chrono::milliseconds Jitter(chrono::milliseconds upper) {
+    static thread_local minstd_rand rng(random_device{}());
+    uniform_int_distribution<long> dist(0, (long)upper.count());
+    return chrono::milliseconds(dist(rng));
+}
+
+} // namespace detail
+
+namespace tracing {
+
+// Connection: a curl easy handle (which keeps its connection alive) and the deflate state of its bodies
+struct HttpTransport::Connection {
+    Connection()
+        : _curl(curl_easy_init())
+        , _zs()
+        , _zinit(false)
+        , _gzipped() {}
+
+    ~Connection() {
+        if (_curl != nullptr) {
+            curl_easy_cleanup(_curl);
+        }
+        if (_zinit) {
+            deflateEnd(&_zs);
+        }
+    }
+
+    // Compress: gzip body into _gzipped
+    bool Compress(const string &body) {
+        if (!_zinit) {
+            if (deflateInit2(&_zs, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                return false;
+            }
+            _zinit = true;
+        } else if (deflateReset(&_zs) != Z_OK) {
+            return false;
+        }
+        _gzipped.resize(deflateBound(&_zs, (uLong)body.size()));
+        _zs.next_in = (Bytef *)body.data();
+        _zs.avail_in = (uInt)body.size();
+        _zs.next_out = (Bytef *)&_gzipped[0];
+        _zs.avail_out = (uInt)_gzipped.size();
+        if (deflate(&_zs, Z_FINISH) != Z_STREAM_END) {
+            return false;
+        }
+        _gzipped.resize(_zs.total_out);
+        return true;
+    }
+
+    CURL *_curl;
+    z_stream _zs;
+    bool _zinit;
+    string _gzipped; // reused, only grows
+};
+
+HttpTransport::HttpTransport(HttpTransportOptions options)
+    : _options(move(options))
+    , _headers(nullptr)
+    , _gzipHeaders(nullptr)
+    , _shutdown(false)
+    , _mtx()
+    , _cv()
+    , _idle()
+    , _failures(0)
+    , _openUntil()
+    , _probing(false) {
+    static once_flag once;
+    call_once(once, []() { curl_global_init(CURL_GLOBAL_DEFAULT); });
+
+    auto contentType = "Content-Type: " + _options._contentType;
+    _headers = curl_slist_append(nullptr, contentType.c_str());
+    _gzipHeaders = curl_slist_append(nullptr, contentType.c_str());
+    _gzipHeaders = curl_slist_append((curl_slist *)_gzipHeaders, "Content-Encoding: gzip");
+}
+
+HttpTransport::~HttpTransport() {
+    Shutdown();
+    _idle.clear();
+    curl_slist_free_all((curl_slist *)_headers);
+    curl_slist_free_all((curl_slist *)_gzipHeaders);
+}
+
+SendResult HttpTransport::Send(const string &body) noexcept {
+    const auto deadline = chrono::steady_clock::now() + _options._budget;
+    if (_shutdown.load(memory_order_relaxed)) {
+        return SendResult::kFailed;
+    }
+    if (!admit()) {
+        Stats::Add(kStatsExportShed);
+        return SendResult::kShed;
+    }
+
+    auto conn = acquire();
+    if (conn == nullptr || conn->_curl == nullptr) {
+        settle(false);
+        return SendResult::kFailed;
+    }
+    // compressed once for all attempts
+    auto gzipped = _options._gzip && body.size() >= _options._gzipMinSize && conn->Compress(body);
+    const auto &payload = gzipped ? conn->_gzipped : body;
+
+    auto result = SendResult::kFailed;
+    auto backoff = _options._backoff;
+    for (auto first = true;; first = false) {
+        if (!first && !admit()) {
+            break;
+        }
+        auto retryable = false;
+        auto start = chrono::steady_clock::now();
+        auto ok = attempt(*conn, payload, gzipped, deadline, retryable);
+        settle(ok && chrono::steady_clock::now() - start <= _options._slowThreshold);
+        if (ok) {
+            result = SendResult::kOk;
+            break;
+        }
+        if (!retryable) {
+            break;
+        }
+        // full jitter, no retry which would not finish within the budget
+        auto wait = detail::Jitter(backoff);
+        if (chrono::steady_clock::now() + wait >= deadline || !sleep(wait)) {
+            break;
+        }
+        backoff = min(backoff * 2, _options._maxBackoff);
+        Stats::Add(kStatsExportRetries);
+    }
+    release(move(conn));
+    return result;
+}
+
+void HttpTransport::Shutdown() noexcept {
+    _shutdown.store(true, memory_order_relaxed);
+    lock_guard<mutex> lock(_mtx);
+    _cv.notify_all();
+}
+
+unique_ptr<HttpTransport::Connection> HttpTransport::acquire() {
+    {
+        lock_guard<mutex> lock(_mtx);
+        if (!_idle.empty()) {
+            auto conn = move(_idle.back());
+            _idle.pop_back();
+            return conn;
+        }
+    }
+
+    unique_ptr<Connection> conn(new Connection);
+    auto curl = conn->_curl;
+    if (curl != nullptr) {
+        curl_easy_setopt(curl, CURLOPT_URL, _options._url.c_str());
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, (long)_options._connectTimeout.count());
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, detail::DiscardResponse);
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, detail::Aborted);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &_shutdown);
+    }
+    return conn;
+}
+
+void HttpTransport::release(unique_ptr<Connection> conn) {
+    lock_guard<mutex> lock(_mtx);
+    if (_idle.size() < _options._poolSize) {
+        _idle.push_back(move(conn));
+    }
+}
+
+bool HttpTransport::attempt(Connection &conn, const string &body, bool gzipped,
+                            chrono::steady_clock::time_point deadline, bool &retryable) noexcept {
+    auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+    auto timeout = max(min(left, _options._timeout), chrono::milliseconds(1));
+    auto curl = conn._curl;
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, gzipped ? _gzipHeaders : _headers);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.data());
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)body.size());
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)timeout.count());
+
+    if (curl_easy_perform(curl) != CURLE_OK) {
+        retryable = !_shutdown.load(memory_order_relaxed);
+        return false;
+    }
+    long code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    if (code >= 200 && code < 300) {
+        return true;
+    }
+    // throttled or the collector failing, the rest is for good
+    retryable = code == 408 || code == 429 || code >= 500;
+    return false;
+}
+
+bool HttpTransport::admit() noexcept {
+    if (_options._breakerFailures == 0) {
+        return true;
+    }
+    lock_guard<mutex> lock(_mtx);
+    if (_failures < _options._breakerFailures) {
+        return true; // closed
+    }
+    if (chrono::steady_clock::now() < _openUntil || _probing) {
+        return false; // open, or half-open with the probe in flight
+    }
+    _probing = true;
+    return true;
+}
+
+void HttpTransport::settle(bool ok) noexcept {
+    if (_options._breakerFailures == 0) {
+        return;
+    }
+    lock_guard<mutex> lock(_mtx);
+    _probing = false;
+    if (ok) {
+        _failures = 0;
+        return;
+    }
+    if (++_failures >= _options._breakerFailures) {
+        _openUntil = chrono::steady_clock::now() + _options._breakerCooldown;
+    }
+}
+
+bool HttpTransport::sleep(chrono::milliseconds duration) noexcept {
+    unique_lock<mutex> lock(_mtx);
+    return !_cv.wait_for(lock, duration, [this]() { return _shutdown.load(memory_order_relaxed); });
+}
+
+} // namespace tracing
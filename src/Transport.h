@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tracing {
+
+// HttpTransportOptions: see reporter.http in tracing.yml
+struct HttpTransportOptions {
+    HttpTransportOptions()
+        : _url()
+        , _contentType("application/json")
+        , _gzip(true)
+        , _gzipMinSize(1024)
+        , _poolSize(2)
+        , _connectTimeout(1000)
+        , _timeout(5000)
+        , _budget(15000)
+        , _backoff(100)
+        , _maxBackoff(2000)
+        , _breakerFailures(5)
+        , _breakerCooldown(10000)
+        , _slowThreshold(3000) {}
+
+    std::string _url;                           // POST target
+    std::string _contentType;                   // of the bodies
+    bool _gzip;                                 // gzip bodies
+    size_t _gzipMinSize;                        // smaller bodies are sent as is
+    size_t _poolSize;                           // idle keep-alive connections kept
+    std::chrono::milliseconds _connectTimeout;  // of each connection
+    std::chrono::milliseconds _timeout;         // of each attempt
+    std::chrono::milliseconds _budget;          // of all attempts of one body, retries stop beyond
+    std::chrono::milliseconds _backoff;         // before the first retry, doubled each retry, full jitter
+    std::chrono::milliseconds _maxBackoff;      // cap of the backoff
+    unsigned _breakerFailures;                  // consecutive failed attempts which open the breaker, 0 for never
+    std::chrono::milliseconds _breakerCooldown; // bodies are shed this long once the breaker opens
+    std::chrono::milliseconds _slowThreshold;   // successful attempts slower count as failed for the breaker
+};
+
+// SendResult: what happened to a body
+enum class SendResult {
+    kOk = 0, // accepted by the collector
+    kFailed, // rejected, or the budget ran out
+    kShed,   // not sent, the breaker is open
+};
+
+// HttpTransport: POST bodies over pooled keep-alive connections, with retry inside a time budget and a circuit
+// breaker which sheds bodies while the collector is failing or slow. Thread-safe.
+class HttpTransport final {
+public:
+    explicit HttpTransport(HttpTransportOptions options);
+    ~HttpTransport();
+
+    HttpTransport(const HttpTransport &) = delete;
+    HttpTransport &operator=(const HttpTransport &) = delete;
+
+public:
+    // Send: POST body, retried until accepted or the budget runs out
+    SendResult Send(const std::string &body) noexcept;
+    // Shutdown: abort the retries in progress, and fail any further Send()
+    void Shutdown() noexcept;
+
+private:
+    struct Connection;
+
+    std::unique_ptr<Connection> acquire();
+    void release(std::unique_ptr<Connection> conn);
+    // attempt: one POST before deadline, whether it may be retried goes to retryable
+    bool attempt(Connection &conn, const std::string &body, bool gzipped,
+                 std::chrono::steady_clock::time_point deadline, bool &retryable) noexcept;
+    // admit: whether the breaker lets an attempt through
+    bool admit() noexcept;
+    // settle: feed the breaker with the outcome of an attempt
+    void settle(bool ok) noexcept;
+    // sleep: sleep unless shut down, returns false if shut down
+    bool sleep(std::chrono::milliseconds duration) noexcept;
+
+private:
+    const HttpTransportOptions _options;
+    void *_headers;     // curl_slist
+    void *_gzipHeaders; // curl_slist with Content-Encoding
+
+    std::atomic<bool> _shutdown;
+
+    std::mutex _mtx; // guards the fields below
+    std::condition_variable _cv;
+    std::vector<std::unique_ptr<Connection>> _idle;
+    unsigned _failures;                               // consecutive failed attempts
+    std::chrono::steady_clock::time_point _openUntil; // breaker open until
+    bool _probing;                                    // a half-open probe is in flight
+};
+
+} // namespace tracing
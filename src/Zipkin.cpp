@@ -0,0 +1,439 @@
+#include "Zipkin.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "Stats.h"
+
+using namespace std;
+using namespace opentelemetry;
+
+namespace detail {
+
+// HexPairs: two lower hex digits of each byte
+struct HexPairs {
+    HexPairs() noexcept {
+        const char *digits = "0123456789abcdef";
+        for (auto i = 0u; i < 256u; i++) {
+            _pairs[2 * i] = digits[i >> 4u];
+            _pairs[2 * i + 1] = digits[i & 0xfu];
+        }
+    }
+    char _pairs[512];
+};
+
+const HexPairs kHexPairs;
+
+// Append: append a string literal without strlen
+template <size_t N>
+void Append(string &out, const char (&literal)[N]) {
+    out.append(literal, N - 1);
+}
+
+void AppendHex(string &out, const uint8_t *bytes, size_t n) {
+    auto pos = out.size();
+    out.resize(pos + 2 * n);
+    auto p = &out[pos];
+    for (size_t i = 0; i < n; i++) {
+        memcpy(p + 2 * i, &kHexPairs._pairs[2 * bytes[i]], 2);
+    }
+}
+
+void AppendInt(string &out, uint64_t value) {
+    char buffer[20];
+    auto p = buffer + sizeof(buffer);
+    do {
+        *--p = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    out.append(p, (size_t)(buffer + sizeof(buffer) - p));
+}
+
+void AppendInt(string &out, int64_t value) {
+    if (value < 0) {
+        out.push_back('-');
+        AppendInt(out, ~(uint64_t)value + 1u);
+        return;
+    }
+    AppendInt(out, (uint64_t)value);
+}
+
+void AppendDouble(string &out, double value) {
+    char buffer[32];
+    auto n = snprintf(buffer, sizeof(buffer), "%.15g", value);
+    out.append(buffer, (size_t)max(n, 0));
+}
+
+constexpr uint64_t kOnes = 0x0101010101010101ull;
+constexpr uint64_t kHighs = 0x8080808080808080ull;
+
+// NeedsEscape: whether any of the 8 bytes is a control character, '"' or '\\' (false positives allowed)
+inline bool NeedsEscape(uint64_t v) {
+    auto control = (v - kOnes * 0x20u) & ~v;
+    auto quote = v ^ (kOnes * '"');
+    auto backslash = v ^ (kOnes * '\\');
+    return ((control | ((quote - kOnes) & ~quote) | ((backslash - kOnes) & ~backslash)) & kHighs) != 0;
+}
+
+inline bool NeedsEscape(char c) {
+    return (unsigned char)c < 0x20u || c == '"' || c == '\\';
+}
+
+// CleanPrefix: length of the prefix which needs no escape, scanned 8 bytes at a time
+size_t CleanPrefix(const char *s, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t v;
+        memcpy(&v, s + i, sizeof(v));
+        if (NeedsEscape(v)) {
+            break;
+        }
+    }
+    while (i < n && !NeedsEscape(s[i])) {
+        i++;
+    }
+    return i;
+}
+
+// AppendEscaped: append s as the content of a JSON string
+void AppendEscaped(string &out, nostd::string_view s) {
+    auto p = s.data();
+    auto n = s.size();
+    while (n > 0) {
+        auto clean = CleanPrefix(p, n);
+        out.append(p, clean);
+        p += clean;
+        n -= clean;
+        if (n == 0) {
+            break;
+        }
+        switch (*p) {
+        case '"':
+            Append(out, "\\\"");
+            break;
+        case '\\':
+            Append(out, "\\\\");
+            break;
+        case '\n':
+            Append(out, "\\n");
+            break;
+        case '\r':
+            Append(out, "\\r");
+            break;
+        case '\t':
+            Append(out, "\\t");
+            break;
+        default: {
+            uint8_t c = (uint8_t)*p;
+            Append(out, "\\u00");
+            AppendHex(out, &c, 1);
+            break;
+        }
+        }
+        p++;
+        n--;
+    }
+}
+
+void AppendString(string &out, nostd::string_view s) {
+    out.push_back('"');
+    AppendEscaped(out, s);
+    out.push_back('"');
+}
+
+// ValueWriter: attribute value as the content of a JSON string, arrays as [a,b]
+struct ValueWriter {
+    string &_out;
+
+    void operator()(bool v) {
+        _out.append(v ? "true" : "false");
+    }
+    void operator()(int32_t v) {
+        AppendInt(_out, (int64_t)v);
+    }
+    void operator()(int64_t v) {
+        AppendInt(_out, v);
+    }
+    void operator()(uint32_t v) {
+        AppendInt(_out, (uint64_t)v);
+    }
+    void operator()(uint64_t v) {
+        AppendInt(_out, v);
+    }
+    void operator()(double v) {
+        AppendDouble(_out, v);
+    }
+    void operator()(const char *v) {
+        AppendEscaped(_out, v);
+    }
+    void operator()(nostd::string_view v) {
+        AppendEscaped(_out, v);
+    }
+    void operator()(nostd::span<const uint8_t> v) {
+        AppendHex(_out, v.data(), v.size());
+    }
+    template <typename T>
+    void operator()(nostd::span<const T> v) {
+        _out.push_back('[');
+        for (size_t i = 0; i < v.size(); i++) {
+            if (i > 0) {
+                _out.push_back(',');
+            }
+            (*this)(v[i]);
+        }
+        _out.push_back(']');
+    }
+};
+
+// AppendAttribute: "key":"value" pair, returns the size of its "key" part
+size_t AppendAttribute(string &out, nostd::string_view key, const common::AttributeValue &value) {
+    auto start = out.size();
+    AppendString(out, key);
+    auto keySize = out.size() - start;
+    Append(out, ":\"");
+    nostd::visit(ValueWriter{out}, value);
+    out.push_back('"');
+    return keySize;
+}
+
+// StatusTag: the pair at is one of the tags an error status writes itself
+bool StatusTag(const string &tags, size_t at) {
+    return tags.compare(at, 8, "\"error\":") == 0 || tags.compare(at, 19, "\"otel.status_code\":") == 0;
+}
+
+const char *KindName(trace::SpanKind kind) {
+    switch (kind) {
+    case trace::SpanKind::kServer:
+        return "SERVER";
+    case trace::SpanKind::kClient:
+        return "CLIENT";
+    case trace::SpanKind::kProducer:
+        return "PRODUCER";
+    case trace::SpanKind::kConsumer:
+        return "CONSUMER";
+    default:
+        return nullptr;
+    }
+}
+
+} // namespace detail
+
+namespace tracing {
+
+ZipkinRecordable::ZipkinRecordable() noexcept
+    : _trace()
+    , _span()
+    , _parent()
+    , _hasParent(false)
+    , _name()
+    , _start(0)
+    , _duration(0)
+    , _kind(trace::SpanKind::kInternal)
+    , _status(trace::StatusCode::kUnset)
+    , _message()
+    , _tags()
+    , _tagAt()
+    , _annotations()
+    , _hold(sizeof(ZipkinRecordable)) {}
+
+void ZipkinRecordable::SetIdentity(const trace::SpanContext &span_context, trace::SpanId parent_span_id) noexcept {
+    span_context.trace_id().CopyBytesTo(_trace);
+    span_context.span_id().CopyBytesTo(_span);
+    parent_span_id.CopyBytesTo(_parent);
+    _hasParent = parent_span_id.IsValid();
+}
+
+void ZipkinRecordable::SetAttribute(nostd::string_view key, const common::AttributeValue &value) noexcept {
+    static thread_local string pair;
+    pair.clear();
+    auto keySize = detail::AppendAttribute(pair, key, Budget::Clip(value));
+    // last write wins: a key set again has its pair replaced in place, attributes are capped so a scan will do
+    for (size_t i = 0; i < _tagAt.size(); i++) {
+        auto at = _tagAt[i];
+        if (_tags.compare(at, keySize, pair, 0, keySize) != 0) {
+            continue;
+        }
+        auto size = tagEnd(i) - at;
+        if (pair.size() > size && !_hold.Grow(pair.size() - size)) {
+            Stats::Add(kStatsAttrsDropped);
+            return;
+        }
+        _tags.replace(at, size, pair);
+        for (auto j = i + 1; j < _tagAt.size(); j++) {
+            _tagAt[j] = _tagAt[j] + pair.size() - size;
+        }
+        return;
+    }
+    auto comma = _tags.empty() ? 0u : 1u;
+    if (!_hold.AddAttribute(comma + pair.size())) {
+        Stats::Add(kStatsAttrsDropped);
+        return;
+    }
+    if (comma != 0) {
+        _tags.push_back(',');
+    }
+    _tagAt.push_back(_tags.size());
+    _tags.append(pair);
+}
+
+void ZipkinRecordable::AddEvent(nostd::string_view name, common::SystemTimestamp timestamp,
+                                const common::KeyValueIterable &attributes) noexcept {
+    auto pos = _annotations.size();
+    if (!_annotations.empty()) {
+        _annotations.push_back(',');
+    }
+    detail::Append(_annotations, "{\"timestamp\":");
+    detail::AppendInt(_annotations, (int64_t)chrono::duration_cast<chrono::microseconds>(
+                                        timestamp.time_since_epoch()).count());
+    detail::Append(_annotations, ",\"value\":\"");
+    detail::AppendEscaped(_annotations, name);
+    // attributes follow the name as k=v
+    attributes.ForEachKeyValue([this](nostd::string_view key, common::AttributeValue value) noexcept -> bool {
+        _annotations.push_back(' ');
+        detail::AppendEscaped(_annotations, key);
+        _annotations.push_back('=');
+        nostd::visit(detail::ValueWriter{_annotations}, value);
+        return true;
+    });
+    detail::Append(_annotations, "\"}");
+    if (!_hold.Grow(_annotations.size() - pos)) {
+        _annotations.resize(pos);
+        Stats::Add(kStatsEventsDropped);
+    }
+}
+
+void ZipkinRecordable::AddLink(const trace::SpanContext &, const common::KeyValueIterable &) noexcept {
+    // no links in zipkin v2
+}
+
+void ZipkinRecordable::SetStatus(trace::StatusCode code, nostd::string_view description) noexcept {
+    auto text = Budget::Clip(description);
+    _hold.Force(text.size() > _message.size() ? text.size() - _message.size() : 0);
+    _status = code;
+    _message.assign(text.data(), text.size());
+}
+
+void ZipkinRecordable::SetName(nostd::string_view name) noexcept {
+    _hold.Force(name.size() > _name.size() ? name.size() - _name.size() : 0);
+    _name.assign(name.data(), name.size());
+}
+
+void ZipkinRecordable::SetSpanKind(trace::SpanKind span_kind) noexcept {
+    _kind = span_kind;
+}
+
+void ZipkinRecordable::SetResource(const sdk::resource::Resource &) noexcept {
+    // the service name comes from ZipkinExporterOptions
+}
+
+void ZipkinRecordable::SetStartTime(common::SystemTimestamp start_time) noexcept {
+    _start = chrono::duration_cast<chrono::microseconds>(start_time.time_since_epoch()).count();
+}
+
+void ZipkinRecordable::SetDuration(chrono::nanoseconds duration) noexcept {
+    _duration = chrono::duration_cast<chrono::microseconds>(duration).count();
+}
+
+void ZipkinRecordable::SetInstrumentationLibrary(const sdk::trace::InstrumentationLibrary &) noexcept {}
+
+size_t ZipkinRecordable::tagEnd(size_t i) const noexcept {
+    return i + 1 < _tagAt.size() ? _tagAt[i + 1] - 1 : _tags.size();
+}
+
+CustomZipkinExporter::CustomZipkinExporter(ZipkinExporterOptions options)
+    : _options(move(options))
+    , _body()
+    , _transport(_options._http)
+    , _shutdown(false) {}
+
+CustomZipkinExporter::~CustomZipkinExporter() = default;
+
+unique_ptr<sdk::trace::Recordable> CustomZipkinExporter::MakeRecordable() noexcept {
+    return unique_ptr<sdk::trace::Recordable>(new ZipkinRecordable);
+}
+
+sdk::common::ExportResult
+CustomZipkinExporter::Export(const nostd::span<unique_ptr<sdk::trace::Recordable>> &spans) noexcept {
+    if (_shutdown.load(memory_order_relaxed)) {
+        return sdk::common::ExportResult::kFailure;
+    }
+    if (spans.empty()) {
+        return sdk::common::ExportResult::kSuccess;
+    }
+    _body.clear(); // capacity is kept
+    Serialize(spans, _options._serviceName, _body);
+    auto result = _transport.Send(_body);
+    return result == SendResult::kOk ? sdk::common::ExportResult::kSuccess : sdk::common::ExportResult::kFailure;
+}
+
+bool CustomZipkinExporter::Shutdown(chrono::microseconds) noexcept {
+    _shutdown.store(true, memory_order_relaxed);
+    _transport.Shutdown();
+    return true;
+}
+
+void CustomZipkinExporter::Serialize(const nostd::span<unique_ptr<sdk::trace::Recordable>> &spans,
+                                     const string &serviceName, string &out) noexcept {
+    // zipkin v2 has no batch level fields, the endpoint every span repeats is rendered once
+    string endpoint(",\"localEndpoint\":{\"serviceName\":");
+    detail::AppendString(endpoint, serviceName);
+    detail::Append(endpoint, "},\"tags\":{");
+    out.push_back('[');
+    auto first = true;
+    for (const auto &recordable : spans) {
+        auto span = static_cast<const ZipkinRecordable *>(recordable.get());
+        if (span == nullptr) {
+            continue;
+        }
+        if (!first) {
+            out.push_back(',');
+        }
+        first = false;
+
+        detail::Append(out, "{\"traceId\":\"");
+        detail::AppendHex(out, span->_trace, sizeof(span->_trace));
+        detail::Append(out, "\",\"id\":\"");
+        detail::AppendHex(out, span->_span, sizeof(span->_span));
+        if (span->_hasParent) {
+            detail::Append(out, "\",\"parentId\":\"");
+            detail::AppendHex(out, span->_parent, sizeof(span->_parent));
+        }
+        detail::Append(out, "\",\"name\":");
+        detail::AppendString(out, span->_name);
+        detail::Append(out, ",\"timestamp\":");
+        detail::AppendInt(out, span->_start);
+        detail::Append(out, ",\"duration\":");
+        detail::AppendInt(out, span->_duration);
+        auto kind = detail::KindName(span->_kind);
+        if (kind != nullptr) {
+            detail::Append(out, ",\"kind\":\"");
+            out.append(kind);
+            out.push_back('"');
+        }
+        out.append(endpoint);
+        if (span->_status != trace::StatusCode::kError) {
+            out.append(span->_tags);
+        } else {
+            // the status has the last word on error and otel.status_code, tags of the same keys are left out
+            for (size_t i = 0; i < span->_tagAt.size(); i++) {
+                auto at = span->_tagAt[i];
+                if (!detail::StatusTag(span->_tags, at)) {
+                    out.append(span->_tags, at, span->tagEnd(i) - at);
+                    out.push_back(',');
+                }
+            }
+            detail::Append(out, "\"otel.status_code\":\"ERROR\",\"error\":");
+            detail::AppendString(out, span->_message);
+        }
+        out.push_back('}');
+        if (!span->_annotations.empty()) {
+            detail::Append(out, ",\"annotations\":[");
+            out.append(span->_annotations);
+            out.push_back(']');
+        }
+        out.push_back('}');
+    }
+    out.push_back(']');
+}
+
+} // namespace tracing
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <opentelemetry/sdk/trace/exporter.h>
+#include <opentelemetry/sdk/trace/recordable.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "Budget.h"
+#include "Transport.h"
+
+namespace tracing {
+
+// ZipkinRecordable: span data kept as the Zipkin v2 JSON needs it, attributes are rendered as JSON on arrival
+class ZipkinRecordable final : public opentelemetry::sdk::trace::Recordable {
+public:
+    ZipkinRecordable() noexcept;
+
+public:
+    void SetIdentity(const opentelemetry::trace::SpanContext &span_context,
+                     opentelemetry::trace::SpanId parent_span_id) noexcept override;
+    void SetAttribute(opentelemetry::nostd::string_view key,
+                      const opentelemetry::common::AttributeValue &value) noexcept override;
+    void AddEvent(opentelemetry::nostd::string_view name, opentelemetry::common::SystemTimestamp timestamp,
+                  const opentelemetry::common::KeyValueIterable &attributes) noexcept override;
+    void AddLink(const opentelemetry::trace::SpanContext &span_context,
+                 const opentelemetry::common::KeyValueIterable &attributes) noexcept override;
+    void SetStatus(opentelemetry::trace::StatusCode code, opentelemetry::nostd::string_view description) noexcept
+        override;
+    void SetName(opentelemetry::nostd::string_view name) noexcept override;
+    void SetSpanKind(opentelemetry::trace::SpanKind span_kind) noexcept override;
+    void SetResource(const opentelemetry::sdk::resource::Resource &resource) noexcept override;
+    void SetStartTime(opentelemetry::common::SystemTimestamp start_time) noexcept override;
+    void SetDuration(std::chrono::nanoseconds duration) noexcept override;
+    void SetInstrumentationLibrary(const opentelemetry::sdk::trace::InstrumentationLibrary &library) noexcept
+        override;
+
+private:
+    friend class CustomZipkinExporter;
+    size_t tagEnd(size_t i) const noexcept;
+
+    uint8_t _trace[16];
+    uint8_t _span[8];
+    uint8_t _parent[8];
+    bool _hasParent;
+    std::string _name;
+    int64_t _start;    // us since epoch
+    int64_t _duration; // us
+    opentelemetry::trace::SpanKind _kind;
+    opentelemetry::trace::StatusCode _status;
+    std::string _message; // status description
+    std::string _tags;          // "key":"value" pairs, comma separated
+    std::vector<size_t> _tagAt; // offset of each pair in _tags
+    std::string _annotations;   // {"timestamp":..,"value":".."} objects, comma separated
+    BudgetHold _hold;           // of the memory budget
+};
+
+// ZipkinExporterOptions: see reporter in tracing.yml
+struct ZipkinExporterOptions {
+    ZipkinExporterOptions()
+        : _serviceName()
+        , _http() {
+        _http._url = "http://localhost:9411/api/v2/spans";
+    }
+
+    std::string _serviceName;   // localEndpoint.serviceName of every span
+    HttpTransportOptions _http; // collector url and how to post to it
+};
+
+// CustomZipkinExporter: Zipkin v2 JSON over HTTP, spans are written straight into one reusable buffer per batch
+class CustomZipkinExporter final : public opentelemetry::sdk::trace::SpanExporter {
+public:
+    explicit CustomZipkinExporter(ZipkinExporterOptions options);
+    ~CustomZipkinExporter() override;
+
+    CustomZipkinExporter(const CustomZipkinExporter &) = delete;
+    CustomZipkinExporter &operator=(const CustomZipkinExporter &) = delete;
+
+public:
+    std::unique_ptr<opentelemetry::sdk::trace::Recordable> MakeRecordable() noexcept override;
+    opentelemetry::sdk::common::ExportResult
+    Export(const opentelemetry::nostd::span<std::unique_ptr<opentelemetry::sdk::trace::Recordable>> &spans) noexcept
+        override;
+    bool Shutdown(std::chrono::microseconds timeout) noexcept override;
+
+public:
+    // Serialize: append spans (ZipkinRecordable only) to out as a Zipkin v2 JSON array
+    static void
+    Serialize(const opentelemetry::nostd::span<std::unique_ptr<opentelemetry::sdk::trace::Recordable>> &spans,
+              const std::string &serviceName, std::string &out) noexcept;
+
+private:
+    const ZipkinExporterOptions _options;
+    std::string _body; // reused across batches, only touched by the export thread
+    HttpTransport _transport;
+    std::atomic<bool> _shutdown;
+};
+
+} // namespace tracing
@@ -0,0 +1,136 @@
+#include <opentelemetry/sdk/trace/random_id_generator.h>
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "IdGenerator.h"
+#include "Propagator.h"
+#include "Zipkin.h"
+
+using namespace std;
+using namespace tracing;
+using namespace opentelemetry;
+
+constexpr const size_t kLoops = 1000000u;
+
+// Bench: run fn kLoops times on each of threads threads and print ns/op
+template <typename F>
+void Bench(const string &name, unsigned threads, F fn) {
+    vector<thread> workers;
+    auto start = chrono::steady_clock::now();
+    for (auto i = 0u; i < threads; i++) {
+        workers.emplace_back([&fn]() {
+            for (auto n = 0u; n < kLoops; n++) {
+                fn();
+            }
+        });
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+    auto cost = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    cout << name << " x" << threads << ": " << (double)cost / (double)kLoops << " ns/op" << endl;
+}
+
+// DoNotOptimize: keep the generated id alive
+template <typename T>
+void DoNotOptimize(const T &value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+void BenchIdGenerator() {
+    cout << "----------------------------------------" << endl;
+    sdk::trace::RandomIdGenerator sdkGen;
+    CustomIdGenerator gen;
+    CustomIdGenerator ordered(true);
+    for (auto threads : {1u, 4u}) {
+        Bench("RandomIdGenerator::GenerateTraceId", threads, [&]() { DoNotOptimize(sdkGen.GenerateTraceId()); });
+        Bench("RandomIdGenerator::GenerateSpanId", threads, [&]() { DoNotOptimize(sdkGen.GenerateSpanId()); });
+        Bench("CustomIdGenerator::GenerateTraceId", threads, [&]() { DoNotOptimize(gen.GenerateTraceId()); });
+        Bench("CustomIdGenerator::GenerateSpanId", threads, [&]() { DoNotOptimize(gen.GenerateSpanId()); });
+        Bench("CustomIdGenerator::GenerateTraceId(time-ordered)", threads,
+              [&]() { DoNotOptimize(ordered.GenerateTraceId()); });
+    }
+}
+
+void BenchZipkinSerialize() {
+    cout << "----------------------------------------" << endl;
+    // one span as Tracing::StartSpan() makes it
+    vector<unique_ptr<sdk::trace::Recordable>> spans;
+    spans.emplace_back(new ZipkinRecordable);
+    auto &span = *spans.back();
+    CustomIdGenerator gen;
+    span.SetIdentity(trace::SpanContext(gen.GenerateTraceId(), gen.GenerateSpanId(), trace::TraceFlags(1), false),
+                     gen.GenerateSpanId());
+    span.SetName("bench.BenchZipkinSerialize");
+    span.SetSpanKind(trace::SpanKind::kServer);
+    span.SetStartTime(common::SystemTimestamp(chrono::system_clock::now()));
+    span.SetDuration(chrono::microseconds(1234));
+    span.SetAttribute("uid", 107274449u);
+    span.SetAttribute("cmd", 1001u);
+    span.SetAttribute("rot", true);
+    span.SetAttribute("err", -1);
+    span.SetStatus(trace::StatusCode::kError, "something \"quoted\" went wrong");
+
+    nostd::span<unique_ptr<sdk::trace::Recordable>> batch(spans.data(), spans.size());
+    Bench("CustomZipkinExporter::Serialize", 1, [&]() {
+        static string out;
+        out.clear();
+        CustomZipkinExporter::Serialize(batch, "bench", out);
+        DoNotOptimize(out);
+    });
+}
+
+void BenchJaegerExtract() {
+    cout << "----------------------------------------" << endl;
+    CustomIdGenerator gen;
+    auto wire = EncodeJaegerContext(
+        trace::SpanContext(gen.GenerateTraceId(), gen.GenerateSpanId(), trace::TraceFlags(1), true));
+    CustomPropagator propagator;
+    Bench("CustomPropagator::Extract(CustomCarrier)", 1, [&]() {
+        CustomCarrier carrier;
+        carrier.Set(jaeger::kBinaryFormat, wire);
+        auto ctx = context::Context();
+        DoNotOptimize(propagator.Extract(carrier, ctx));
+    });
+    Bench("CustomPropagator::Extract(CustomCarrierView)", 1, [&]() {
+        CustomCarrierView carrier(wire);
+        auto ctx = context::Context();
+        DoNotOptimize(propagator.Extract(carrier, ctx));
+    });
+}
+
+void BenchMultiFormatExtract() {
+    cout << "----------------------------------------" << endl;
+    CustomPropagator propagator;
+    CustomCarrier w3cCarrier;
+    w3cCarrier.Set(w3c::kTraceParent, "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01");
+    CustomCarrier singleCarrier;
+    singleCarrier.Set(b3::kSingle, "80f198ee56343ba864fe8b2a57d3eff7-e457b5a2e4d86bd1-1");
+    CustomCarrier multiCarrier;
+    multiCarrier.Set(b3::kTraceId, "80f198ee56343ba864fe8b2a57d3eff7");
+    multiCarrier.Set(b3::kSpanId, "e457b5a2e4d86bd1");
+    multiCarrier.Set(b3::kSampled, "1");
+    Bench("CustomPropagator::Extract(traceparent)", 1, [&]() {
+        auto ctx = context::Context();
+        DoNotOptimize(propagator.Extract(w3cCarrier, ctx));
+    });
+    Bench("CustomPropagator::Extract(b3)", 1, [&]() {
+        auto ctx = context::Context();
+        DoNotOptimize(propagator.Extract(singleCarrier, ctx));
+    });
+    Bench("CustomPropagator::Extract(x-b3-*)", 1, [&]() {
+        auto ctx = context::Context();
+        DoNotOptimize(propagator.Extract(multiCarrier, ctx));
+    });
+}
+
+int main() {
+    BenchIdGenerator();
+    BenchZipkinSerialize();
+    BenchJaegerExtract();
+    BenchMultiFormatExtract();
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <string>
+
+#include "Budget.h"
+#include "Check.h"
+#include "Stats.h"
+
+using namespace std;
+using namespace tracing;
+using namespace opentelemetry;
+
+// Setup: a budget of chunks whole chunks, the other caps as given
+void Setup(size_t chunks, size_t maxAttributes = 0, size_t maxValueLen = 0) {
+    BudgetOptions options;
+    options._maxBytes = chunks * kBudgetChunk;
+    options._maxAttributes = maxAttributes;
+    options._maxValueLen = maxValueLen;
+    Budget::Setup(options);
+}
+
+void Chunks() {
+    Setup(4);
+    auto base = Budget::Used();
+    {
+        BudgetHold hold(100);
+        Check(Budget::Used() - base == kBudgetChunk, "chunks: the base is charged by the chunk");
+        Check(hold.Grow(kBudgetChunk - 100), "chunks: grows within the chunk");
+        Check(Budget::Used() - base == kBudgetChunk, "chunks: nothing more charged within the chunk");
+        Check(hold.Grow(1), "chunks: grows past the chunk");
+        Check(Budget::Used() - base == kBudgetChunk * 2, "chunks: one more chunk charged");
+        Check(hold.Grow(kBudgetChunk * 2), "chunks: grows to the budget");
+        Check(Budget::Exhausted(), "chunks: exhausted at the budget");
+        Check(hold.Grow(1), "chunks: still grows within what it holds");
+        Check(!hold.Grow(kBudgetChunk), "chunks: no growing over the budget");
+        Check(Budget::Used() - base == kBudgetChunk * 4, "chunks: nothing charged when it does not fit");
+        hold.Force(kBudgetChunk);
+        Check(Budget::Used() - base == kBudgetChunk * 5, "chunks: forced over the budget");
+    }
+    Check(Budget::Used() == base, "chunks: all released on destruction");
+    {
+        BudgetHold over(kBudgetChunk * 8);
+        Check(Budget::Used() - base == kBudgetChunk * 8, "chunks: the base is charged over the budget");
+    }
+    Check(Budget::Used() == base && !Budget::Exhausted(), "chunks: released again");
+}
+
+void Attributes() {
+    Setup(4, 3);
+    BudgetHold hold(0);
+    auto added = 0;
+    for (auto i = 0; i < 5; i++) {
+        added += hold.AddAttribute(8) ? 1 : 0;
+    }
+    Check(added == 3, "attributes: capped at max-attributes");
+    Setup(4, 0);
+    Check(hold.AddAttribute(8), "attributes: no cap with 0");
+}
+
+void Clip() {
+    Setup(0, 0, 5);
+    auto truncated = Stats::Snapshot()._counters[kStatsAttrsTruncated];
+    auto clip = [](const char *text) { return Budget::Clip(nostd::string_view(text)); };
+    Check(clip("abcde") == "abcde", "clip: as is at max-value-len");
+    Check(Stats::Snapshot()._counters[kStatsAttrsTruncated] == truncated, "clip: not counted as is");
+    Check(clip("abcdef") == "abcde", "clip: cut at max-value-len");
+    Check(clip("abcd\xc3\xa9x") == "abcd", "clip: a 2-byte code point is not split");
+    Check(clip("abc\xe2\x82\xac") == "abc", "clip: a 3-byte code point is not split");
+    Check(clip("ab\xe2\x82\xac") == "ab\xe2\x82\xac", "clip: a code point which ends at the cap is kept");
+    Check(Stats::Snapshot()._counters[kStatsAttrsTruncated] - truncated == 3, "clip: counted once cut");
+
+    common::AttributeValue value = nostd::string_view("abcd\xc3\xa9x");
+    auto clipped = Budget::Clip(value);
+    Check(nostd::holds_alternative<nostd::string_view>(clipped) && nostd::get<nostd::string_view>(clipped) == "abcd",
+          "clip: the string of an attribute value");
+    Check(nostd::get<int64_t>(Budget::Clip(common::AttributeValue((int64_t)1234567))) == 1234567,
+          "clip: other types as is");
+}
+
+int main() {
+    Chunks();
+    Attributes();
+    Clip();
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+
+namespace tracing {
+
+// failures: checks failed so far, main returns non-zero when there are any
+static int failures = 0;
+
+// Check: print what with ok or FAIL, and count a failure
+static void Check(bool ok, const std::string &what) {
+    std::cout << (ok ? "ok   " : "FAIL ") << what << std::endl;
+    failures += ok ? 0 : 1;
+}
+
+} // namespace tracing
@@ -0,0 +1,329 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <opentelemetry/common/key_value_iterable_view.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Check.h"
+#include "IdGenerator.h"
+#include "Jaeger.h"
+#include "Stats.h"
+
+using namespace std;
+using namespace tracing;
+using namespace opentelemetry;
+
+// DecodedSpan: what the agent would see of a span
+struct DecodedSpan {
+    int64_t _traceLow;
+    int64_t _traceHigh;
+    int64_t _span;
+    int64_t _parent;
+    string _name;
+    int64_t _flags;
+    size_t _tags;
+    size_t _logs;
+};
+
+// Reader: just enough thrift compact to decode Agent.emitBatch
+struct Reader {
+    const uint8_t *_p;
+    const uint8_t *_end;
+    bool _ok;
+
+    uint8_t Byte() {
+        if (_p >= _end) {
+            _ok = false;
+            return 0;
+        }
+        return *_p++;
+    }
+    uint64_t Varint() {
+        uint64_t v = 0;
+        for (auto shift = 0; shift < 64 && _ok; shift += 7) {
+            auto b = Byte();
+            v |= (uint64_t)(b & 0x7fu) << shift;
+            if ((b & 0x80u) == 0) {
+                break;
+            }
+        }
+        return v;
+    }
+    int64_t Int() {
+        auto v = Varint();
+        return (int64_t)(v >> 1) ^ -(int64_t)(v & 1u);
+    }
+    string Binary() {
+        auto n = Varint();
+        if ((size_t)(_end - _p) < n) {
+            _ok = false;
+            return "";
+        }
+        string s((const char *)_p, n);
+        _p += n;
+        return s;
+    }
+    // Field: the next field of the struct, false at its stop
+    bool Field(int16_t &last, int16_t &id, uint8_t &type) {
+        auto b = Byte();
+        if (b == 0 || !_ok) {
+            return false;
+        }
+        type = b & 0x0fu;
+        id = (b >> 4) != 0 ? (int16_t)(last + (b >> 4)) : (int16_t)Int();
+        last = id;
+        return true;
+    }
+    size_t List(uint8_t &type) {
+        auto b = Byte();
+        type = b & 0x0fu;
+        size_t size = b >> 4;
+        return size == 15 ? Varint() : size;
+    }
+    void Skip(uint8_t type) {
+        switch (type) {
+        case 1:
+        case 2:
+            break;
+        case 3:
+            Byte();
+            break;
+        case 4:
+        case 5:
+        case 6:
+            Varint();
+            break;
+        case 7:
+            _p += 8;
+            break;
+        case 8:
+            Binary();
+            break;
+        case 9: {
+            uint8_t elem;
+            for (auto n = List(elem); n > 0 && _ok; n--) {
+                Skip(elem);
+            }
+            break;
+        }
+        case 12: {
+            int16_t last = 0, id;
+            uint8_t t;
+            while (Field(last, id, t)) {
+                Skip(t);
+            }
+            break;
+        }
+        default:
+            _ok = false;
+        }
+    }
+};
+
+// Decode: the spans of one emitBatch datagram, false if it is malformed
+bool Decode(const string &datagram, string &service, vector<DecodedSpan> &spans) {
+    Reader r{(const uint8_t *)datagram.data(), (const uint8_t *)datagram.data() + datagram.size(), true};
+    if (r.Byte() != 0x82 || r.Byte() != 0x81) {
+        return false;
+    }
+    r.Varint();
+    if (r.Binary() != "emitBatch") {
+        return false;
+    }
+    int16_t argsLast = 0, batchLast = 0, id;
+    uint8_t type;
+    if (!r.Field(argsLast, id, type) || id != 1 || type != 12) {
+        return false;
+    }
+    while (r.Field(batchLast, id, type)) {
+        if (id == 1 && type == 12) {
+            int16_t last = 0;
+            while (r.Field(last, id, type)) {
+                if (id == 1) {
+                    service = r.Binary();
+                } else {
+                    r.Skip(type);
+                }
+            }
+        } else if (id == 2 && type == 9) {
+            uint8_t elem;
+            for (auto n = r.List(elem); n > 0 && r._ok; n--) {
+                DecodedSpan span{};
+                int16_t last = 0;
+                while (r.Field(last, id, type)) {
+                    uint8_t t;
+                    switch (id) {
+                    case 1:
+                        span._traceLow = r.Int();
+                        break;
+                    case 2:
+                        span._traceHigh = r.Int();
+                        break;
+                    case 3:
+                        span._span = r.Int();
+                        break;
+                    case 4:
+                        span._parent = r.Int();
+                        break;
+                    case 5:
+                        span._name = r.Binary();
+                        break;
+                    case 7:
+                        span._flags = r.Int();
+                        break;
+                    case 10:
+                        span._tags = r.List(t);
+                        for (auto i = span._tags; i > 0; i--) {
+                            r.Skip(t);
+                        }
+                        break;
+                    case 11:
+                        span._logs = r.List(t);
+                        for (auto i = span._logs; i > 0; i--) {
+                            r.Skip(t);
+                        }
+                        break;
+                    default:
+                        r.Skip(type);
+                    }
+                }
+                spans.push_back(span);
+            }
+        } else {
+            r.Skip(type);
+        }
+    }
+    int16_t tmp = 0;
+    return r._ok && !r.Field(tmp, id, type) && r._ok && r._p == r._end;
+}
+
+// Agent: a UDP socket on 127.0.0.1 standing in for jaeger-agent
+struct Agent {
+    Agent()
+        : _fd(socket(AF_INET, SOCK_DGRAM, 0))
+        , _port(0) {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        int size = 8 << 20;
+        setsockopt(_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        bind(_fd, (sockaddr *)&addr, len);
+        getsockname(_fd, (sockaddr *)&addr, &len);
+        _port = ntohs(addr.sin_port);
+    }
+    ~Agent() {
+        close(_fd);
+    }
+
+    // Receive: all datagrams which arrive until nothing comes for a while
+    vector<string> Receive() {
+        vector<string> datagrams;
+        char buffer[65536];
+        pollfd pfd{_fd, POLLIN, 0};
+        while (poll(&pfd, 1, 100) > 0) {
+            auto n = recv(_fd, buffer, sizeof(buffer), 0);
+            if (n < 0) {
+                break;
+            }
+            datagrams.emplace_back(buffer, (size_t)n);
+        }
+        return datagrams;
+    }
+
+    int _fd;
+    uint16_t _port;
+};
+
+vector<unique_ptr<sdk::trace::Recordable>> MakeSpans(CustomJaegerExporter &exporter, size_t n) {
+    CustomIdGenerator gen;
+    vector<unique_ptr<sdk::trace::Recordable>> spans;
+    for (size_t i = 0; i < n; i++) {
+        spans.push_back(exporter.MakeRecordable());
+        auto &span = *spans.back();
+        span.SetIdentity(trace::SpanContext(gen.GenerateTraceId(), gen.GenerateSpanId(), trace::TraceFlags(1), false),
+                         gen.GenerateSpanId());
+        span.SetName("span." + to_string(i));
+        span.SetSpanKind(trace::SpanKind::kServer);
+        span.SetStartTime(common::SystemTimestamp(chrono::system_clock::now()));
+        span.SetDuration(chrono::microseconds(1234));
+        span.SetAttribute("uid", 107274449u);
+        span.SetAttribute("cmd", 1001u);
+        span.SetAttribute("rot", true);
+        span.SetAttribute("ratio", 0.5);
+        span.SetAttribute("peer", "127.0.0.1");
+    }
+    return spans;
+}
+
+void Packing() {
+    Agent agent;
+    JaegerExporterOptions options;
+    options._endpoint = "127.0.0.1:" + to_string(agent._port);
+    options._serviceName = "test";
+    options._maxPacketSize = 1500;
+    CustomJaegerExporter exporter(options);
+
+    auto spans = MakeSpans(exporter, 200);
+    map<string, common::AttributeValue> attrs{{"err", -1}, {"retry", 2}};
+    spans.back()->AddEvent("retry", common::SystemTimestamp(chrono::system_clock::now()),
+                           common::KeyValueIterableView<map<string, common::AttributeValue>>(attrs));
+    spans.back()->SetStatus(trace::StatusCode::kError, "failed");
+    nostd::span<unique_ptr<sdk::trace::Recordable>> batch(spans.data(), spans.size());
+    Check(exporter.Export(batch) == sdk::common::ExportResult::kSuccess, "packing: exported");
+
+    auto datagrams = agent.Receive();
+    auto ok = true;
+    auto fits = true;
+    vector<DecodedSpan> decoded;
+    string service;
+    for (const auto &d : datagrams) {
+        fits = fits && d.size() <= options._maxPacketSize;
+        ok = ok && Decode(d, service, decoded);
+    }
+    cout << "     " << datagrams.size() << " datagrams for " << spans.size() << " spans" << endl;
+    Check(datagrams.size() > 1 && datagrams.size() < spans.size() / 4, "packing: several spans per datagram");
+    Check(fits, "packing: every datagram under the max packet size");
+    Check(ok && service == "test", "packing: every datagram decodes");
+    Check(decoded.size() == spans.size(), "packing: every span delivered");
+    Check(!decoded.empty() && decoded.back()._name == "span.199" && decoded.back()._flags == 1 &&
+              decoded.back()._tags == 8 && decoded.back()._logs == 1 && decoded.back()._parent != 0,
+          "packing: span fields");
+}
+
+void Oversize() {
+    Agent agent;
+    JaegerExporterOptions options;
+    options._endpoint = "127.0.0.1:" + to_string(agent._port);
+    options._maxPacketSize = 1500;
+    CustomJaegerExporter exporter(options);
+
+    auto spans = MakeSpans(exporter, 3);
+    string blob(2000, 'x');
+    spans[1]->SetAttribute("blob", nostd::string_view(blob));
+    auto oversize = Stats::Snapshot()._counters[kStatsDropOversize];
+    nostd::span<unique_ptr<sdk::trace::Recordable>> batch(spans.data(), spans.size());
+    Check(exporter.Export(batch) == sdk::common::ExportResult::kSuccess, "oversize: exported");
+
+    vector<DecodedSpan> decoded;
+    string service;
+    for (const auto &d : agent.Receive()) {
+        Decode(d, service, decoded);
+    }
+    Check(decoded.size() == 2 && decoded[0]._name == "span.0" && decoded[1]._name == "span.2",
+          "oversize: the others delivered");
+    Check(Stats::Snapshot()._counters[kStatsDropOversize] - oversize == 1, "oversize: counted");
+}
+
+int main() {
+    Packing();
+    Oversize();
+    return failures == 0 ? 0 : 1;
+}
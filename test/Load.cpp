@@ -0,0 +1,234 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Common.h"
+#include "IdGenerator.h"
+#include "MockCollector.h"
+#include "Stats.h"
+#include "Tracing.h"
+
+// Load: closed-loop load generator, each worker serves RPC trees back to back with the whole export path up against
+// in-process mock collectors. The tracing overhead of a request is its time minus the time of its simulated work.
+//
+//     Load [threads=8] [seconds=10] [ratio=10000] [fanout=3] [max-p99-us=0] [group-window-ms=0]
+//
+// ratio is sampler.ratio (of 10000). With max-p99-us > 0 the exit code is 1 if the p99 overhead is over it, so a
+// release pipeline can catch overhead regressions. group-window-ms > 0 turns reporter.queue.group on with it, compare
+// the bytes per span at the collectors with and without.
+
+using namespace std;
+using namespace tracing;
+using namespace opentelemetry;
+
+constexpr const unsigned kWork = 2000u; // iterations of each simulated work segment
+
+// LoadOptions: see the usage above
+struct LoadOptions {
+    unsigned _threads;
+    unsigned _seconds;
+    unsigned _ratio;
+    unsigned _fanout;
+    uint64_t _maxP99;      // us, 0 for no check
+    unsigned _groupWindow; // ms, 0 for no grouping
+};
+
+// LoadResult: what a worker did
+struct LoadResult {
+    LoadResult()
+        : _requests(0)
+        , _overhead(new Histogram) {}
+
+    uint64_t _requests;
+    unique_ptr<Histogram> _overhead; // ns per request
+};
+
+// DoNotOptimize: keep the computed value alive
+template <typename T>
+void DoNotOptimize(const T &value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+// Work: simulated request handling, returns the ns spent
+int64_t Work(uint64_t &state) {
+    auto start = chrono::steady_clock::now();
+    for (auto i = 0u; i < kWork; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+    }
+    DoNotOptimize(state);
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+// Upstream: a remote caller's jaeger binary context with baggage, a new trace each time
+void Upstream(string &out) {
+    char traceId[33], spanId[17];
+    snprintf(traceId, sizeof(traceId), "%016" PRIx64 "%016" PRIx64, CustomIdGenerator::Random(),
+             CustomIdGenerator::Random());
+    snprintf(spanId, sizeof(spanId), "%016" PRIx64, CustomIdGenerator::Random() | 1u);
+    Context ctx(traceId, spanId, "", true, {{"tenant", "load"}, {"region", "local"}});
+    Tracing::FormatAsJaegerContext(ctx, out);
+}
+
+// Request: one RPC tree, a server span with fanout nested client calls and an asynchronous hand-off whose isolated
+// context is picked up by the consumer. Returns the ns spent in the simulated work.
+int64_t Request(unsigned fanout, nostd::string_view remote, unsigned uid, bool fail, uint64_t &state) {
+    static const auto handle = Tracing::RegisterName("load", "Handle");
+    static const auto call = Tracing::RegisterName("load", "Call");
+    static const auto produce = Tracing::RegisterName("load", "Produce");
+    static const auto consume = Tracing::RegisterName("load", "Consume");
+
+    int64_t work = 0;
+    auto server = Tracing::Instance()->StartSpan(remote, handle, SpanKind::kServer,
+                                                 SampleHint(uid, 1001u, remote.empty()));
+    server.SetAttr("peer", "127.0.0.1");
+    work += Work(state);
+    for (auto i = 0u; i < fanout; i++) {
+        SpanGuard client("", call, SpanKind::kClient, SampleHint(uid, 2001u + i));
+        client.AddEvent("sent");
+        work += Work(state);
+        if (fail && i + 1 == fanout) {
+            client.SetErr(-1);
+        }
+    }
+
+    auto producer = Tracing::Instance()->StartIsolatedSpan("", produce, SpanKind::kProducer, SampleHint(uid, 3001u));
+    {
+        // the consumer only sees the context the producer hands over
+        auto consumer = Tracing::Instance()->StartSpan(producer.ContextView(), consume, SpanKind::kConsumer,
+                                                       SampleHint(uid, 3002u));
+        work += Work(state);
+        Tracing::Instance()->EndSpan(move(consumer));
+    }
+    Tracing::Instance()->EndIsolatedSpan(move(producer));
+
+    Tracing::Instance()->EndSpan(move(server), fail ? -1 : 0, fail ? "failed" : "");
+    return work;
+}
+
+void Worker(const LoadOptions &options, const atomic<bool> &stop, LoadResult &result) {
+    uint64_t state = CustomIdGenerator::Random() | 1u;
+    string remote;
+    while (!stop.load(memory_order_relaxed)) {
+        // half of the requests come with a remote context, the others are roots
+        auto n = result._requests++;
+        remote.clear();
+        if (n % 2 == 0) {
+            Upstream(remote);
+        }
+        auto start = chrono::steady_clock::now();
+        auto work = Request(options._fanout, remote, (unsigned)(n % 100000u) + 1u, n % 100u == 0, state);
+        auto total = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        result._overhead->Record(total > work ? (uint64_t)(total - work) : 0u);
+    }
+}
+
+// WriteConfig: tracing.yml pointing at the mocks
+bool WriteConfig(const string &path, const LoadOptions &options, const MockCollector &zipkin,
+                 const MockAgent &agent) {
+    ofstream out(path, ios::trunc);
+    out << "reporter:\n"
+        << "  logSpans: false\n"
+        << "  jaegerEndpoint: " << agent.Endpoint() << "\n"
+        << "  zipkinEndpoint: " << zipkin.Url() << "\n"
+        << "  enable: true\n"
+        << "  signal: 0\n"
+        << "  shutdown-timeout: 5000\n"
+        << "  queue:\n"
+        << "    group: {enable: " << (options._groupWindow > 0 ? "true" : "false")
+        << ", window: " << options._groupWindow << "}\n"
+        << "recorder:\n"
+        << "  signal: 0\n"
+        << "sampler:\n"
+        << "  ratio: " << options._ratio << "\n";
+    return out.good();
+}
+
+unsigned Arg(int argc, char **argv, int i, unsigned value) {
+    return argc > i ? (unsigned)strtoul(argv[i], nullptr, 10) : value;
+}
+
+int main(int argc, char **argv) {
+    LoadOptions options{Arg(argc, argv, 1, 8u), Arg(argc, argv, 2, 10u), Arg(argc, argv, 3, kMaxRatioValue),
+                        Arg(argc, argv, 4, 3u), Arg(argc, argv, 5, 0u), Arg(argc, argv, 6, 0u)};
+
+    MockCollector zipkin;
+    MockAgent agent;
+    zipkin.Discard(true);
+    auto path = "/tmp/hornet-load." + to_string(getpid()) + ".yml";
+    if (!WriteConfig(path, options, zipkin, agent)) {
+        cout << "cannot write " << path << endl;
+        return 1;
+    }
+    TracingOptions to;
+    to._path = path;
+    to._async = false;
+    Tracing::Init(to);
+    auto before = Tracing::GetStats();
+
+    cout << "threads " << options._threads << ", " << options._seconds << " s, ratio " << options._ratio << "/"
+         << kMaxRatioValue << ", fanout " << options._fanout << ", group window " << options._groupWindow << " ms"
+         << endl;
+    atomic<bool> stop(false);
+    vector<LoadResult> results(options._threads);
+    vector<thread> workers;
+    auto start = chrono::steady_clock::now();
+    for (auto i = 0u; i < options._threads; i++) {
+        workers.emplace_back([&options, &stop, &results, i]() { Worker(options, stop, results[i]); });
+    }
+    this_thread::sleep_for(chrono::seconds(options._seconds));
+    stop.store(true);
+    for (auto &w : workers) {
+        w.join();
+    }
+    auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    auto flushed = Tracing::Shutdown(chrono::seconds(5));
+    this_thread::sleep_for(chrono::milliseconds(200)); // the last datagrams
+    auto after = Tracing::GetStats();
+    unlink(path.c_str());
+
+    uint64_t requests = 0;
+    Histogram overhead;
+    for (const auto &r : results) {
+        requests += r._requests;
+        overhead.Merge(*r._overhead);
+    }
+    auto delta = [&before, &after](StatsCounter counter) {
+        return after._counters[counter] - before._counters[counter];
+    };
+    auto spans = delta(kStatsSpansStarted);
+    auto p99 = overhead.Percentile(99) / 1000u;
+
+    cout << "requests " << requests << " (" << (uint64_t)((double)requests / elapsed) << "/s), spans " << spans << " ("
+         << (uint64_t)((double)spans / elapsed) << "/s)" << endl;
+    cout << "overhead per request: p50 " << overhead.Percentile(50) << " ns, p90 " << overhead.Percentile(90)
+         << " ns, p99 " << overhead.Percentile(99) << " ns, max " << overhead.Max() << " ns" << endl;
+    cout << "spans sampled " << delta(kStatsSpansSampled) << ", exported " << delta(kStatsSpansExported)
+         << (flushed ? "" : " (flush timed out)") << endl;
+    cout << "dropped: sampler " << delta(kStatsDropSampler) << ", queue-full " << delta(kStatsDropQueueFull)
+         << ", budget " << delta(kStatsDropBudget) << " (queued error " << delta(kStatsDropLaneError) << ", debug "
+         << delta(kStatsDropLaneDebug) << ", normal " << delta(kStatsDropLaneNormal) << "), export "
+         << delta(kStatsDropExport) << ", oversize " << delta(kStatsDropOversize) << ", shed "
+         << delta(kStatsExportShed) << " batches" << endl;
+    auto exported = max(delta(kStatsSpansExported), (uint64_t)1);
+    cout << "zipkin collector: " << zipkin.Count() << " requests, " << zipkin.Bytes() << " bytes; jaeger agent: "
+         << agent.Datagrams() << " datagrams, " << agent.Bytes() << " bytes; "
+         << (zipkin.Bytes() + agent.Bytes()) / exported << " bytes per span" << endl;
+
+    if (options._maxP99 > 0 && p99 > options._maxP99) {
+        cout << "FAIL p99 overhead " << p99 << " us over " << options._maxP99 << " us" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace tracing {
+
+// MockRequest: one request seen by MockCollector
+struct MockRequest {
+    unsigned _connection; // which accepted connection it came on
+    bool _gzip;           // Content-Encoding: gzip
+    std::string _body;
+    int _status; // answered with
+};
+
+// MockCollector: a minimal HTTP/1.1 collector on 127.0.0.1 for tests, keep-alive and Content-Length bodies only.
+// Answers with the scripted status codes in order, then 200.
+class MockCollector final {
+public:
+    MockCollector()
+        : _fd(-1)
+        , _port(0)
+        , _stop(false)
+        , _connections(0)
+        , _mtx()
+        , _script()
+        , _delay(0)
+        , _discard(false)
+        , _requests()
+        , _count(0)
+        , _bytes(0)
+        , _acceptor()
+        , _workers() {
+        _fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (bind(_fd, (sockaddr *)&addr, len) != 0 || listen(_fd, 16) != 0 ||
+            getsockname(_fd, (sockaddr *)&addr, &len) != 0) {
+            return;
+        }
+        _port = ntohs(addr.sin_port);
+        _acceptor = std::thread([this]() { accept(); });
+    }
+
+    ~MockCollector() {
+        _stop.store(true);
+        if (_acceptor.joinable()) {
+            _acceptor.join();
+        }
+        for (auto &w : _workers) {
+            w.join();
+        }
+        close(_fd);
+    }
+
+public:
+    std::string Url() const {
+        return "http://127.0.0.1:" + std::to_string(_port) + "/api/v2/spans";
+    }
+
+    // Script: answer the next requests with these status codes
+    void Script(std::vector<int> statuses) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _script.insert(_script.end(), statuses.begin(), statuses.end());
+    }
+
+    // Delay: answer every request this late
+    void Delay(std::chrono::milliseconds delay) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _delay = delay;
+    }
+
+    // Discard: count the requests without keeping them, for load tests
+    void Discard(bool discard) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _discard = discard;
+    }
+
+    std::vector<MockRequest> Requests() {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _requests;
+    }
+
+    unsigned Connections() const {
+        return _connections.load();
+    }
+
+    // Count: requests seen, kept or not
+    uint64_t Count() {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _count;
+    }
+
+    // Bytes: body bytes of the requests seen, as sent
+    uint64_t Bytes() {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _bytes;
+    }
+
+private:
+    void accept() {
+        while (!_stop.load()) {
+            pollfd pfd{_fd, POLLIN, 0};
+            if (poll(&pfd, 1, 20) <= 0) {
+                continue;
+            }
+            auto conn = ::accept(_fd, nullptr, nullptr);
+            if (conn < 0) {
+                continue;
+            }
+            auto id = _connections.fetch_add(1);
+            _workers.emplace_back([this, conn, id]() { serve(conn, id); });
+        }
+    }
+
+    void serve(int conn, unsigned id) {
+        std::string buffer;
+        char chunk[4096];
+        while (!_stop.load()) {
+            auto end = buffer.find("\r\n\r\n");
+            if (end == std::string::npos) {
+                if (!receive(conn, chunk, sizeof(chunk), buffer)) {
+                    break;
+                }
+                continue;
+            }
+            auto headers = buffer.substr(0, end + 2);
+            for (auto &c : headers) {
+                c = (char)tolower(c);
+            }
+            size_t length = 0;
+            auto pos = headers.find("\r\ncontent-length:");
+            if (pos != std::string::npos) {
+                length = (size_t)strtoul(headers.c_str() + pos + 17, nullptr, 10);
+            }
+            auto total = end + 4 + length;
+            while (buffer.size() < total && receive(conn, chunk, sizeof(chunk), buffer)) {
+            }
+            if (buffer.size() < total) {
+                break;
+            }
+
+            MockRequest req{id, headers.find("\r\ncontent-encoding: gzip") != std::string::npos,
+                            buffer.substr(end + 4, length), 200};
+            buffer.erase(0, total);
+            std::chrono::milliseconds delay(0);
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                if (!_script.empty()) {
+                    req._status = _script.front();
+                    _script.pop_front();
+                }
+                delay = _delay;
+                ++_count;
+                _bytes += req._body.size();
+                if (!_discard) {
+                    _requests.push_back(req);
+                }
+            }
+            std::this_thread::sleep_for(delay);
+            auto resp = "HTTP/1.1 " + std::to_string(req._status) + " Mock\r\nContent-Length: 0\r\n\r\n";
+            if (send(conn, resp.data(), resp.size(), MSG_NOSIGNAL) < 0) {
+                break;
+            }
+        }
+        close(conn);
+    }
+
+    bool receive(int conn, char *chunk, size_t size, std::string &buffer) {
+        while (!_stop.load()) {
+            pollfd pfd{conn, POLLIN, 0};
+            if (poll(&pfd, 1, 20) <= 0) {
+                continue;
+            }
+            auto n = recv(conn, chunk, size, 0);
+            if (n <= 0) {
+                return false;
+            }
+            buffer.append(chunk, (size_t)n);
+            return true;
+        }
+        return false;
+    }
+
+private:
+    int _fd;
+    uint16_t _port;
+    std::atomic<bool> _stop;
+    std::atomic<unsigned> _connections;
+
+    std::mutex _mtx; // guards the fields below
+    std::deque<int> _script;
+    std::chrono::milliseconds _delay;
+    bool _discard;
+    std::vector<MockRequest> _requests;
+    uint64_t _count;
+    uint64_t _bytes;
+
+    std::thread _acceptor;
+    std::vector<std::thread> _workers; // only touched by the acceptor, joined after it
+};
+
+// MockAgent: a UDP socket on 127.0.0.1 standing in for jaeger-agent, datagrams are counted and discarded
+class MockAgent final {
+public:
+    MockAgent()
+        : _fd(socket(AF_INET, SOCK_DGRAM, 0))
+        , _port(0)
+        , _stop(false)
+        , _datagrams(0)
+        , _bytes(0)
+        , _drainer() {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        int size = 8 << 20;
+        setsockopt(_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        if (bind(_fd, (sockaddr *)&addr, len) != 0 || getsockname(_fd, (sockaddr *)&addr, &len) != 0) {
+            return;
+        }
+        _port = ntohs(addr.sin_port);
+        _drainer = std::thread([this]() { drain(); });
+    }
+
+    ~MockAgent() {
+        _stop.store(true);
+        if (_drainer.joinable()) {
+            _drainer.join();
+        }
+        close(_fd);
+    }
+
+public:
+    std::string Endpoint() const {
+        return "127.0.0.1:" + std::to_string(_port);
+    }
+
+    uint64_t Datagrams() const {
+        return _datagrams.load();
+    }
+
+    uint64_t Bytes() const {
+        return _bytes.load();
+    }
+
+private:
+    void drain() {
+        char buffer[65536];
+        while (!_stop.load()) {
+            pollfd pfd{_fd, POLLIN, 0};
+            if (poll(&pfd, 1, 20) <= 0) {
+                continue;
+            }
+            auto n = recv(_fd, buffer, sizeof(buffer), 0);
+            if (n >= 0) {
+                _datagrams.fetch_add(1);
+                _bytes.fetch_add((uint64_t)n);
+            }
+        }
+    }
+
+private:
+    int _fd;
+    uint16_t _port;
+    std::atomic<bool> _stop;
+    std::atomic<uint64_t> _datagrams;
+    std::atomic<uint64_t> _bytes;
+    std::thread _drainer;
+};
+
+} // namespace tracing
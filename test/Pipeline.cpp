@@ -0,0 +1,328 @@
+#include <opentelemetry/sdk/trace/span_data.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Budget.h"
+#include "Check.h"
+#include "Pipeline.h"
+#include "Stats.h"
+
+using namespace std;
+using namespace tracing;
+using namespace opentelemetry;
+
+using Batch = vector<string>;
+
+// Sink: what the exporter was given, batch by batch
+struct Sink {
+    mutex _mtx;
+    condition_variable _cv;
+    vector<Batch> _batches;
+    bool _gated = false;   // Export() waits until opened
+    bool _entered = false; // an Export() call is waiting at the gate
+    bool _shutdown = false;
+
+    void Open() {
+        lock_guard<mutex> lock(_mtx);
+        _gated = false;
+        _cv.notify_all();
+    }
+    void WaitEntered() {
+        unique_lock<mutex> lock(_mtx);
+        _cv.wait(lock, [this]() { return _entered; });
+    }
+    vector<Batch> Batches() {
+        lock_guard<mutex> lock(_mtx);
+        return _batches;
+    }
+    Batch Spans() {
+        Batch all;
+        for (const auto &batch : Batches()) {
+            all.insert(all.end(), batch.begin(), batch.end());
+        }
+        return all;
+    }
+};
+
+// SinkExporter: records the names of the spans exported into a Sink
+class SinkExporter final : public sdk::trace::SpanExporter {
+public:
+    explicit SinkExporter(shared_ptr<Sink> sink)
+        : _sink(move(sink)) {}
+
+    unique_ptr<sdk::trace::Recordable> MakeRecordable() noexcept override {
+        return unique_ptr<sdk::trace::Recordable>(new sdk::trace::SpanData);
+    }
+    sdk::common::ExportResult Export(const nostd::span<unique_ptr<sdk::trace::Recordable>> &spans) noexcept override {
+        Batch batch;
+        for (const auto &span : spans) {
+            auto name = static_cast<sdk::trace::SpanData *>(span.get())->GetName();
+            batch.emplace_back(name.data(), name.size());
+        }
+        unique_lock<mutex> lock(_sink->_mtx);
+        _sink->_entered = true;
+        _sink->_cv.notify_all();
+        _sink->_cv.wait(lock, [this]() { return !_sink->_gated; });
+        _sink->_batches.push_back(move(batch));
+        return sdk::common::ExportResult::kSuccess;
+    }
+    bool Shutdown(chrono::microseconds) noexcept override {
+        lock_guard<mutex> lock(_sink->_mtx);
+        _sink->_shutdown = true;
+        return true;
+    }
+
+private:
+    shared_ptr<Sink> _sink;
+};
+
+// Options: no timed export, batches only once full or flushed
+PriorityProcessorOptions Options(size_t queue, size_t batch) {
+    PriorityProcessorOptions options;
+    options._maxQueueSize = queue;
+    options._maxBatchSize = batch;
+    options._delay = chrono::hours(1);
+    options._laneSizes = {{queue, queue, queue}};
+    return options;
+}
+
+// End: a span named name of trace ended in lane
+void End(PriorityProcessor &processor, ExportLane lane, const string &name,
+         const trace::TraceId &trace = trace::TraceId()) {
+    auto span = processor.MakeRecordable();
+    span->SetName(name);
+    PriorityProcessor::EndScope scope(lane, trace);
+    processor.OnEnd(move(span));
+}
+
+// Trace: a trace id of n in every byte
+trace::TraceId Trace(uint8_t n) {
+    uint8_t id[trace::TraceId::kSize];
+    memset(id, n, sizeof(id));
+    return trace::TraceId(id);
+}
+
+// Contiguous: whether the spans of each trace (the first letter of the name) are one run of the batch
+bool Contiguous(const Batch &batch) {
+    string seen;
+    for (size_t i = 0; i < batch.size(); i++) {
+        auto trace = batch[i][0];
+        if (i > 0 && batch[i - 1][0] == trace) {
+            continue;
+        }
+        if (seen.find(trace) != string::npos) {
+            return false;
+        }
+        seen.push_back(trace);
+    }
+    return true;
+}
+
+// WaitBatches: until the exporter got n batches, false after a second
+bool WaitBatches(Sink &sink, size_t n) {
+    for (auto i = 0; i < 1000 && sink.Batches().size() < n; i++) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    return sink.Batches().size() >= n;
+}
+
+uint64_t Counter(StatsCounter counter) {
+    return Stats::Snapshot()._counters[counter];
+}
+
+void Evict() {
+    auto sink = make_shared<Sink>();
+    PriorityProcessor processor(unique_ptr<sdk::trace::SpanExporter>(new SinkExporter(sink)), Options(4, 64));
+    auto normal = Counter(kStatsDropLaneNormal);
+    auto debug = Counter(kStatsDropLaneDebug);
+    auto error = Counter(kStatsDropLaneError);
+    auto total = Counter(kStatsDropQueueFull);
+    for (auto i = 0; i < 4; i++) {
+        End(processor, kLaneNormal, "n" + to_string(i));
+    }
+    End(processor, kLaneError, "e0");
+    End(processor, kLaneDebug, "d0");
+    Check(Counter(kStatsDropLaneNormal) - normal == 2, "evict: two normal spans evicted and counted");
+    End(processor, kLaneError, "e1");
+    End(processor, kLaneError, "e2");
+    End(processor, kLaneNormal, "n4");
+    Check(Counter(kStatsDropLaneNormal) - normal == 5, "evict: a normal span is dropped once nothing is lower");
+    End(processor, kLaneError, "e3");
+    Check(Counter(kStatsDropLaneDebug) - debug == 1, "evict: debug evicted for error once normal is empty");
+    End(processor, kLaneError, "e4");
+    Check(Counter(kStatsDropLaneError) - error == 1, "evict: an error span is dropped once the queue is all errors");
+    Check(Counter(kStatsDropQueueFull) - total == 7, "evict: the total counts every lane");
+    processor.ForceFlush(chrono::seconds(5));
+    Check(sink->Spans() == Batch({"e0", "e1", "e2", "e3"}), "evict: the oldest of the lowest lane goes first");
+}
+
+void LaneCaps() {
+    auto sink = make_shared<Sink>();
+    auto options = Options(16, 64);
+    options._laneSizes = {{1, 2, 16}};
+    PriorityProcessor processor(unique_ptr<sdk::trace::SpanExporter>(new SinkExporter(sink)), options);
+    auto error = Counter(kStatsDropLaneError);
+    auto debug = Counter(kStatsDropLaneDebug);
+    for (auto i = 0; i < 3; i++) {
+        End(processor, kLaneError, "e" + to_string(i));
+        End(processor, kLaneDebug, "d" + to_string(i));
+    }
+    Check(Counter(kStatsDropLaneError) - error == 2, "caps: error lane holds 1");
+    Check(Counter(kStatsDropLaneDebug) - debug == 1, "caps: debug lane holds 2");
+    processor.ForceFlush(chrono::seconds(5));
+    Check(sink->Spans() == Batch({"e0", "d0", "d1"}), "caps: the spans over the cap are dropped, not the queued");
+}
+
+void Weights() {
+    auto sink = make_shared<Sink>();
+    sink->_gated = true;
+    auto options = Options(16, 4);
+    options._laneWeights = {{2, 1, 1}};
+    PriorityProcessor processor(unique_ptr<sdk::trace::SpanExporter>(new SinkExporter(sink)), options);
+    // a full batch keeps the export thread at the gate while the lanes fill
+    for (auto i = 0; i < 4; i++) {
+        End(processor, kLaneNormal, "w" + to_string(i));
+    }
+    sink->WaitEntered();
+    for (auto name : {"e0", "e1", "e2"}) {
+        End(processor, kLaneError, name);
+    }
+    for (auto name : {"d0", "d1"}) {
+        End(processor, kLaneDebug, name);
+    }
+    for (auto name : {"n0", "n1"}) {
+        End(processor, kLaneNormal, name);
+    }
+    sink->Open();
+    processor.ForceFlush(chrono::seconds(5));
+    auto batches = sink->Batches();
+    Check(batches.size() == 3, "weights: three batches");
+    Check(batches.size() == 3 && batches[1] == Batch({"e0", "e1", "d0", "n0"}), "weights: 2 error, 1 debug, 1 normal");
+    Check(batches.size() == 3 && batches[2] == Batch({"e2", "d1", "n1"}), "weights: the next round");
+}
+
+void BudgetEvict() {
+    auto sink = make_shared<Sink>();
+    PriorityProcessor processor(unique_ptr<sdk::trace::SpanExporter>(new SinkExporter(sink)), Options(16, 64));
+    for (auto i = 0; i < 3; i++) {
+        End(processor, kLaneNormal, "n" + to_string(i));
+    }
+    End(processor, kLaneDebug, "d0");
+    auto normal = Counter(kStatsDropLaneNormal);
+    auto debug = Counter(kStatsDropLaneDebug);
+    auto full = Counter(kStatsDropQueueFull);
+    auto budget = Counter(kStatsDropBudget);
+    BudgetOptions options;
+    options._maxBytes = kBudgetChunk;
+    Budget::Setup(options);
+    {
+        BudgetHold hold(kBudgetChunk); // the budget is used up by others
+        End(processor, kLaneDebug, "d1");
+    }
+    Budget::Setup(BudgetOptions());
+    Check(Counter(kStatsDropLaneNormal) - normal == 3, "budget: lower lanes evicted and counted per lane");
+    Check(Counter(kStatsDropLaneDebug) - debug == 1, "budget: the span is dropped once nothing is lower");
+    Check(Counter(kStatsDropBudget) - budget == 4, "budget: counted as budget drops");
+    Check(Counter(kStatsDropQueueFull) == full, "budget: not as queue-full drops");
+    processor.ForceFlush(chrono::seconds(5));
+    Check(sink->Spans() == Batch({"d0"}), "budget: the same lane is kept");
+}
+
+// GroupOptions: every run is recent enough to be held back
+PriorityProcessorOptions GroupOptions() {
+    auto options = Options(64, 8);
+    options._group = true;
+    options._groupWindow = chrono::hours(1);
+    return options;
+}
+
+void Group() {
+    auto sink = make_shared<Sink>();
+    PriorityProcessor processor(unique_ptr<sdk::trace::SpanExporter>(new SinkExporter(sink)), GroupOptions());
+    // a full batch of two traces, half a batch is held back
+    for (auto i = 0; i < 4; i++) {
+        End(processor, kLaneNormal, "a" + to_string(i), Trace(1));
+        End(processor, kLaneNormal, "b" + to_string(i), Trace(2));
+    }
+    Check(WaitBatches(*sink, 1), "group: first batch");
+    Check(sink->Batches()[0] == Batch({"b0", "b1", "b2", "b3"}), "group: one run held back, the other exported");
+    Check(Stats::QueueDepth() == 4, "group: the run held back is still queued");
+    // the next batch takes the held back run first, and never holds it again
+    for (auto i = 0; i < 8; i++) {
+        End(processor, kLaneNormal, "c" + to_string(i), Trace(3));
+    }
+    Check(WaitBatches(*sink, 2), "group: second batch");
+    Check(sink->Batches()[1] == Batch({"a0", "a1", "a2", "a3"}), "group: the run held back goes with the next batch");
+    End(processor, kLaneNormal, "d0", Trace(4));
+    End(processor, kLaneNormal, "c8", Trace(3));
+    End(processor, kLaneNormal, "d1", Trace(4));
+    processor.ForceFlush(chrono::seconds(5));
+    auto batches = sink->Batches();
+    auto ok = true;
+    for (const auto &batch : batches) {
+        ok = ok && Contiguous(batch);
+    }
+    Check(ok, "group: one run per trace in each batch");
+    Check(batches.size() == 4 && batches[2].size() == 8 && batches[3] == Batch({"c8", "d0", "d1"}),
+          "group: a flush holds nothing back");
+    Check(Stats::QueueDepth() == 0, "group: queue depth back to 0");
+}
+
+void GroupBudget() {
+    auto sink = make_shared<Sink>();
+    PriorityProcessor processor(unique_ptr<sdk::trace::SpanExporter>(new SinkExporter(sink)), GroupOptions());
+    for (auto i = 0; i < 4; i++) {
+        End(processor, kLaneNormal, "a" + to_string(i), Trace(1));
+        End(processor, kLaneNormal, "b" + to_string(i), Trace(2));
+    }
+    Check(WaitBatches(*sink, 1) && Stats::QueueDepth() == 4, "group budget: a run held back");
+    auto normal = Counter(kStatsDropLaneNormal);
+    BudgetOptions options;
+    options._maxBytes = kBudgetChunk;
+    Budget::Setup(options);
+    {
+        BudgetHold hold(kBudgetChunk);
+        End(processor, kLaneError, "e0", Trace(5));
+    }
+    Budget::Setup(BudgetOptions());
+    Check(Counter(kStatsDropLaneNormal) - normal == 4, "group budget: the run held back is evicted");
+    Check(Stats::QueueDepth() == 0, "group budget: and no longer queued");
+    processor.ForceFlush(chrono::seconds(5));
+    Check(sink->Spans() == Batch({"b0", "b1", "b2", "b3"}), "group budget: nothing else exported");
+}
+
+void Drain() {
+    auto sink = make_shared<Sink>();
+    PriorityProcessor processor(unique_ptr<sdk::trace::SpanExporter>(new SinkExporter(sink)), Options(64, 8));
+    for (auto i = 0; i < 20; i++) {
+        End(processor, kLaneNormal, "f" + to_string(i));
+    }
+    Check(processor.ForceFlush(chrono::seconds(5)), "drain: flushed in time");
+    Check(sink->Spans().size() == 20, "drain: flush exports everything queued");
+    for (auto i = 0; i < 5; i++) {
+        End(processor, kLaneError, "s" + to_string(i));
+    }
+    Check(processor.Shutdown(chrono::seconds(5)), "drain: shut down");
+    Check(sink->Spans().size() == 25 && sink->_shutdown, "drain: shutdown exports the rest, then the exporter");
+    End(processor, kLaneError, "late");
+    Check(sink->Spans().size() == 25, "drain: nothing is queued after shutdown");
+    Check(Stats::QueueDepth() == 0, "drain: queue depth back to 0");
+}
+
+int main() {
+    Evict();
+    LaneCaps();
+    Weights();
+    BudgetEvict();
+    Group();
+    GroupBudget();
+    Drain();
+    return failures == 0 ? 0 : 1;
+}
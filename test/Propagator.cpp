@@ -0,0 +1,117 @@
+#include <opentelemetry/common/key_value_iterable_view.h>
+#include <opentelemetry/sdk/trace/samplers/always_on.h>
+#include <opentelemetry/sdk/trace/samplers/parent.h>
+#include <opentelemetry/trace/span_context_kv_iterable.h>
+
+#include <map>
+#include <string>
+
+#include "Check.h"
+#include "Common.h"
+#include "Propagator.h"
+#include "Sampler.h"
+
+using namespace std;
+using namespace tracing;
+using namespace opentelemetry;
+
+constexpr const char *kTraceId = "4bf92f3577b34da6a3ce929d0e0e4736";
+constexpr const char *kSpanId = "00f067aa0ba902b7";
+
+// Extract: the remote context the propagator finds in the headers
+trace::SpanContext Extract(const map<string, string> &headers) {
+    CustomCarrier carrier;
+    for (const auto &header : headers) {
+        carrier.Set(header.first, header.second);
+    }
+    CustomPropagator propagator;
+    auto ctx = context::Context();
+    return trace::GetSpan(propagator.Extract(carrier, ctx))->GetContext();
+}
+
+void W3C() {
+    auto parent = string("00-") + kTraceId + "-" + kSpanId + "-01";
+    auto ctx = Extract({{w3c::kTraceParent, parent}});
+    Check(ctx.IsValid() && ctx.IsSampled() && ctx.IsRemote(), "w3c: sampled");
+    Check(FormatTraceId(ctx.trace_id()) == kTraceId && FormatSpanId(ctx.span_id()) == kSpanId, "w3c: ids");
+
+    Check(!Extract({{w3c::kTraceParent, parent.substr(0, parent.size() - 1)}}).IsValid(), "w3c: one char short");
+    Check(!Extract({{w3c::kTraceParent, parent + "0"}}).IsValid(), "w3c: one char over on version 00");
+    Check(Extract({{w3c::kTraceParent, "01" + parent.substr(2) + "-future"}}).IsValid(), "w3c: later version appends");
+    Check(!Extract({{w3c::kTraceParent, "ff" + parent.substr(2)}}).IsValid(), "w3c: version ff");
+    Check(!Extract({{w3c::kTraceParent, "00-4bf92f3577b34da6a3ce929d0e0e473g-00f067aa0ba902b7-01"}}).IsValid(),
+          "w3c: not hex");
+    Check(!Extract({{w3c::kTraceParent, "00-4bf92f3577b34da6a3ce929d0e0e4736_00f067aa0ba902b7-01"}}).IsValid(),
+          "w3c: no dash");
+    Check(!Extract({{w3c::kTraceParent, "00-00000000000000000000000000000000-00f067aa0ba902b7-01"}}).IsValid(),
+          "w3c: all-zero trace id");
+    Check(!Extract({{w3c::kTraceParent, "00-4bf92f3577b34da6a3ce929d0e0e4736-0000000000000000-01"}}).IsValid(),
+          "w3c: all-zero span id");
+}
+
+void B3() {
+    auto ctx = Extract({{b3::kSingle, string(kTraceId) + "-" + kSpanId + "-1"}});
+    Check(ctx.IsValid() && ctx.IsSampled(), "b3: sampled");
+    Check(FormatTraceId(ctx.trace_id()) == kTraceId && FormatSpanId(ctx.span_id()) == kSpanId, "b3: ids");
+
+    ctx = Extract({{b3::kSingle, string("a3ce929d0e0e4736-") + kSpanId + "-0"}});
+    Check(ctx.IsValid() && !ctx.IsSampled(), "b3: not sampled");
+    Check(FormatTraceId(ctx.trace_id()) == "0000000000000000a3ce929d0e0e4736", "b3: 64-bit trace id left-padded");
+
+    ctx = Extract({{b3::kSingle, string(kTraceId) + "-" + kSpanId + "-d"}});
+    Check(ctx.IsSampled() && (ctx.trace_flags().flags() & jaeger::kDebugFlag) != 0, "b3: d is debug and sampled");
+
+    ctx = Extract({{b3::kSingle, string(kTraceId) + "-" + kSpanId}});
+    Check(ctx.IsValid() && !ctx.IsSampled() && (ctx.trace_flags().flags() & b3::kDeferFlag) != 0,
+          "b3: no sampling state defers");
+
+    Check(!Extract({{b3::kSingle, "1"}}).IsValid(), "b3: sampling state only");
+    Check(!Extract({{b3::kSingle, string(kTraceId) + "-" + kSpanId + "-x"}}).IsValid(), "b3: bad sampling state");
+    Check(!Extract({{b3::kSingle, string(kTraceId) + "-" + kSpanId + "0"}}).IsValid(), "b3: span id one char over");
+    Check(!Extract({{b3::kSingle, string(kTraceId).substr(1) + "-" + kSpanId}}).IsValid(),
+          "b3: trace id one char short");
+}
+
+void B3Multi() {
+    auto ctx = Extract({{b3::kTraceId, kTraceId}, {b3::kSpanId, kSpanId}, {b3::kSampled, "1"}});
+    Check(ctx.IsValid() && ctx.IsSampled(), "x-b3: sampled");
+
+    ctx = Extract({{b3::kTraceId, "a3ce929d0e0e4736"}, {b3::kSpanId, kSpanId}, {b3::kSampled, "0"}});
+    Check(ctx.IsValid() && !ctx.IsSampled(), "x-b3: not sampled");
+    Check(FormatTraceId(ctx.trace_id()) == "0000000000000000a3ce929d0e0e4736", "x-b3: 64-bit trace id left-padded");
+
+    ctx = Extract({{b3::kTraceId, kTraceId}, {b3::kSpanId, kSpanId}, {b3::kFlags, "1"}});
+    Check(ctx.IsSampled() && (ctx.trace_flags().flags() & jaeger::kDebugFlag) != 0, "x-b3: flags 1 is debug");
+
+    ctx = Extract({{b3::kTraceId, kTraceId}, {b3::kSpanId, kSpanId}});
+    Check(ctx.IsValid() && (ctx.trace_flags().flags() & b3::kDeferFlag) != 0, "x-b3: no x-b3-sampled defers");
+
+    Check(!Extract({{b3::kTraceId, kTraceId}, {b3::kSpanId, "00f067aa0ba902b"}}).IsValid(),
+          "x-b3: span id one char short");
+}
+
+// Defer: a deferred parent is decided by the root sampler, a parent with a decision by the delegate
+void Defer() {
+    shared_ptr<sdk::trace::Sampler> root(new sdk::trace::AlwaysOnSampler);
+    DeferSampler sampler(unique_ptr<sdk::trace::Sampler>(new sdk::trace::ParentBasedSampler(root)), root);
+
+    map<string, int> none;
+    common::KeyValueIterableView<map<string, int>> attr(none);
+    trace::NullSpanContext link;
+    auto decide = [&](const trace::SpanContext &parent) {
+        return sampler.ShouldSample(parent, parent.trace_id(), "defer", trace::SpanKind::kServer, attr, link).decision;
+    };
+    auto deferred = Extract({{b3::kSingle, string(kTraceId) + "-" + kSpanId}});
+    Check(decide(deferred) == sdk::trace::Decision::RECORD_AND_SAMPLE, "defer: no sampling state is decided here");
+    auto dropped = Extract({{b3::kSingle, string(kTraceId) + "-" + kSpanId + "-0"}});
+    Check(decide(dropped) == sdk::trace::Decision::DROP, "defer: a remote decision is kept");
+    Check(decide(trace::SpanContext::GetInvalid()) == sdk::trace::Decision::RECORD_AND_SAMPLE, "defer: roots as is");
+}
+
+int main() {
+    W3C();
+    B3();
+    B3Multi();
+    Defer();
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,84 @@
+#include <string>
+
+#include "Check.h"
+#include "Common.h"
+#include "Stats.h"
+#include "Throttle.h"
+
+using namespace std;
+using namespace tracing;
+
+constexpr size_t kQueueSize = 1000;
+
+// Setup: a fresh controller with the default options over an empty queue
+ThrottleOptions Setup() {
+    Stats::AddQueueDepth(-Stats::QueueDepth());
+    ThrottleOptions options;
+    Throttle::Setup(options, kQueueSize);
+    Throttle::Update(); // takes the counters as they are now
+    return options;
+}
+
+void Cut() {
+    Setup();
+    Check(Throttle::Scale() == kMaxRatioValue, "cut: full scale while the queue is empty");
+
+    // nothing sampled in the step, halved
+    Stats::Add(kStatsDropQueueFull);
+    Throttle::Update();
+    Check(Throttle::Scale() == kMaxRatioValue / 2, "cut: halved on queue-full drops");
+
+    // over budget counts as overflow too, towards 0.8 * out / in but no faster than halving
+    Stats::Add(kStatsSpansSampled, 1000);
+    Stats::Add(kStatsSpansExported, 1000);
+    Stats::Add(kStatsDropBudget);
+    Throttle::Update();
+    Check(Throttle::Scale() == kMaxRatioValue / 2 * 8 / 10, "cut: towards what the exporter drains on budget drops");
+
+    // no overflow but the queue over high
+    auto before = Throttle::Scale();
+    Stats::AddQueueDepth(kQueueSize * 6 / 10);
+    Throttle::Update();
+    Check(Throttle::Scale() == before / 2, "cut: halved while the queue is over high");
+
+    // between low and high, held
+    Stats::AddQueueDepth(-(int64_t)(kQueueSize * 3 / 10));
+    before = Throttle::Scale();
+    Throttle::Update();
+    Check(Throttle::Scale() == before, "hold: kept between low and high");
+}
+
+void Floor() {
+    auto options = Setup();
+    for (auto i = 0; i < 32; i++) {
+        Stats::Add(kStatsDropQueueFull);
+        Throttle::Update();
+    }
+    Check(Throttle::Scale() == options._minScale, "floor: never under min-scale");
+}
+
+void Recover() {
+    auto options = Setup();
+    for (auto i = 0; i < 32; i++) {
+        Stats::Add(kStatsDropQueueFull);
+        Throttle::Update();
+    }
+    Throttle::Update();
+    Check(Throttle::Scale() == options._minScale + options._recoverStep, "recover: one step once below low");
+
+    auto steps = 0;
+    while (Throttle::Scale() < kMaxRatioValue && steps < 100) {
+        Throttle::Update();
+        steps++;
+    }
+    Check(Throttle::Scale() == kMaxRatioValue, "recover: back to the full scale");
+    Check(steps == (int)((kMaxRatioValue - options._minScale) / options._recoverStep),
+          "recover: by recover-step per step");
+}
+
+int main() {
+    Cut();
+    Floor();
+    Recover();
+    return failures == 0 ? 0 : 1;
+}
@@ -1,7 +1,11 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include <chrono>
 #include <iostream>
 #include <thread>
 
+#include "LogCorrelation.h"
 #include "Tracing.h"
 
 using namespace std;
@@ -55,7 +59,7 @@ bool HexToBinary(const string &hex, uint8_t *buffer, size_t buffer_size) {
 }
 
 void F2() {
-    auto ctx = Tracing::Instance()->StartSpan("", "test", "F1", SpanKind::kServer);
+    auto ctx = Tracing::Instance()->StartSpan(nostd::string_view(), "test", "F1", SpanKind::kServer);
     this_thread::sleep_for(chrono::milliseconds(10));
 
     auto ret = Tracing::ParseFromJaegerContext(Tracing::GetJaegerContext());
@@ -77,12 +81,45 @@ void F1(const string &remote) {
 }
 
 void F3() {
-    auto ctx = Tracing::Instance()->StartIsolatedSpan("", "test", "F3", SpanKind::kClient, uid, cmd, true);
+    static const auto name = Tracing::RegisterName("test", "F3");
+    auto ctx = Tracing::Instance()->StartIsolatedSpan("", name, SpanKind::kClient, SampleHint(uid, cmd, true));
     this_thread::sleep_for(chrono::milliseconds(10));
     Tracing::Instance()->EndIsolatedSpan(move(ctx), 0);
 }
 
+void F4(bool fail) {
+    SpanGuard guard(nostd::string_view(), "test", "F4", SpanKind::kServer, SampleHint(uid, cmd, true));
+    auto ret = Tracing::ParseFromJaegerContext(Tracing::GetJaegerContext());
+    cout << "f4->:" << ret._traceId << "-" << ret._spanId << "-" << ret._parentSpanId << "-" << ret._sampled << endl;
+    cout << "f4 log: " << Tracing::GetLogIds() << endl;
+    guard.AddEvent("parsed");
+    guard.SetAttrLazy("debug", [&ret]() { return "trace " + ret._traceId + " span " + ret._spanId; });
+    if (fail) {
+        guard.SetErr(-1);
+        return; // ended by the guard
+    }
+    this_thread::sleep_for(chrono::milliseconds(10));
+}
+
+// F5: prefork, the child exports on its own and its ids differ from the parent's
+void F5() {
+    auto pid = fork();
+    {
+        SpanGuard guard("", "test", pid == 0 ? "F5.child" : "F5.parent", SpanKind::kServer,
+                        SampleHint(uid, cmd, true));
+        cout << "f5 " << (pid == 0 ? "child" : "parent") << ": " << Tracing::GetLogIds() << endl;
+    }
+    if (pid == 0) {
+        exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+}
+
 int main() {
+    TracingOptions options;
+    options._async = false; // spans of the first requests are not relayed, so the output is stable
+    Tracing::Init(options);
+
     char buffer[strlen(hexParentContext) / 2];
     if (!HexToBinary(hexParentContext, (uint8_t *)buffer, sizeof(buffer))) {
         cout << "invalid parent context" << endl;
@@ -90,7 +127,7 @@ int main() {
     }
 
     cout << "----------------------------------------" << endl;
-    auto ctx = Tracing::ParseFromJaegerContext(string(buffer, sizeof(buffer)));
+    auto ctx = Tracing::ParseFromJaegerContext(nostd::string_view(buffer, sizeof(buffer)));
     cout << "f0:" << ctx._traceId << "-" << ctx._spanId << "-" << ctx._parentSpanId << "-" << ctx._sampled << endl;
     for (const auto &item : ctx._baggage) {
         cout << "\t" << item.first << ": " << item.second << endl;
@@ -123,5 +160,17 @@ int main() {
     F3();
     this_thread::sleep_for(chrono::seconds(2));
 
+    cout << "----------------------------------------" << endl;
+    F4(false);
+    F4(true);
+    this_thread::sleep_for(chrono::seconds(2));
+
+    cout << "----------------------------------------" << endl;
+    F5();
+
+    cout << "----------------------------------------" << endl;
+    cout << "shutdown: " << Tracing::Shutdown(chrono::seconds(2)) << endl;
+    cout << Tracing::GetStats().Format();
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,152 @@
+#include <zlib.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "Check.h"
+#include "MockCollector.h"
+#include "Stats.h"
+#include "Transport.h"
+
+using namespace std;
+using namespace tracing;
+
+// Inflate: gunzip body of at most size bytes, empty on error
+string Inflate(const string &body, size_t size) {
+    z_stream zs{};
+    if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+        return "";
+    }
+    string out(size, '\0');
+    zs.next_in = (Bytef *)body.data();
+    zs.avail_in = (uInt)body.size();
+    zs.next_out = (Bytef *)&out[0];
+    zs.avail_out = (uInt)out.size();
+    auto ret = inflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    inflateEnd(&zs);
+    return ret == Z_STREAM_END ? out : "";
+}
+
+HttpTransportOptions Options(const MockCollector &collector) {
+    HttpTransportOptions options;
+    options._url = collector.Url();
+    options._backoff = chrono::milliseconds(10);
+    options._maxBackoff = chrono::milliseconds(40);
+    options._timeout = chrono::milliseconds(500);
+    options._budget = chrono::milliseconds(2000);
+    return options;
+}
+
+void KeepAlive() {
+    MockCollector collector;
+    HttpTransport transport(Options(collector));
+    auto ok = true;
+    for (auto i = 0; i < 10; i++) {
+        ok = ok && transport.Send("[]") == SendResult::kOk;
+    }
+    Check(ok, "keep-alive: all sent");
+    Check(collector.Requests().size() == 10, "keep-alive: 10 requests");
+    Check(collector.Connections() == 1, "keep-alive: 1 connection");
+}
+
+void Gzip() {
+    MockCollector collector;
+    HttpTransport transport(Options(collector));
+    string body(64 * 1024, 'x');
+    for (size_t i = 0; i < body.size(); i += 7) {
+        body[i] = (char)('a' + i % 26);
+    }
+    Check(transport.Send("[]") == SendResult::kOk, "gzip: small body sent");
+    Check(transport.Send(body) == SendResult::kOk, "gzip: large body sent");
+    auto reqs = collector.Requests();
+    Check(reqs.size() == 2 && !reqs[0]._gzip && reqs[0]._body == "[]", "gzip: small body as is");
+    Check(reqs.size() == 2 && reqs[1]._gzip && reqs[1]._body.size() < body.size(), "gzip: large body compressed");
+    Check(reqs.size() == 2 && Inflate(reqs[1]._body, body.size()) == body, "gzip: round trip");
+}
+
+void Retry() {
+    MockCollector collector;
+    collector.Script({503, 429, 200});
+    HttpTransport transport(Options(collector));
+    auto retries = Stats::Snapshot()._counters[kStatsExportRetries];
+    Check(transport.Send("[]") == SendResult::kOk, "retry: sent after 503 and 429");
+    Check(collector.Requests().size() == 3, "retry: 3 attempts");
+    Check(Stats::Snapshot()._counters[kStatsExportRetries] - retries == 2, "retry: 2 retries counted");
+
+    collector.Script({400});
+    Check(transport.Send("[]") == SendResult::kFailed, "retry: 400 failed");
+    Check(collector.Requests().size() == 4, "retry: 400 not retried");
+}
+
+void Budget() {
+    MockCollector collector;
+    collector.Script(vector<int>(100, 503));
+    auto options = Options(collector);
+    options._budget = chrono::milliseconds(300);
+    options._breakerFailures = 0;
+    HttpTransport transport(options);
+    auto start = chrono::steady_clock::now();
+    Check(transport.Send("[]") == SendResult::kFailed, "budget: failed");
+    auto cost = chrono::steady_clock::now() - start;
+    Check(cost < chrono::milliseconds(400), "budget: gave up within the budget");
+    Check(collector.Requests().size() > 2, "budget: retried meanwhile");
+}
+
+void Breaker() {
+    MockCollector collector;
+    collector.Script(vector<int>(3, 500));
+    auto options = Options(collector);
+    options._breakerFailures = 3;
+    options._breakerCooldown = chrono::milliseconds(200);
+    HttpTransport transport(options);
+    Check(transport.Send("[]") == SendResult::kFailed, "breaker: retries stop once open");
+    auto shed = Stats::Snapshot()._counters[kStatsExportShed];
+    Check(transport.Send("[]") == SendResult::kShed, "breaker: open, shed");
+    Check(collector.Requests().size() == 3, "breaker: nothing sent while open");
+    Check(Stats::Snapshot()._counters[kStatsExportShed] - shed == 1, "breaker: shed counted");
+
+    this_thread::sleep_for(options._breakerCooldown);
+    Check(transport.Send("[]") == SendResult::kOk, "breaker: half-open probe sent");
+    Check(transport.Send("[]") == SendResult::kOk, "breaker: closed again");
+
+    collector.Delay(chrono::milliseconds(50));
+    options._slowThreshold = chrono::milliseconds(20);
+    HttpTransport slow(options);
+    for (auto i = 0; i < 3; i++) {
+        slow.Send("[]");
+    }
+    Check(slow.Send("[]") == SendResult::kShed, "breaker: slow collector, shed");
+}
+
+void Shutdown() {
+    MockCollector collector;
+    collector.Script(vector<int>(100, 503));
+    auto options = Options(collector);
+    options._backoff = chrono::milliseconds(1000);
+    options._maxBackoff = chrono::milliseconds(1000);
+    options._budget = chrono::milliseconds(10000);
+    options._breakerFailures = 0;
+    HttpTransport transport(options);
+    auto start = chrono::steady_clock::now();
+    thread stopper([&transport]() {
+        this_thread::sleep_for(chrono::milliseconds(100));
+        transport.Shutdown();
+    });
+    transport.Send("[]");
+    stopper.join();
+    Check(chrono::steady_clock::now() - start < chrono::milliseconds(1000), "shutdown: retries interrupted");
+    Check(transport.Send("[]") == SendResult::kFailed, "shutdown: no more sends");
+}
+
+int main() {
+    KeepAlive();
+    Gzip();
+    Retry();
+    Budget();
+    Breaker();
+    Shutdown();
+    cout << Stats::Snapshot().Format();
+    return failures == 0 ? 0 : 1;
+}